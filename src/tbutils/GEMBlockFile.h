@@ -0,0 +1,567 @@
+#ifndef GEM_BlockFile
+#define GEM_BlockFile
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMBlockFile                                                         //
+//                                                                      //
+// Raw GEB/VFAT data in independently compressed blocks with an index   //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#ifdef GEM_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef GEM_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "GEMRaw.h"
+#include "GEMConvert.h"
+#include "GEMWriter.h"
+#include "GEMVFATCodec.h"
+
+//! Block-compressed raw container.
+/*!
+  \brief GEMBlockFile
+  The raw stream (binary GEMRaw blocks, or the hex text) is cut at GEB
+  block boundaries into blocks of about blockSize bytes, each compressed on
+  its own, so readers can decompress them in parallel and start at any
+  block. All numbers are little endian.
+
+    file header  32 bytes   kMagic, version, header size, payload (0 binary, 1 hex),
+                            codec, nominal block size
+    block        32 bytes   kBlockMagic, codec, raw size, compressed size,
+                            first event, events, crc32 of the compressed bytes
+                 compressed bytes
+    ...
+    index        32 bytes per block   offset, first event, sizes, events, codec
+    trailer      32 bytes   kIndexMagic, index offset, blocks, events
+
+  zlib is always there; LZ4 and ZSTD are compiled in with -DGEM_WITH_LZ4
+  -llz4 and -DGEM_WITH_ZSTD -lzstd. "vfat" is GEMVFATCodec alone, for
+  binary payloads, "vfat+zlib" its output deflated again (the size of the
+  GEMVFATCodec stream first, 4 bytes). A file without index (a writer that
+  did not finish) is read by following the block headers.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMBlockFile {
+
+  const uint64_t kMagic      = 0x4b434f4c42204d47ULL;   /*!<"GM BLOCK" */
+  const uint64_t kIndexMagic = 0x5845444e49204d47ULL;   /*!<"GM INDEX" */
+  const uint32_t kBlockMagic = 0x4b4c4247;              /*!<"GBLK" */
+  const uint32_t kVersion    = 1;
+  const size_t   kHeaderSize = 32;
+  const size_t   kBlockHeaderSize = 32;
+  const size_t   kIndexEntrySize  = 32;
+
+  enum Payload { kBinary = 0, kHex = 1 };
+  enum Codec { kNone = 0, kZlib = 1, kLZ4 = 2, kZstd = 3, kVFAT = 4, kVFATZlib = 5 };
+
+  inline const char* codecName(int codec) {
+    static const char* names[] = { "none", "zlib", "lz4", "zstd", "vfat", "vfat+zlib" };
+    return (codec >= 0 && codec <= kVFATZlib) ? names[codec] : "unknown";
+  }
+
+  //! The codec knows the GEB/VFAT layout, for binary payloads only.
+  inline bool binaryOnly(int codec) { return codec == kVFAT || codec == kVFATZlib; }
+
+  //! Codec by name, -1 if unknown or not compiled in.
+  inline int codecByName(const std::string& name) {
+    if (name == "none") return kNone;
+    if (name == "zlib") return kZlib;
+    if (name == "vfat") return kVFAT;
+    if (name == "vfat+zlib") return kVFATZlib;
+#ifdef GEM_WITH_LZ4
+    if (name == "lz4")  return kLZ4;
+#endif
+#ifdef GEM_WITH_ZSTD
+    if (name == "zstd") return kZstd;
+#endif
+    return -1;
+  }
+
+  //! One block as listed in the index.
+  struct Entry {
+    uint64_t offset;       /*!<of the block header in the file */
+    uint64_t firstEvent;
+    uint32_t rawSize, compSize, nEvents, codec;
+  };
+
+  inline void put32(unsigned char* p, uint32_t v) { memcpy(p, &v, 4); }
+  inline uint32_t get32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+  //! Compress n bytes with codec into out, false if the codec is not available.
+  inline bool compress(int codec, int level, const char* src, size_t n, std::vector<char>& out) {
+    switch (codec) {
+      case kNone:
+        out.assign(src, src + n);
+        return true;
+      case kZlib: {
+        uLongf len = compressBound(n);
+        out.resize(len);
+        if (compress2((Bytef*)&out[0], &len, (const Bytef*)src, n, level > 0 ? level : 6) != Z_OK) return false;
+        out.resize(len);
+        return true;
+      }
+      case kVFAT:
+        GEMVFATCodec::encode((const unsigned char*)src, n, out);
+        return true;
+      case kVFATZlib: {
+        std::vector<char> v;
+        GEMVFATCodec::encode((const unsigned char*)src, n, v);
+        if (!compress(kZlib, level, v.empty() ? 0 : &v[0], v.size(), out)) return false;
+        out.insert(out.begin(), 4, 0);
+        put32((unsigned char*)&out[0], v.size());
+        return true;
+      }
+#ifdef GEM_WITH_LZ4
+      case kLZ4: {
+        out.resize(LZ4_compressBound(n));
+        int len = LZ4_compress_fast(src, &out[0], n, out.size(), level > 0 ? level : 1);
+        if (len <= 0) return false;
+        out.resize(len);
+        return true;
+      }
+#endif
+#ifdef GEM_WITH_ZSTD
+      case kZstd: {
+        out.resize(ZSTD_compressBound(n));
+        size_t len = ZSTD_compress(&out[0], out.size(), src, n, level > 0 ? level : 3);
+        if (ZSTD_isError(len)) return false;
+        out.resize(len);
+        return true;
+      }
+#endif
+    }
+    return false;
+  }
+
+  //! Decompress into dst of exactly rawSize bytes.
+  inline bool decompress(int codec, const char* src, size_t n, char* dst, size_t rawSize) {
+    switch (codec) {
+      case kNone:
+        if (n != rawSize) return false;
+        memcpy(dst, src, n);
+        return true;
+      case kZlib: {
+        uLongf len = rawSize;
+        return uncompress((Bytef*)dst, &len, (const Bytef*)src, n) == Z_OK && len == rawSize;
+      }
+      case kVFAT:
+        return GEMVFATCodec::decode((const unsigned char*)src, n, (unsigned char*)dst, rawSize);
+      case kVFATZlib: {
+        if (n < 4) return false;
+        std::vector<char> v(get32((const unsigned char*)src) + 1);
+        return decompress(kZlib, src + 4, n - 4, &v[0], v.size() - 1)
+            && GEMVFATCodec::decode((const unsigned char*)&v[0], v.size() - 1, (unsigned char*)dst, rawSize);
+      }
+#ifdef GEM_WITH_LZ4
+      case kLZ4:
+        return LZ4_decompress_safe(src, dst, n, rawSize) == (int)rawSize;
+#endif
+#ifdef GEM_WITH_ZSTD
+      case kZstd:
+        return ZSTD_decompress(dst, rawSize, src, n) == rawSize;
+#endif
+    }
+    return false;
+  }
+
+  //! A whole block record, header and compressed bytes, of nEvents GEB blocks; firstEvent is set by the writer.
+  inline bool pack(int codec, int level, const char* raw, size_t n, uint32_t nEvents, std::vector<char>& out) {
+    std::vector<char> comp;
+    if (!compress(codec, level, raw, n, comp)) return false;
+    if (comp.size() >= n && codec != kNone) {
+      // incompressible, kept as it is
+      codec = kNone;
+      comp.assign(raw, raw + n);
+    }
+    out.resize(kBlockHeaderSize + comp.size());
+    unsigned char* h = (unsigned char*)&out[0];
+    memset(h, 0, kBlockHeaderSize);
+    put32(h, kBlockMagic);
+    put32(h + 4, codec);
+    put32(h + 8, n);
+    put32(h + 12, comp.size());
+    put32(h + 24, nEvents);
+    put32(h + 28, crc32(0, (const Bytef*)&comp[0], comp.size()));
+    if (!comp.empty()) memcpy(&out[kBlockHeaderSize], &comp[0], comp.size());
+    return true;
+  }
+
+} // end of GEMBlockFile
+
+//! Writes a GEMBlockFile.
+/*!
+  \brief GEMBlockWriter
+  Has the put/binary/hex/endBlock calls of GEMWriter, so the gem-re-write.cc
+  write functions fill either. endBlock() marks the end of a GEB block and
+  compresses once blockSize bytes are collected; whole blocks made by other
+  threads (GEMBlockFile::pack) are added with writePacked().
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMBlockWriter {
+  public:
+
+      GEMBlockWriter() : nBlocks(0), nRaw(0), nEvents(0), fCodec(GEMBlockFile::kZlib), fLevel(0), fBlockSize(1 << 20), fPending(0), fOffset(0) {}
+
+      ~GEMBlockWriter() { close(); }
+
+      bool open(const std::string& path, int codec, int payload, size_t blockSize = 1 << 20, int level = 0) {
+        if (payload != GEMBlockFile::kBinary && GEMBlockFile::binaryOnly(codec)) {
+          error = std::string(GEMBlockFile::codecName(codec)) + " needs a binary payload";
+          return false;
+        }
+        fCodec = codec;
+        fLevel = level;
+        fBlockSize = blockSize ? blockSize : 1 << 20;
+        fIndex.clear();
+        fRaw.clear();
+        if (!fFile.open(path, false)) { error = fFile.error; return false; }
+        unsigned char h[GEMBlockFile::kHeaderSize];
+        memset(h, 0, sizeof(h));
+        GEMRaw::store64(h, GEMBlockFile::kMagic);
+        GEMBlockFile::put32(h + 8,  GEMBlockFile::kVersion);
+        GEMBlockFile::put32(h + 12, GEMBlockFile::kHeaderSize);
+        GEMBlockFile::put32(h + 16, payload);
+        GEMBlockFile::put32(h + 20, codec);
+        GEMRaw::store64(h + 24, fBlockSize);
+        fFile.put(h, sizeof(h));
+        fOffset = sizeof(h);
+        return true;
+      }
+
+      bool is_open() const { return fFile.is_open(); }
+      bool ok() const { return error.empty() && fFile.ok(); }
+
+      void put(const void* p, size_t n) { fRaw.insert(fRaw.end(), (const char*)p, (const char*)p + n); }
+      template <class T> void binary(T v) { put(&v, sizeof(v)); }
+      void hex(uint64_t v) {
+        char s[17];
+        put(s, GEMConvert::hexWord(s, v) - s);
+      }
+
+      //! End of a GEB block: compress once enough is collected.
+      bool endBlock() {
+        fPending++;
+        if (fRaw.size() >= fBlockSize) return flushBlock();
+        return ok();
+      }
+
+      //! A block record from GEMBlockFile::pack.
+      bool writePacked(std::vector<char>& rec) {
+        if (rec.size() < GEMBlockFile::kBlockHeaderSize) return false;
+        unsigned char* h = (unsigned char*)&rec[0];
+        GEMBlockFile::Entry e;
+        e.offset     = fOffset;
+        e.firstEvent = nEvents;
+        e.codec      = GEMBlockFile::get32(h + 4);
+        e.rawSize    = GEMBlockFile::get32(h + 8);
+        e.compSize   = GEMBlockFile::get32(h + 12);
+        e.nEvents    = GEMBlockFile::get32(h + 24);
+        GEMRaw::store64(h + 16, e.firstEvent);
+        fFile.put(&rec[0], rec.size());
+        fFile.endBlock();
+        fIndex.push_back(e);
+        fOffset += rec.size();
+        nBlocks++;
+        nRaw    += e.rawSize;
+        nEvents += e.nEvents;
+        return ok();
+      }
+
+      //! Last block, index and trailer.
+      bool close() {
+        if (!fFile.is_open()) return ok();
+        flushBlock();
+        std::vector<unsigned char> idx(fIndex.size()*GEMBlockFile::kIndexEntrySize + 32);
+        unsigned char* p = idx.empty() ? 0 : &idx[0];
+        for (size_t i = 0; i < fIndex.size(); i++, p += GEMBlockFile::kIndexEntrySize) {
+          GEMRaw::store64(p,      fIndex[i].offset);
+          GEMRaw::store64(p + 8,  fIndex[i].firstEvent);
+          GEMBlockFile::put32(p + 16, fIndex[i].rawSize);
+          GEMBlockFile::put32(p + 20, fIndex[i].compSize);
+          GEMBlockFile::put32(p + 24, fIndex[i].nEvents);
+          GEMBlockFile::put32(p + 28, fIndex[i].codec);
+        }
+        GEMRaw::store64(p,      GEMBlockFile::kIndexMagic);
+        GEMRaw::store64(p + 8,  fOffset);
+        GEMRaw::store64(p + 16, fIndex.size());
+        GEMRaw::store64(p + 24, nEvents);
+        fFile.put(&idx[0], idx.size());
+        bool good = fFile.close() && ok();
+        if (!fFile.ok()) error = fFile.error;
+        return good;
+      }
+
+      uint64_t nBlocks;    /*!<compressed blocks written */
+      uint64_t nRaw;       /*!<bytes before compression */
+      uint64_t nEvents;    /*!<GEB blocks */
+      uint64_t bytes() const { return fOffset; }
+      std::string error;
+
+  private:
+
+      bool flushBlock() {
+        if (fRaw.empty()) return ok();
+        std::vector<char> rec;
+        if (!GEMBlockFile::pack(fCodec, fLevel, &fRaw[0], fRaw.size(), fPending, rec)) {
+          error = std::string("cannot compress with ") + GEMBlockFile::codecName(fCodec);
+          return false;
+        }
+        fRaw.clear();
+        fPending = 0;
+        return writePacked(rec);
+      }
+
+      GEMWriter fFile;
+      int fCodec, fLevel;
+      size_t fBlockSize;
+      std::vector<char> fRaw;
+      uint32_t fPending;
+      uint64_t fOffset;
+      std::vector<GEMBlockFile::Entry> fIndex;
+};
+
+//! Reads a GEMBlockFile, decompressing the next blocks in parallel.
+/*!
+  \brief GEMBlockReader
+  next() returns the blocks in file order; up to 2*threads blocks ahead are
+  read (pread) and decompressed by std::async tasks meanwhile. seek() starts
+  at the block holding a given event, found by binary search in the index.
+  A block whose crc32 does not match is skipped and counted, the others
+  are not affected. nextGEB() hands out the GEB blocks one by one, in the
+  binary GEMRaw layout whatever the payload is.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMBlockReader {
+  public:
+
+      GEMBlockReader(const std::string& path, int threads = 0)
+        : nCorrupt(0), nSkipped(0), fFd(-1), fPayload(0), fNext(0), fPos(0), fFirst(0), fEvent(0), fSkip(0) {
+        fThreads = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+        fFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fFd < 0) { error = path + ": " + strerror(errno); return; }
+        unsigned char h[GEMBlockFile::kHeaderSize];
+        if (pread(fFd, h, sizeof(h), 0) != (ssize_t)sizeof(h) || GEMRaw::load64(h) != GEMBlockFile::kMagic) {
+          error = path + ": not a GEM block file";
+          return;
+        }
+        if (GEMBlockFile::get32(h + 8) != GEMBlockFile::kVersion) { error = path + ": unknown version"; return; }
+        fPayload = GEMBlockFile::get32(h + 16);
+        if (!readIndex()) scanBlocks(GEMBlockFile::get32(h + 12));
+      }
+
+      ~GEMBlockReader() {
+        fAhead.clear();   // waits for the running tasks
+        if (fFd >= 0) ::close(fFd);
+      }
+
+      //! First bytes of path are a block file header.
+      static bool IsBlockFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        unsigned char h[8];
+        bool is = pread(fd, h, 8, 0) == 8 && GEMRaw::load64(h) == GEMBlockFile::kMagic;
+        ::close(fd);
+        return is;
+      }
+
+      bool good() const { return error.empty(); }
+      bool hex() const { return fPayload == GEMBlockFile::kHex; }
+      size_t nBlocks() const { return fIndex.size(); }
+      uint64_t nEvents() const { return fIndex.empty() ? 0 : fIndex.back().firstEvent + fIndex.back().nEvents; }
+      const GEMBlockFile::Entry& entry(size_t i) const { return fIndex[i]; }
+
+      //! Continue with the block holding event; nextGEB() skips the events before it.
+      bool seek(uint64_t event) {
+        fAhead.clear();
+        fRaw.clear();
+        fPos = 0;
+        size_t lo = 0, hi = fIndex.size();
+        while (lo < hi) {
+          size_t mid = (lo + hi)/2;
+          if (fIndex[mid].firstEvent + fIndex[mid].nEvents <= event) lo = mid + 1;
+          else hi = mid;
+        }
+        fNext = lo;
+        fSkip = lo < fIndex.size() ? event - fIndex[lo].firstEvent : 0;
+        return lo < fIndex.size();
+      }
+
+      //! Next decompressed block in file order, false at the end.
+      bool next(std::vector<char>& raw, uint64_t& firstEvent, uint32_t& nEvents) {
+        for (;;) {
+          while (fAhead.size() < 2*(size_t)fThreads && fNext < fIndex.size()) {
+            size_t i = fNext++;
+            fAhead.push_back(std::async(std::launch::async, [this, i] { return load(i); }));
+          }
+          if (fAhead.empty()) return false;
+          Loaded b = fAhead.front().get();
+          fAhead.pop_front();
+          if (!b.ok) { nCorrupt++; continue; }
+          raw.swap(b.raw);
+          firstEvent = b.firstEvent;
+          nEvents = b.nEvents;
+          return true;
+        }
+      }
+
+      //! Next GEB block in the binary layout, 0 at the end.
+      const unsigned char* nextGEB(size_t& n, uint64_t* event = 0) {
+        for (;;) {
+          if (fPos >= fRaw.size()) {
+            uint32_t nev;
+            fPos = 0;
+            if (!next(fRaw, fFirst, nev)) { fRaw.clear(); return 0; }
+            fEvent = fFirst;
+          }
+          const unsigned char* p = 0;
+          if (fPayload == GEMBlockFile::kHex) {
+            // one hex block to the binary layout
+            uint64_t words[GEMConvert::kMaxWords];
+            long pos = GEMResync::skipSpace(&fRaw[0], fRaw.size(), fPos);
+            // the control bits are left to the reader, as for binary blocks
+            long end = pos < (long)fRaw.size() ? GEMConvert::parseHex(&fRaw[0], fRaw.size(), pos, words, false) : 0;
+            if (end < 0) {
+              // not a GEB block here, go on from the next GEB header
+              long h = GEMResync::findHex(&fRaw[pos + 1], fRaw.size() - pos - 1, false);
+              if (h >= 0) {
+                nSkipped += pos + 1 + h - fPos;
+                fPos = pos + 1 + h;
+                continue;
+              }
+            }
+            if (end <= 0) {
+              // blocks are cut at GEB boundaries, the rest is not one
+              nSkipped += fRaw.size() - fPos;
+              fPos = fRaw.size();
+              continue;
+            }
+            fPos = end;
+            n = GEMConvert::wordsToBinary(words, fBin);
+            p = fBin;
+          } else {
+            p = (const unsigned char*)&fRaw[fPos];
+            size_t left = fRaw.size() - fPos;
+            n = left >= GEMRaw::kGEBHeaderSize && GEMRaw::headerOK(GEMRaw::load64(p)) ? GEMRaw::gebSize(GEMRaw::load64(p)) : 0;
+            if (!n || n > left) {
+              nSkipped += left;
+              fPos = fRaw.size();
+              continue;
+            }
+            fPos += n;
+          }
+          uint64_t ev = fEvent++;
+          if (fSkip) { fSkip--; continue; }
+          if (event) *event = ev;
+          return p;
+        }
+      }
+
+      uint64_t nCorrupt;   /*!<blocks with a wrong crc32 or which did not decompress */
+      uint64_t nSkipped;   /*!<bytes in blocks which are not a GEB block */
+      std::string error;
+
+  private:
+
+      struct Loaded {
+        std::vector<char> raw;
+        uint64_t firstEvent;
+        uint32_t nEvents;
+        bool ok;
+      };
+
+      //! Read and decompress block i, runs in the read ahead tasks.
+      Loaded load(size_t i) const {
+        const GEMBlockFile::Entry& e = fIndex[i];
+        Loaded b;
+        b.firstEvent = e.firstEvent;
+        b.nEvents = e.nEvents;
+        b.ok = false;
+        std::vector<char> comp(GEMBlockFile::kBlockHeaderSize + e.compSize);
+        if (pread(fFd, &comp[0], comp.size(), e.offset) != (ssize_t)comp.size()) return b;
+        const unsigned char* h = (const unsigned char*)&comp[0];
+        const char* data = &comp[GEMBlockFile::kBlockHeaderSize];
+        if (GEMBlockFile::get32(h) != GEMBlockFile::kBlockMagic) return b;
+        if (GEMBlockFile::get32(h + 28) != crc32(0, (const Bytef*)data, e.compSize)) return b;
+        b.raw.resize(e.rawSize);
+        b.ok = GEMBlockFile::decompress(e.codec, data, e.compSize, e.rawSize ? &b.raw[0] : 0, e.rawSize);
+        return b;
+      }
+
+      bool readIndex() {
+        struct stat st;
+        if (fstat(fFd, &st) != 0 || st.st_size < (off_t)(GEMBlockFile::kHeaderSize + 32)) return false;
+        unsigned char t[32];
+        if (pread(fFd, t, 32, st.st_size - 32) != 32 || GEMRaw::load64(t) != GEMBlockFile::kIndexMagic) return false;
+        uint64_t at = GEMRaw::load64(t + 8), n = GEMRaw::load64(t + 16);
+        if (at + n*GEMBlockFile::kIndexEntrySize + 32 != (uint64_t)st.st_size) return false;
+        std::vector<unsigned char> idx(n*GEMBlockFile::kIndexEntrySize + 1);
+        if (n && pread(fFd, &idx[0], n*GEMBlockFile::kIndexEntrySize, at) != (ssize_t)(n*GEMBlockFile::kIndexEntrySize)) return false;
+        fIndex.resize(n);
+        for (uint64_t i = 0; i < n; i++) {
+          const unsigned char* p = &idx[i*GEMBlockFile::kIndexEntrySize];
+          fIndex[i].offset     = GEMRaw::load64(p);
+          fIndex[i].firstEvent = GEMRaw::load64(p + 8);
+          fIndex[i].rawSize    = GEMBlockFile::get32(p + 16);
+          fIndex[i].compSize   = GEMBlockFile::get32(p + 20);
+          fIndex[i].nEvents    = GEMBlockFile::get32(p + 24);
+          fIndex[i].codec      = GEMBlockFile::get32(p + 28);
+        }
+        return true;
+      }
+
+      //! No index: follow the block headers from the first one.
+      void scanBlocks(uint64_t at) {
+        fIndex.clear();
+        struct stat st;
+        if (fstat(fFd, &st) != 0) return;
+        unsigned char h[GEMBlockFile::kBlockHeaderSize];
+        while (at + sizeof(h) <= (uint64_t)st.st_size) {
+          if (pread(fFd, h, sizeof(h), at) != (ssize_t)sizeof(h) || GEMBlockFile::get32(h) != GEMBlockFile::kBlockMagic) break;
+          GEMBlockFile::Entry e;
+          e.offset     = at;
+          e.codec      = GEMBlockFile::get32(h + 4);
+          e.rawSize    = GEMBlockFile::get32(h + 8);
+          e.compSize   = GEMBlockFile::get32(h + 12);
+          e.firstEvent = GEMRaw::load64(h + 16);
+          e.nEvents    = GEMBlockFile::get32(h + 24);
+          if (at + sizeof(h) + e.compSize > (uint64_t)st.st_size) break;   // being written
+          fIndex.push_back(e);
+          at += sizeof(h) + e.compSize;
+        }
+      }
+
+      int fFd;
+      int fThreads;
+      uint32_t fPayload;
+      std::vector<GEMBlockFile::Entry> fIndex;
+      size_t fNext;
+      std::deque<std::future<Loaded> > fAhead;
+      std::vector<char> fRaw;
+      size_t fPos;
+      uint64_t fFirst, fEvent, fSkip;
+      unsigned char fBin[GEMRaw::kMaxGEBSize];
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef GEM_ByteOrder
+#define GEM_ByteOrder
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMByteOrder                                                         //
+//                                                                      //
+// Byte order of binary GEB/VFAT streams, detection and conversion      //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define GEM_BYTEORDER_SSSE3 1
+#endif
+
+#include "GEMRaw.h"
+
+//! Foreign byte order binary streams.
+/*!
+  \brief GEMByteOrder
+  writeVFATdataBinary writes every field in the byte order of its host, a
+  big endian DAQ writes the same layout with every field reversed. detect()
+  tells the two apart from the first GEB block which is valid in exactly
+  one of them (header sumVFAT and the 1010/1100/1110 control bits).
+  swapBlocks() turns whole foreign blocks into the host order in place:
+  header and trailer are one bswap each, the VFAT records go through a
+  byte shuffle of the whole 24 bytes record (SSSE3 pshufb, chosen at run
+  time, no compiler flags needed) instead of six field conversions.
+  Used by gem-convert.cc, gem-replay.cc and GEMRunFile.h.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMByteOrder {
+
+  enum Order { kUnknown, kNative, kSwapped };
+
+  //! Header and VFAT control bits of a block at b[0, n) are valid in that order.
+  inline bool validAt(const unsigned char* b, size_t n, bool swapped) {
+    if (n < GEMRaw::kGEBHeaderSize + GEMRaw::kVFATSize) return false;
+    uint64_t h = GEMRaw::load64(b);
+    if (swapped) h = __builtin_bswap64(h);
+    if (!GEMRaw::headerOK(h)) return false;
+    const unsigned char* v = b + GEMRaw::kGEBHeaderSize;
+    for (uint64_t i = 0; i < GEMRaw::sumVFAT(h) && v + GEMRaw::kVFATSize <= b + n; i++, v += GEMRaw::kVFATSize) {
+      uint16_t BC = GEMRaw::load16(v + GEMRaw::kBCOffset), EC = GEMRaw::load16(v + GEMRaw::kECOffset);
+      uint16_t ID = GEMRaw::load16(v + GEMRaw::kChipIDOffset);
+      if (swapped) { BC = __builtin_bswap16(BC); EC = __builtin_bswap16(EC); ID = __builtin_bswap16(ID); }
+      if (!GEMRaw::controlBitsOK(BC, EC, ID)) return false;
+    }
+    return true;
+  }
+
+  //! Byte order of the first block valid in one order only, kUnknown if none in b[0, n).
+  inline Order detect(const unsigned char* b, size_t n) {
+    for (size_t p = 0; p + GEMRaw::kGEBHeaderSize + GEMRaw::kVFATSize <= n; p++) {
+      bool native = validAt(b + p, n - p, false), swapped = validAt(b + p, n - p, true);
+      if (native != swapped) return native ? kNative : kSwapped;
+    }
+    return kUnknown;
+  }
+
+  //! One VFAT record, field by field.
+  inline void swapVFATScalar(unsigned char* r) {
+    GEMRaw::store16(r + GEMRaw::kBCOffset,     __builtin_bswap16(GEMRaw::load16(r + GEMRaw::kBCOffset)));
+    GEMRaw::store16(r + GEMRaw::kECOffset,     __builtin_bswap16(GEMRaw::load16(r + GEMRaw::kECOffset)));
+    GEMRaw::store16(r + GEMRaw::kChipIDOffset, __builtin_bswap16(GEMRaw::load16(r + GEMRaw::kChipIDOffset)));
+    GEMRaw::store64(r + GEMRaw::kLsDataOffset, __builtin_bswap64(GEMRaw::load64(r + GEMRaw::kLsDataOffset)));
+    GEMRaw::store64(r + GEMRaw::kMsDataOffset, __builtin_bswap64(GEMRaw::load64(r + GEMRaw::kMsDataOffset)));
+    GEMRaw::store16(r + GEMRaw::kCrcOffset,    __builtin_bswap16(GEMRaw::load16(r + GEMRaw::kCrcOffset)));
+  }
+
+#ifdef GEM_BYTEORDER_SSSE3
+  //! n VFAT records with pshufb.
+  /*!
+    x holds record bytes 0-15, y bytes 8-23, so every field is inside one of
+    them: BC, EC, ChipID, lsData come from x, msData and crc from y. The
+    first 16 output bytes are shuffle(x) | shuffle(y), the last 8 shuffle(y).
+   */
+  __attribute__((target("ssse3")))
+  inline void swapVFATsSSSE3(unsigned char* r, size_t n) {
+    const __m128i mx   = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 13, 12, 11, 10, 9, 8, 7, 6, -128, -128);
+    const __m128i mylo = _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128,
+                                       -128, -128, -128, -128, -128, -128, 13, 12);
+    const __m128i myhi = _mm_setr_epi8(11, 10, 9, 8, 7, 6, 15, 14, -128, -128, -128, -128, -128, -128, -128, -128);
+    for (size_t i = 0; i < n; i++, r += GEMRaw::kVFATSize) {
+      __m128i x = _mm_loadu_si128((const __m128i*)r);
+      __m128i y = _mm_loadu_si128((const __m128i*)(r + 8));
+      _mm_storeu_si128((__m128i*)r, _mm_or_si128(_mm_shuffle_epi8(x, mx), _mm_shuffle_epi8(y, mylo)));
+      _mm_storel_epi64((__m128i*)(r + 16), _mm_shuffle_epi8(y, myhi));
+    }
+  }
+#endif
+
+  //! n VFAT records in place.
+  inline void swapVFATs(unsigned char* r, size_t n) {
+#ifdef GEM_BYTEORDER_SSSE3
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3) { swapVFATsSSSE3(r, n); return; }
+#endif
+    for (size_t i = 0; i < n; i++) swapVFATScalar(r + i*GEMRaw::kVFATSize);
+  }
+
+  //! Whole foreign blocks of b[0, n) to host order; returns the offset of the first byte not looked at.
+  /*!
+    Bytes between blocks are left as they are, the host order framing skips
+    and counts them. A block running past n, and the bytes from where one
+    may still start, are left for the next call with more data.
+   */
+  inline size_t swapBlocks(unsigned char* b, size_t n) {
+    size_t pos = 0;
+    while (pos + GEMRaw::kGEBHeaderSize <= n) {
+      uint64_t h = __builtin_bswap64(GEMRaw::load64(b + pos));
+      size_t size = GEMRaw::headerOK(h) ? GEMRaw::gebSize(h) : 0;
+      if (size && pos + size > n) return pos;
+      if (!size || !validAt(b + pos, size, true)) {
+        // the next position where a foreign block may start
+        size_t p = pos + 1;
+        while (p + GEMRaw::kGEBHeaderSize + GEMRaw::kVFATSize <= n && !validAt(b + p, n - p, true)) p++;
+        if (p + GEMRaw::kGEBHeaderSize + GEMRaw::kVFATSize > n) return n > pos + GEMRaw::kMaxGEBSize ? n - GEMRaw::kMaxGEBSize : pos;
+        pos = p;
+        continue;
+      }
+      GEMRaw::store64(b + pos, h);
+      swapVFATs(b + pos + GEMRaw::kGEBHeaderSize, GEMRaw::sumVFAT(h));
+      GEMRaw::store64(b + pos + size - GEMRaw::kGEBTrailerSize, __builtin_bswap64(GEMRaw::load64(b + pos + size - GEMRaw::kGEBTrailerSize)));
+      pos += size;
+    }
+    return pos;
+  }
+
+} // end of GEMByteOrder
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef GEM_Catalog
+#define GEM_Catalog
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMCatalog                                                           //
+//                                                                      //
+// Per-run summaries of many runs in one mmap-able index file           //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GEMRaw.h"
+
+//! Run catalog file.
+/*!
+  \brief GEMCatalog
+  A 16 bytes file header (kMagic, kVersion, size of a Run) followed by one
+  record per catalogued run, appended as the runs are processed:
+
+    Run     128 bytes   kRunMagic, bytes of the record, run number, date,
+                        time, scan parameters, events, VFATs, CRC and
+                        control bits errors, EC and BC ranges, number of
+                        chips, name of the input
+    Chip    16 bytes    ChipID, VFATs, CRC and control bits errors,
+                        nChips of them, in ChipID order
+
+  Everything is in the byte order of the host, fixed size fields only, so
+  the reader maps the file and walks the records in place. A run appended
+  again (same run number and input) replaces its earlier record.
+  GEMCatalogBuilder collects the summary while a run is processed
+  (gem-reading --catalog, thldread --catalog, gem-catalog -add),
+  gem-catalog.cc queries the file.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMCatalog {
+
+  const uint64_t kMagic    = 0x474c5441432d4d47ULL;   /*!<"GM-CATLG" */
+  const uint32_t kRunMagic = 0x4e555247;              /*!<"GRUN" */
+  const uint32_t kVersion  = 1;
+  const size_t   kHeaderSize = 16;
+
+  //! Counters of one ChipID in a run.
+  struct Chip {
+    uint16_t ChipID, spare;
+    uint32_t nVFAT, nCRC, nControl;
+  };
+
+  //! Summary of one run, followed by its nChips Chip records.
+  struct Run {
+    uint32_t magic, size;
+    int32_t  run, date, time;            /*!<date yyyymmdd, time hhmmss */
+    int32_t  minTh, maxTh, stepSize;     /*!<threshold scan, 0 if none */
+    uint64_t nEvents, nVFAT, nCRC, nControl;
+    uint64_t nSkipped;                   /*!<bytes of the input which were not GEB blocks */
+    uint16_t ECmin, ECmax, BCmin, BCmax; /*!<of the VFATs with good control bits */
+    uint32_t nChips, spare;
+    char     source[40];                 /*!<input file name, the end of it if longer */
+
+    const Chip* chips() const { return (const Chip*)(this + 1); }
+
+    //! Counters of ChipID, 0 if it did not appear.
+    const Chip* chip(uint16_t ChipID) const {
+      const Chip* c = chips();
+      size_t lo = 0, hi = nChips;
+      while (lo < hi) {
+        size_t mid = (lo + hi)/2;
+        if (c[mid].ChipID < ChipID) lo = mid + 1;
+        else hi = mid;
+      }
+      return lo < nChips && c[lo].ChipID == ChipID ? &c[lo] : 0;
+    }
+  };
+
+  static_assert(sizeof(Chip) == 16, "GEMCatalog::Chip is written as it is");
+  static_assert(sizeof(Run) == 128, "GEMCatalog::Run is written as it is");
+
+} // end of GEMCatalog
+
+//! Collects the summary of a run and appends it to a catalog.
+/*!
+  \brief GEMCatalogBuilder
+  vfat() takes the raw 16 bits words, control bits included; the CRC is
+  checked by the caller, which usually does it anyway.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMCatalogBuilder {
+  public:
+
+      GEMCatalogBuilder() : fChips(0x1000) {
+        memset(&fRun, 0, sizeof(fRun));
+        fRun.magic = GEMCatalog::kRunMagic;
+        fRun.run = -1;
+        fRun.ECmin = fRun.BCmin = 0xffff;
+      }
+
+      void vfat(uint16_t BC, uint16_t EC, uint16_t ChipID, bool crcOK) {
+        GEMCatalog::Chip& c = fChips[ChipID & 0x0fff];
+        c.nVFAT++;
+        fRun.nVFAT++;
+        if (!crcOK) { c.nCRC++; fRun.nCRC++; }
+        if (!GEMRaw::controlBitsOK(BC, EC, ChipID)) {
+          c.nControl++;
+          fRun.nControl++;
+          return;
+        }
+        uint16_t ec = (EC >> 4) & 0xff, bc = BC & 0x0fff;
+        if (ec < fRun.ECmin) fRun.ECmin = ec;
+        if (ec > fRun.ECmax) fRun.ECmax = ec;
+        if (bc < fRun.BCmin) fRun.BCmin = bc;
+        if (bc > fRun.BCmax) fRun.BCmax = bc;
+      }
+
+      //! A GEB block dropped for its control bits before its VFATs were looked at.
+      void controlError() { fRun.nControl++; }
+
+      void event() { fRun.nEvents++; }
+      void skipped(uint64_t bytes) { fRun.nSkipped += bytes; }
+
+      void scan(int minTh, int maxTh, int stepSize) {
+        fRun.minTh = minTh;
+        fRun.maxTh = maxTh;
+        fRun.stepSize = stepSize;
+      }
+
+      //! Run number, date and time; date 0 is now.
+      void run(int run, int date = 0, int time = 0) {
+        fRun.run = run;
+        fRun.date = date;
+        fRun.time = time;
+        if (date) return;
+        time_t t = ::time(0);
+        struct tm tm;
+        localtime_r(&t, &tm);
+        fRun.date = (tm.tm_year + 1900)*10000 + (tm.tm_mon + 1)*100 + tm.tm_mday;
+        fRun.time = tm.tm_hour*10000 + tm.tm_min*100 + tm.tm_sec;
+      }
+
+      void source(const std::string& name) {
+        memset(fRun.source, 0, sizeof(fRun.source));
+        size_t n = std::min(name.size(), sizeof(fRun.source) - 1);
+        memcpy(fRun.source, name.data() + name.size() - n, n);
+      }
+
+      const GEMCatalog::Run& summary() const { return fRun; }
+
+      //! The counters so far as one word, for a checkpoint of the run; restore() continues from them.
+      std::string state() const {
+        std::ostringstream s;
+        s << fRun.date << "," << fRun.time << "," << fRun.nEvents << "," << fRun.nVFAT << "," << fRun.nCRC
+          << "," << fRun.nControl << "," << fRun.ECmin << "," << fRun.ECmax << "," << fRun.BCmin << "," << fRun.BCmax;
+        for (size_t id = 0; id < fChips.size(); id++) {
+          const GEMCatalog::Chip& c = fChips[id];
+          if (c.nVFAT || c.nControl) s << ";" << id << ":" << c.nVFAT << ":" << c.nCRC << ":" << c.nControl;
+        }
+        return s.str();
+      }
+
+      //! Counters from state(), false if it is not one.
+      bool restore(const std::string& state) {
+        std::istringstream s(state);
+        GEMCatalog::Run r = fRun;
+        char c[9];
+        s >> r.date >> c[0] >> r.time >> c[1] >> r.nEvents >> c[2] >> r.nVFAT >> c[3] >> r.nCRC
+          >> c[4] >> r.nControl >> c[5] >> r.ECmin >> c[6] >> r.ECmax >> c[7] >> r.BCmin >> c[8] >> r.BCmax;
+        if (s.fail() || std::string(c, 9) != ",,,,,,,,,") return false;
+        std::vector<GEMCatalog::Chip> chips(fChips.size());
+        memset(&chips[0], 0, chips.size()*sizeof(GEMCatalog::Chip));
+        char semi, c1, c2, c3;
+        size_t id;
+        GEMCatalog::Chip k;
+        while (s >> semi) {
+          s >> id >> c1 >> k.nVFAT >> c2 >> k.nCRC >> c3 >> k.nControl;
+          if (s.fail() || semi != ';' || c1 != ':' || c2 != ':' || c3 != ':' || id >= chips.size()) return false;
+          chips[id].nVFAT = k.nVFAT;
+          chips[id].nCRC = k.nCRC;
+          chips[id].nControl = k.nControl;
+        }
+        fRun = r;
+        fChips.swap(chips);
+        return true;
+      }
+
+      //! Append the run to path, made with its header if missing; one write, so runs of several processes do not mix.
+      bool append(const std::string& path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+          unsigned char h[GEMCatalog::kHeaderSize];
+          uint32_t version = GEMCatalog::kVersion, size = sizeof(GEMCatalog::Run);
+          memcpy(h, &GEMCatalog::kMagic, 8);
+          memcpy(h + 8, &version, 4);
+          memcpy(h + 12, &size, 4);
+          if (::write(fd, h, sizeof(h)) != (ssize_t)sizeof(h)) return fail(fd, "write");
+        } else if (errno == EEXIST) {
+          fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        }
+        if (fd < 0) { error = path + ": " + strerror(errno); return false; }
+
+        std::vector<char> rec(sizeof(GEMCatalog::Run));
+        uint32_t nChips = 0;
+        for (size_t id = 0; id < fChips.size(); id++) {
+          if (!fChips[id].nVFAT) continue;
+          GEMCatalog::Chip c = fChips[id];
+          c.ChipID = id;
+          rec.insert(rec.end(), (const char*)&c, (const char*)&c + sizeof(c));
+          nChips++;
+        }
+        GEMCatalog::Run r = fRun;
+        r.nChips = nChips;
+        r.size = rec.size();
+        if (r.ECmin > r.ECmax) r.ECmin = r.BCmin = 0;   // no VFAT with good control bits
+        memcpy(&rec[0], &r, sizeof(r));
+        if (::write(fd, &rec[0], rec.size()) != (ssize_t)rec.size()) return fail(fd, "write");
+        if (::close(fd) != 0) { error = std::string("close: ") + strerror(errno); return false; }
+        return true;
+      }
+
+      std::string error;
+
+  private:
+
+      bool fail(int fd, const char* what) {
+        error = std::string(what) + ": " + strerror(errno);
+        ::close(fd);
+        return false;
+      }
+
+      GEMCatalog::Run fRun;
+      std::vector<GEMCatalog::Chip> fChips;
+};
+
+//! A catalog file mapped into memory.
+/*!
+  \brief GEMCatalogReader
+  runs() are the records in file order, a run appended again only with
+  its last record. A damaged record ends the walk, nCorrupt says so.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMCatalogReader {
+  public:
+
+      GEMCatalogReader(const std::string& path) : nCorrupt(0), fMap(0), fSize(0) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) { error = path + ": " + strerror(errno); if (fd >= 0) ::close(fd); return; }
+        fSize = st.st_size;
+        if (fSize >= GEMCatalog::kHeaderSize) {
+          void* m = mmap(0, fSize, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (m != MAP_FAILED) fMap = (const unsigned char*)m;
+        }
+        ::close(fd);
+        if (!fMap) { error = path + ": not a GEM catalog"; return; }
+        uint32_t version, size;
+        memcpy(&version, fMap + 8, 4);
+        memcpy(&size, fMap + 12, 4);
+        if (GEMRaw::load64(fMap) != GEMCatalog::kMagic) { error = path + ": not a GEM catalog"; return; }
+        if (version != GEMCatalog::kVersion || size != sizeof(GEMCatalog::Run)) { error = path + ": unknown version"; return; }
+        walk();
+      }
+
+      ~GEMCatalogReader() { if (fMap) munmap((void*)fMap, fSize); }
+
+      bool good() const { return error.empty(); }
+      const std::vector<const GEMCatalog::Run*>& runs() const { return fRuns; }
+
+      uint64_t nCorrupt;   /*!<bytes after a damaged record */
+      std::string error;
+
+  private:
+
+      void walk() {
+        std::map<std::pair<int, std::string>, size_t> seen;
+        size_t pos = GEMCatalog::kHeaderSize;
+        // records are 8 bytes aligned, they are read in place
+        while (pos + sizeof(GEMCatalog::Run) <= fSize) {
+          const GEMCatalog::Run* r = (const GEMCatalog::Run*)(fMap + pos);
+          if (r->magic != GEMCatalog::kRunMagic || r->size != sizeof(GEMCatalog::Run) + r->nChips*sizeof(GEMCatalog::Chip)
+              || pos + r->size > fSize) {
+            nCorrupt = fSize - pos;
+            return;
+          }
+          std::pair<int, std::string> key(r->run, std::string(r->source, strnlen(r->source, sizeof(r->source))));
+          std::map<std::pair<int, std::string>, size_t>::iterator it = seen.find(key);
+          if (it == seen.end()) {
+            seen[key] = fRuns.size();
+            fRuns.push_back(r);
+          } else {
+            fRuns[it->second] = r;
+          }
+          pos += r->size;
+        }
+        if (pos < fSize) nCorrupt = fSize - pos;
+      }
+
+      const unsigned char* fMap;
+      size_t fSize;
+      std::vector<const GEMCatalog::Run*> fRuns;
+};
+
+#endif
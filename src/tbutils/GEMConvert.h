@@ -0,0 +1,187 @@
+#ifndef GEM_Convert
+#define GEM_Convert
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMConvert                                                           //
+//                                                                      //
+// Framing of GEB blocks in memory and hex <-> binary conversion        //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "GEMRaw.h"
+#include "GEMResync.h"
+
+//! GEB block framing and format conversion.
+/*!
+  \brief GEMConvert
+  frameHex and frameBinary walk the GEB blocks of a buffer and call back
+  for every valid one; garbage in between is skipped with GEMResync and
+  counted. Both return the offset of the first byte not used: a block
+  running past the end of the buffer is left for the next one.
+  With keepBad a block with wrong VFAT control bits is handed on as well
+  when the next block, or the end of the buffer, follows right after it,
+  for gem-skim.cc which looks for exactly these. The next block may be a
+  bad one too: its header and two of the three control bits of its first
+  VFAT are enough.
+  Used by gem-replay.cc, gem-convert.cc and gem-skim.cc.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMConvert {
+
+  const size_t kMaxHexGEB = GEMRaw::kMaxGEBSize*3;   /*!<at most 17 characters per 8 bytes */
+  const int kMaxWords = 2 + 6*GEMRaw::kMaxVFAT;       /*!<header, 6 words per VFAT, trailer */
+
+  //! Parse one hex GEB block at b[pos].
+  /*!
+    Returns the offset after its trailer and new line, 0 if it runs past
+    the buffer, -1 if it is not a valid block. With controlBits false only
+    the header decides.
+   */
+  inline long parseHex(const char* b, long n, long pos, uint64_t* words, bool controlBits = true) {
+    long p = pos;
+    int nwords = 2;
+    for (int k = 0; k < nwords; k++) {
+      p = GEMResync::skipSpace(b, n, p);
+      if (p >= n) return 0;
+      long e = GEMResync::hexToken(b, n, p, words[k]);
+      if (e < 0) return -1;
+      if (e >= n) return 0;
+      p = e;
+      if (k == 0) {
+        if (!GEMRaw::headerOK(words[0])) return -1;
+        nwords = 2 + 6*GEMRaw::sumVFAT(words[0]);
+      } else if (controlBits && k < nwords - 1 && (k - 1) % 6 == 2) {
+        if (!GEMRaw::controlBitsOK(words[k-2], words[k-1], words[k])) return -1;
+      }
+    }
+    while (p < n && b[p] != '\n' && GEMResync::isSpace(b[p])) p++;
+    if (p >= n) return 0;
+    if (b[p] == '\n') p++;
+    return p;
+  }
+
+  //! Words of a parsed hex block to the binary layout, returns its size.
+  inline size_t wordsToBinary(const uint64_t* w, unsigned char* out) {
+    uint64_t sumVFAT = GEMRaw::sumVFAT(w[0]);
+    unsigned char* p = out;
+    GEMRaw::store64(p, w[0]);
+    p += GEMRaw::kGEBHeaderSize;
+    for (uint64_t i = 0; i < sumVFAT; i++, p += GEMRaw::kVFATSize) {
+      const uint64_t* v = w + 1 + 6*i;
+      GEMRaw::store16(p + GEMRaw::kBCOffset,     v[0]);
+      GEMRaw::store16(p + GEMRaw::kECOffset,     v[1]);
+      GEMRaw::store16(p + GEMRaw::kChipIDOffset, v[2]);
+      GEMRaw::store64(p + GEMRaw::kLsDataOffset, v[3]);
+      GEMRaw::store64(p + GEMRaw::kMsDataOffset, v[4]);
+      GEMRaw::store16(p + GEMRaw::kCrcOffset,    v[5]);
+    }
+    GEMRaw::store64(p, w[1 + 6*sumVFAT]);
+    return p + GEMRaw::kGEBTrailerSize - out;
+  }
+
+  //! Lower case hex without leading zeros and a new line, as "outf << hex << x << endl".
+  inline char* hexWord(char* p, uint64_t x) {
+    static const char digits[] = "0123456789abcdef";
+    int n = x ? (64 - __builtin_clzll(x) + 3)/4 : 1;
+    for (int i = n - 1; i >= 0; i--) { p[i] = digits[x & 0xf]; x >>= 4; }
+    p[n] = '\n';
+    return p + n + 1;
+  }
+
+  //! A binary GEB block as hex text, returns its length (at most kMaxHexGEB).
+  inline size_t binaryToHex(const unsigned char* b, char* out) {
+    uint64_t header = GEMRaw::load64(b);
+    uint64_t sumVFAT = GEMRaw::sumVFAT(header);
+    char* p = hexWord(out, header);
+    const unsigned char* r = b + GEMRaw::kGEBHeaderSize;
+    for (uint64_t i = 0; i < sumVFAT; i++, r += GEMRaw::kVFATSize) {
+      p = hexWord(p, GEMRaw::load16(r + GEMRaw::kBCOffset));
+      p = hexWord(p, GEMRaw::load16(r + GEMRaw::kECOffset));
+      p = hexWord(p, GEMRaw::load16(r + GEMRaw::kChipIDOffset));
+      p = hexWord(p, GEMRaw::load64(r + GEMRaw::kLsDataOffset));
+      p = hexWord(p, GEMRaw::load64(r + GEMRaw::kMsDataOffset));
+      p = hexWord(p, GEMRaw::load16(r + GEMRaw::kCrcOffset));
+    }
+    p = hexWord(p, GEMRaw::load64(r));
+    return p - out;
+  }
+
+  //! Binary blocks in b[0, n), block(p, size) for each; returns the offset of the first byte not used.
+  /*!
+    With until < n only the blocks starting before until are framed, the bytes
+    after it are looked at as in a buffer of n bytes, so a piece of a larger
+    buffer is framed exactly as the whole buffer would be.
+    keepBad takes the end of the buffer for the end of the data.
+   */
+  template <class F> size_t frameBinary(const unsigned char* b, size_t n, uint64_t& skipped, F block, size_t until = ~(size_t)0, bool keepBad = false) {
+    size_t pos = 0;
+    while (pos < until && pos + GEMRaw::kGEBHeaderSize <= n) {
+      uint64_t header = GEMRaw::load64(b + pos);
+      size_t size = GEMRaw::headerOK(header) ? GEMRaw::gebSize(header) : 0;
+      if (size && pos + size > n) break;
+      // control bits too, as parseHex does: a block must not depend on where the buffer ends
+      if (size && !GEMResync::verifyBinary(b, n, pos + GEMRaw::kGEBHeaderSize)) {
+        size_t next = pos + size;
+        const unsigned char* v = b + next + GEMRaw::kGEBHeaderSize;
+        bool framed = next == n || (next + GEMRaw::kGEBHeaderSize + GEMRaw::kLsDataOffset <= n && GEMRaw::headerOK(GEMRaw::load64(b + next))
+          && GEMRaw::nearlyOK(GEMRaw::load16(v + GEMRaw::kBCOffset), GEMRaw::load16(v + GEMRaw::kECOffset), GEMRaw::load16(v + GEMRaw::kChipIDOffset)));
+        if (!keepBad || !framed) size = 0;
+      }
+      if (!size) {
+        long off = GEMResync::findBinary(b + pos + 1, n - pos - 1);
+        // a block not found may still start in the last kMaxGEBSize bytes
+        if (off < 0 && n - pos <= GEMRaw::kMaxGEBSize) break;
+        size_t skip = off < 0 ? n - pos - GEMRaw::kMaxGEBSize : off + 1;
+        skipped += (until - pos < skip) ? until - pos : skip;
+        pos += skip;
+        continue;
+      }
+      block(b + pos, size);
+      pos += size;
+    }
+    return pos;
+  }
+
+  //! Hex blocks in b[0, n), block(text, length, words) for each; returns the offset of the first byte not used.
+  /*!
+    until and keepBad as for frameBinary.
+   */
+  template <class F> size_t frameHex(const char* b, size_t n, uint64_t& skipped, F block, size_t until = ~(size_t)0, bool keepBad = false) {
+    long pos = 0;
+    uint64_t words[kMaxWords], next[kMaxWords];
+    for (;;) {
+      pos = GEMResync::skipSpace(b, n, pos);
+      if (pos >= (long)n) return n;
+      if ((size_t)pos >= until) return pos;
+      long end = parseHex(b, n, pos, words);
+      if (end < 0 && keepBad) {
+        long bad = parseHex(b, n, pos, words, false);
+        long q = bad > 0 ? GEMResync::skipSpace(b, n, bad) : 0;
+        if (bad > 0 && (q >= (long)n || (parseHex(b, n, q, next, false) > 0 && GEMRaw::nearlyOK(next[1], next[2], next[3])))) end = bad;
+      }
+      if (end == 0) return pos;          // runs past the buffer
+      if (end < 0) {
+        long h = GEMResync::findHex(b + pos + 1, n - pos - 1, false);
+        long next = h + 1;
+        if (h < 0) {
+          // a block may still start near the end of the buffer
+          next = (long)n - (long)kMaxHexGEB > pos + 1 ? (long)n - (long)kMaxHexGEB - pos : 1;
+        }
+        skipped += (until - pos < (size_t)next) ? until - pos : next;
+        pos += next;
+        if (h < 0) return pos;
+        continue;
+      }
+      block(b + pos, (size_t)(end - pos), (const uint64_t*)words);
+      pos = end;
+    }
+  }
+
+} // end of GEMConvert
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef GEM_Crc
+#define GEM_Crc
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMCrc                                                               //
+//                                                                      //
+// VFAT2 CRC-16 (CCITT polynomial, reflected, 0x8408)                   //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+//! VFAT2 checksum.
+/*!
+  \brief GEMCrc
+  The VFAT2 CRC runs over the eleven 16 bits words BC, EC, ChipID,
+  msData<127:64> (high word first) and lsData<63:0> (high word first),
+  starting from 0xffff. crc_calc is the bit serial reference used by
+  gem-reading.cc, update() is the equivalent table driven version which
+  consumes a word as its low byte followed by its high byte, vfatCRC()
+  computes a whole VFAT2 word from per byte position tables.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMCrc {
+
+  //! Bit serial CRC of one 16 bits word, reference implementation.
+  inline uint16_t crc_calc(uint16_t crc_in, uint16_t dato) {
+    uint16_t v = 0x0001;
+    uint16_t mask = 0x0001;
+    bool d = 0;
+    uint16_t crc_temp = crc_in;
+    unsigned char datalen = 16;
+
+    for (int i=0; i<datalen; i++){
+      if (dato & v) d = 1;
+      else d = 0;
+      if ((crc_temp & mask)^d) crc_temp = crc_temp>>1 ^ 0x8408;
+      else crc_temp = crc_temp>>1;
+      v<<=1;
+    }
+    return(crc_temp);
+  }
+
+  //! 256 entries byte table.
+  struct ByteTable {
+    uint16_t t[256];
+    ByteTable() {
+      for (int b = 0; b < 256; b++) {
+        uint16_t c = b;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0x8408 : (c >> 1);
+        t[b] = c;
+      }
+    }
+  };
+
+  //! The byte table, built once, also when first used by several threads.
+  inline const uint16_t* table() {
+    static const ByteTable T;
+    return T.t;
+  }
+
+  //! Table driven CRC of one 16 bits word, same result as crc_calc.
+  inline uint16_t update(const uint16_t* t, uint16_t crc, uint16_t dato) {
+    crc = (crc >> 8) ^ t[(crc ^ dato) & 0xff];
+    crc = (crc >> 8) ^ t[(crc ^ (dato >> 8)) & 0xff];
+    return crc;
+  }
+
+  //! Per byte position tables for a complete VFAT2 word.
+  /*!
+    The CRC is affine in the message: crc(0xffff, m) = crc(0xffff, 0) ^ crc(0, m),
+    and crc(0, m) is the XOR of the contributions of every message byte alone.
+    pos[k][b] is the contribution of byte b at position k of the 22 bytes
+    message, so a VFAT2 CRC is 22 independent lookups instead of a chain.
+   */
+  struct VFATTables {
+    uint16_t pos[22][256];
+    uint16_t zero;       /*!<CRC of a message of zeros */
+    VFATTables() {
+      const uint16_t* t = table();
+      for (int k = 0; k < 22; k++) {
+        for (int b = 0; b < 256; b++) {
+          uint16_t crc = 0;
+          for (int j = 0; j < 22; j++) crc = (crc >> 8) ^ t[(crc ^ (j == k ? b : 0)) & 0xff];
+          pos[k][b] = crc;
+        }
+      }
+      uint16_t crc = 0xffff;
+      for (int j = 0; j < 22; j++) crc = (crc >> 8) ^ t[crc & 0xff];
+      zero = crc;
+    }
+  };
+
+  inline const VFATTables& vfatTables() {
+    static const VFATTables T;
+    return T;
+  }
+
+  //! CRC of a complete VFAT2 word, what the chip puts into its crc field.
+  inline uint16_t vfatCRC(uint16_t BC, uint16_t EC, uint16_t ChipID, uint64_t lsData, uint64_t msData) {
+    const VFATTables& T = vfatTables();
+    uint16_t crc = T.zero;
+    crc ^= T.pos[0][BC & 0xff]     ^ T.pos[1][BC >> 8];
+    crc ^= T.pos[2][EC & 0xff]     ^ T.pos[3][EC >> 8];
+    crc ^= T.pos[4][ChipID & 0xff] ^ T.pos[5][ChipID >> 8];
+    for (int w = 0; w < 4; w++) {
+      uint16_t m = msData >> (48 - 16*w);
+      uint16_t l = lsData >> (48 - 16*w);
+      crc ^= T.pos[6 + 2*w][m & 0xff]  ^ T.pos[7 + 2*w][m >> 8];
+      crc ^= T.pos[14 + 2*w][l & 0xff] ^ T.pos[15 + 2*w][l >> 8];
+    }
+    return crc;
+  }
+
+  //! Same as vfatCRC, one word at a time, reference for tests and benchmarks.
+  inline uint16_t vfatCRCSerial(uint16_t BC, uint16_t EC, uint16_t ChipID, uint64_t lsData, uint64_t msData) {
+    uint16_t dataVFAT[11] = { BC, EC, ChipID,
+                              (uint16_t)(msData >> 48), (uint16_t)(msData >> 32), (uint16_t)(msData >> 16), (uint16_t)msData,
+                              (uint16_t)(lsData >> 48), (uint16_t)(lsData >> 32), (uint16_t)(lsData >> 16), (uint16_t)lsData };
+    uint16_t crc = 0xffff;
+    for (int i = 0; i < 11; i++) crc = crc_calc(crc, dataVFAT[i]);
+    return crc;
+  }
+
+} // end of GEMCrc
+
+#endif
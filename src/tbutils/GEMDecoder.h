@@ -0,0 +1,324 @@
+#ifndef GEM_Decoder
+#define GEM_Decoder
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMDecoder                                                           //
+//                                                                      //
+// VFAT/GEB decoding for every reader, specialized on the record format //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include "GEMRaw.h"
+
+//! VFAT2 record decoding, one implementation for all the readers.
+/*!
+  \brief GEMDecoder
+  A Decoder is made of two policies:
+
+    Format   the fields of a VFAT record
+               ThresholdScan  ThresholdScan.dat of the XDAQ threshold scan
+                              (thldread.cc, gem-re-write.cc): a scan header,
+                              then BC EC bxExp bxNum ChipID lsData msData
+                              delVT crc per VFAT, no GEB framing
+               GEBFramed      DataParker.dat of gem-re-write.cc (gem-reading.cc):
+                              GEB header, BC EC ChipID lsData msData crc per
+                              VFAT, GEB trailer, see GEMRaw.h
+    Source   where the words come from
+               Hex            whitespace separated numbers from a stream
+               Binary         packed host order words in memory, the
+                              GEMRaw.h layout for GEBFramed
+
+  The fields a format does not have are not in its VFAT struct at all, and
+  the decoder of a format reads just its own fields, in its order, with no
+  test at run time: the choice is made by overloading on the format flags.
+  The printouts are shared the same way.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMDecoder {
+
+  //! ThresholdScan.dat: scan header, then one VFAT record after the other.
+  struct ThresholdScan {
+    static const bool kBx = true;           /*!<bxExp, bxNum after EC */
+    static const bool kDelVT = true;        /*!<delVT before crc */
+    static const bool kScanHeader = true;   /*!<minTh maxTh stepSize first */
+  };
+
+  //! GEB blocks: header, sumVFAT VFAT records, trailer.
+  struct GEBFramed {
+    static const bool kBx = false;
+    static const bool kDelVT = false;
+    static const bool kScanHeader = false;
+  };
+
+  //! Numbers in hex from a stream, one per token.
+  struct Hex {
+    typedef std::istream Input;
+    template <class T> static void word(Input& in, T& x) { in >> std::hex >> x; }
+    static void real(Input& in, double& x) { in >> x; }
+    static bool ok(const Input& in) { return !in.fail(); }
+  };
+
+  //! Packed words in memory, the cursor is moved past what is read.
+  struct Binary {
+    typedef const unsigned char* Input;
+    template <class T> static void word(Input& in, T& x) { memcpy(&x, in, sizeof(x)); in += sizeof(x); }
+    static void real(Input& in, double& x) { word(in, x); }
+    static bool ok(const Input&) { return true; }
+  };
+
+  template <bool> struct BxWords {};
+  template <> struct BxWords<true> {
+    uint32_t bxExp;
+    uint16_t bxNum;   /*!<Event Number & SBit, 16 bits : bxNum:6, SBit:6 */
+  };
+
+  template <bool> struct DelVTWord {};
+  template <> struct DelVTWord<true> {
+    double delVT;     /*!<delVT = deviceVT2-deviceVT1, Threshold Scan needs this value. */
+  };
+
+  //! GEM Event Data Format (one chip data)
+  /*!
+    Uncoding of VFAT2 data for one chip, with the fields of Format only.
+    \image html vfat2.data.format.png
+    \author Sergey.Baranov@cern.ch
+   */
+  template <class Format> struct VFAT : BxWords<Format::kBx>, DelVTWord<Format::kDelVT> {
+    uint16_t BC;      /*!<Banch Crossing number "BC" 16 bits, : 1010:4 (control bits), BC:12 */
+    uint16_t EC;      /*!<Event Counter "EC" 16 bits: 1100:4(control bits) , EC:8, Flags:4 */
+    uint16_t ChipID;  /*!<ChipID 16 bits, 1110:4 (control bits), ChipID:12 */
+    uint64_t lsData;  /*!<lsData value, bits from 1to64. */
+    uint64_t msData;  /*!<msData value, bits from 65to128. */
+    uint16_t crc;     /*!<Checksum number, CRC:16 */
+  };
+
+  template <class Format> struct GEB {
+    uint64_t header;      // ZSFlag:24 ChamID:12
+    std::vector<VFAT<Format> > vfats;
+    uint64_t trailer;     // OHcrc: 16 OHwCount:16  ChamStatus:16
+  };
+
+  template <class Format> struct AMC {
+    uint64_t header1;      // AmcNo:4      0000:4     LV1ID:24   BXID:12     DataLgth:20
+    uint64_t header2;      // User:32      OrN:16     BoardID:16
+    uint64_t header3;      // DAVList:24   BufStat:24 DAVCount:5 FormatVer:3 MP7BordStat:8
+    std::vector<GEB<Format> > gebs;
+    uint64_t trailer2;     // EventStat:32 GEBerrFlag:24
+    uint64_t trailer1;     // crc:32       LV1IDT:8   0000:4     DataLgth:20
+  };
+
+  //! Application header struct
+  /*!
+    \brief AppHeader contens Threshold scan parameters
+   */
+  struct AppHeader {
+    int minTh;     /*!<minTh minimal threshold value. */
+    int maxTh;     /*!<maxTh maximal threshold value. */
+    int stepSize;  /*!<stepSize threshold ste size value. */
+  };
+
+  //! Useful printouts of the records of Format.
+  template <class Format> class Print {
+    public:
+
+      typedef VFAT<Format> VFATData;
+      typedef GEB<Format>  GEBData;
+
+      static void show4bits(uint8_t x) {
+        const unsigned long unit = 1;
+        for (int i = (sizeof(uint8_t)*4)-1; i >= 0; i--)
+          (x & ((unit)<<i)) ? putchar('1') : putchar('0');
+      }
+
+      //! show bits function, needs for debugging
+      static void showbits(uint8_t x) {
+        for (int i = (sizeof(uint8_t)*8)-1; i >= 0; i--)
+          (x & (1<<i)) ? putchar('1') : putchar('0');
+        printf("\n");
+      }
+
+      //! Print VFAT2 event, "hex" format.
+      static bool printVFATdata(int event, const VFATData& vfat) {
+        if (event < 0) return(false);
+        std::cout << "Received tracking data word:" << std::endl;
+        std::cout << "BC      :: 0x" << std::setfill('0') << std::setw(4) << std::hex << vfat.BC     << std::dec << std::endl;
+        std::cout << "EC      :: 0x" << std::setfill('0') << std::setw(4) << std::hex << vfat.EC     << std::dec << std::endl;
+        printBx(vfat, std::integral_constant<bool, Format::kBx>());
+        std::cout << "ChipID  :: 0x" << std::setfill('0') << std::setw(4) << std::hex << vfat.ChipID << std::dec << std::endl;
+        std::cout << "<127:64>:: 0x" << std::setfill('0') << std::setw(8) << std::hex << vfat.msData << std::dec << std::endl;
+        std::cout << "<63:0>  :: 0x" << std::setfill('0') << std::setw(8) << std::hex << vfat.lsData << std::dec << std::endl;
+        std::cout << "crc     :: 0x" << std::setfill('0') << std::setw(4) << std::hex << vfat.crc    << std::dec << "\n" << std::endl;
+        return(true);
+      }
+
+      //! Print VFAT2 event, control bits and fields; ivfat, the VFAT in its GEB block, if not negative.
+      static bool printVFATdataBits(int event, int ivfat, const VFATData& vfat) {
+        if (event < 0) return(false);
+        std::cout << "\nReceived VFAT data word: event " << event;
+        if (ivfat >= 0) std::cout << " ivfat  " << ivfat;
+        std::cout << std::endl;
+
+        uint8_t   b1010 = (0xf000 & vfat.BC) >> 12;
+        show4bits(b1010); std::cout << " BC     0x" << std::hex << (0x0fff & vfat.BC) << std::dec << std::endl;
+
+        uint8_t   b1100 = (0xf000 & vfat.EC) >> 12;
+        uint16_t   EC   = (0x0ff0 & vfat.EC) >> 4;
+        uint8_t   Flag  = (0x000f & vfat.EC);
+        show4bits(b1100); std::cout << " EC     0x" << std::hex << EC << std::dec << std::endl;
+        show4bits(Flag);  std::cout << " Flags " << std::endl;
+
+        uint8_t   b1110 = (0xf000 & vfat.ChipID) >> 12;
+        uint16_t ChipID = (0x0fff & vfat.ChipID);
+        show4bits(b1110); std::cout << " ChipID 0x" << std::hex << ChipID << std::dec << " " << std::endl;
+
+        printBxBits(vfat, std::integral_constant<bool, Format::kBx>());
+        std::cout << " <127:64>:: 0x" << std::setfill('0') << std::setw(8) << std::hex << vfat.msData << std::dec << std::endl;
+        std::cout << " <63:0>  :: 0x" << std::setfill('0') << std::setw(8) << std::hex << vfat.lsData << std::dec << std::endl;
+        std::cout << "     crc    0x" << std::hex << vfat.crc << std::dec << std::endl;
+        return(true);
+      }
+
+      static bool printVFATdataBits(int event, const VFATData& vfat) { return printVFATdataBits(event, -1, vfat); }
+
+      //! Print ChipID "hex" number and control bits "1110"
+      static bool PrintChipID(int event, const VFATData& vfat) {
+        if (event < 0) return(false);
+        std::cout << "\nevent " << event << std::endl;
+        uint8_t bitsE = ((vfat.ChipID&0xF000)>>12);
+        showbits(bitsE);
+        std::cout << std::hex << "1110 0x0" << ((vfat.ChipID&0xF000)>>12) << " ChipID 0x" << (vfat.ChipID&0x0FFF) << std::dec << std::endl;
+        return(true);
+      }
+
+      static bool printGEBheader(const GEBData& geb) {
+        std::cout << std::hex << geb.header << " ChamID " << GEMRaw::ChamID(geb.header)
+                  << std::dec << " sumVFAT " << GEMRaw::sumVFAT(geb.header) << std::endl;
+        return(true);
+      }
+
+      static bool printGEBtrailer(const GEBData& geb) {
+        uint64_t OHcrc      = (0xffff000000000000 & geb.trailer) >> 48;
+        uint64_t OHwCount   = (0x0000ffff00000000 & geb.trailer) >> 32;
+        uint64_t ChamStatus = (0x00000000ffff0000 & geb.trailer) >> 16;
+        std::cout << "GEM Camber Treiler: OHcrc " << std::hex << OHcrc << " OHwCount " << OHwCount << " ChamStatus " << ChamStatus << std::dec
+                  << std::endl;
+        return(true);
+      }
+
+    private:
+
+      static void printBx(const VFATData& vfat, std::true_type) {
+        std::cout << "BxExp   :: 0x" << std::setfill('0') << std::setw(4) << std::hex << vfat.bxExp  << std::dec << std::endl;
+        std::cout << "BxNum   :: 0x" << std::setfill('0') << std::setw(4) << std::hex << vfat.bxNum  << std::dec << std::endl;
+      }
+      static void printBx(const VFATData&, std::false_type) {}
+
+      static void printBxBits(const VFATData& vfat, std::true_type) {
+        std::cout << "     bxExp  0x" << std::setfill('0') << std::setw(4) << std::hex << vfat.bxExp << std::dec << " " << std::endl;
+        std::cout << "     bxNum  0x" << std::setfill('0') << std::setw(2) << std::hex << ((0xff00 & vfat.bxNum) >> 8) << std::dec << std::endl;
+        std::cout << "     SBit   0x" << std::setfill('0') << std::setw(2) << std::hex <<  (0x00ff & vfat.bxNum)       << std::dec << std::endl;
+      }
+      static void printBxBits(const VFATData&, std::false_type) {}
+  };
+
+  //! Reads the records of Format from Source.
+  /*!
+    readEvent() is one VFAT record, readGEB() a whole GEB block; a hex
+    reader can also check the VFATs of a block one by one between
+    readGEBheader() and readGEBtrailer(). The return value is false once
+    the source fails (the end of a hex stream, a token which is no number);
+    binary memory is checked by the caller beforehand, GEMRaw::gebSize().
+   */
+  template <class Format, class Source> class Decoder : public Print<Format> {
+    public:
+
+      typedef typename Source::Input Input;
+      typedef VFAT<Format> VFATData;
+      typedef GEB<Format>  GEBData;
+      typedef AMC<Format>  GEMData;
+      typedef GEMDecoder::AppHeader AppHeader;
+
+      //! Read GEM event data: one VFAT2 record, the fields of Format in the order of the file.
+      static bool readEvent(Input& in, int event, VFATData& vfat) {
+        if (event < 0) return(false);
+        Source::word(in, vfat.BC);
+        Source::word(in, vfat.EC);
+        readBx(in, vfat, std::integral_constant<bool, Format::kBx>());
+        Source::word(in, vfat.ChipID);
+        Source::word(in, vfat.lsData);
+        Source::word(in, vfat.msData);
+        readDelVT(in, vfat, std::integral_constant<bool, Format::kDelVT>());
+        Source::word(in, vfat.crc);
+        return(Source::ok(in));
+      }
+
+      static bool readGEBheader(Input& in, GEBData& geb) {
+        Source::word(in, geb.header);
+        return(Source::ok(in));
+      }
+
+      static bool readGEBtrailer(Input& in, GEBData& geb) {
+        Source::word(in, geb.trailer);
+        return(Source::ok(in));
+      }
+
+      //! Header, sumVFAT VFATs and trailer; the header is checked by the caller.
+      static bool readGEB(Input& in, GEBData& geb) {
+        static_assert(!Format::kScanHeader, "a threshold scan has no GEB blocks");
+        if (!readGEBheader(in, geb)) return(false);
+        uint64_t sumVFAT = GEMRaw::sumVFAT(geb.header);
+        geb.vfats.resize(sumVFAT);
+        for (uint64_t ivfat = 0; ivfat < sumVFAT; ivfat++)
+          if (!readEvent(in, 0, geb.vfats[ivfat])) return(false);
+        return(readGEBtrailer(in, geb));
+      }
+
+      //! Decode the binary GEB block at p, its header is already checked.
+      static void decodeGEB(const unsigned char* p, GEBData& geb) {
+        static_assert(std::is_same<Source, Binary>::value, "decodeGEB() is for binary blocks in memory");
+        Input in = p;
+        readGEB(in, geb);
+      }
+
+      //! The whole binary GEB block at the reader position, 0 if its header is wrong or the data ends.
+      template <class Reader> static const unsigned char* peekGEB(Reader& reader) {
+        static_assert(std::is_same<Source, Binary>::value, "peekGEB() is for binary blocks");
+        const unsigned char* p = reader.peek(GEMRaw::kGEBHeaderSize);
+        if (!p || !GEMRaw::headerOK(GEMRaw::load64(p))) return(0);
+        return(reader.peek(GEMRaw::gebSize(GEMRaw::load64(p))));
+      }
+
+      //! read Threshold scan header.
+      static bool readHeader(std::istream& in, AppHeader& ah) {
+        static_assert(Format::kScanHeader, "the format has no scan header");
+        in >> ah.minTh;
+        in >> ah.maxTh;
+        in >> ah.stepSize;
+        return(!in.fail());
+      }
+
+    private:
+
+      static void readBx(Input& in, VFATData& vfat, std::true_type) {
+        Source::word(in, vfat.bxExp);
+        Source::word(in, vfat.bxNum);
+      }
+      static void readBx(Input&, VFATData&, std::false_type) {}
+
+      static void readDelVT(Input& in, VFATData& vfat, std::true_type) { Source::real(in, vfat.delVT); }
+      static void readDelVT(Input&, VFATData&, std::false_type) {}
+  };
+
+} // end of GEMDecoder
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef GEM_Display
+#define GEM_Display
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMDisplay                                                           //
+//                                                                      //
+// Timer driven canvas and web refresh from histogram snapshots        //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <TCanvas.h>
+#include <TH1.h>
+#include <THttpServer.h>
+#include <TTimer.h>
+#include <TVirtualPad.h>
+#include <TString.h>
+
+#include "GEMTelemetry.h"
+
+//! Canvas refresh outside of the event loop.
+/*!
+  \brief GEMDisplay
+  The event loop runs in a worker thread and holds Mutex() while it fills
+  histograms, releasing it between batches of events. The timer fires in
+  the thread running TApplication::Run: it takes the lock only to copy the
+  live histograms into private snapshots, then draws the snapshots with the
+  lock released, so a slow X server never stalls the decoding.
+  The same snapshots can be published on a THttpServer (Publish). The server
+  answers requests from the thread running the timer, so a client always
+  sees a complete snapshot and never touches the live histograms: any
+  number of web clients cost the event loop nothing. Histograms shown on a
+  pad are copied at every tick, the others round robin, at most MaxCopies
+  per tick, so the time spent under the lock does not grow with the number
+  of booked histograms. Without a canvas only the snapshots are kept.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMDisplay : public TTimer {
+  public:
+
+      GEMDisplay(TCanvas* c, Long_t periodMs, GEMTelemetry* t = 0)
+        : TTimer(periodMs, kTRUE), fCanvas(c), fTelemetry(t), fDone(false), fDrawn(false),
+          fMaxCopies(16), fNext(0) {}
+
+      virtual ~GEMDisplay() {
+        for (size_t i = 0; i < fPads.size(); i++) delete fPads[i].snapshot;
+      }
+
+      //! Show histogram h in pad number pad, pad 0 keeps only a snapshot for the web.
+      void Add(TH1* h, int pad = 0, bool logy = false) {
+        Pad p;
+        p.live = h;
+        p.snapshot = (TH1*)h->Clone(TString::Format("%s_snapshot", h->GetName()));
+        p.snapshot->SetDirectory(0);
+        p.pad = pad;
+        p.logy = logy;
+        fPads.push_back(p);
+      }
+
+      //! Register all snapshots on the server, in folder.
+      void Publish(THttpServer* server, const char* folder) {
+        for (size_t i = 0; i < fPads.size(); i++) server->Register(folder, fPads[i].snapshot);
+      }
+
+      //! Histograms without a pad copied per tick.
+      void SetMaxCopies(int n) { fMaxCopies = n; }
+
+      //! Lock held by the event loop while it fills the histograms.
+      std::mutex& Mutex() { return fMutex; }
+
+      //! The event loop is over, draw once more and stop.
+      void Done() { fDone = true; }
+      bool IsDone() const { return fDone; }
+
+      //! Copy the live histograms, the only step done under the lock.
+      void Snapshot(bool all = false) {
+        std::lock_guard<std::mutex> lock(fMutex);
+        int copies = 0;
+        size_t next = fNext;
+        for (size_t n = 0; n < fPads.size(); n++) {
+          size_t i = (fNext + n) % fPads.size();
+          if (!all && !fPads[i].pad) {
+            if (copies == fMaxCopies) continue;
+            copies++;
+            next = i + 1;
+          }
+          // the contents only: TH1::Copy would also give the snapshot the name
+          // of the live histogram and put it in gDirectory, the output file
+          fPads[i].snapshot->Reset();
+          fPads[i].snapshot->Add(fPads[i].live);
+        }
+        fNext = next;
+      }
+
+      void Draw() {
+        if (!fCanvas) return;
+        for (size_t i = 0; i < fPads.size(); i++) {
+          if (!fPads[i].pad) continue;
+          TVirtualPad* pad = fCanvas->cd(fPads[i].pad);
+          if (!fDrawn) {
+            if (fPads[i].logy) pad->SetLogy();
+            fPads[i].snapshot->Draw();
+          }
+          pad->Modified();
+        }
+        fCanvas->Update();
+        fDrawn = true;
+      }
+
+      virtual Bool_t Notify() {
+        bool last = fDone;
+        uint64_t t0 = GEMTelemetry::now();
+        Snapshot(last);
+        Draw();
+        if (fTelemetry) fTelemetry->stage(GEMTelemetry::kDraw, GEMTelemetry::now() - t0);
+        if (last) TurnOff();
+        else Reset();
+        return kTRUE;
+      }
+
+  private:
+
+      struct Pad {
+        TH1* live;
+        TH1* snapshot;
+        int  pad;
+        bool logy;
+      };
+
+      TCanvas* fCanvas;
+      GEMTelemetry* fTelemetry;
+      std::vector<Pad> fPads;
+      std::mutex fMutex;
+      std::atomic<bool> fDone;
+      bool fDrawn;
+      int fMaxCopies;
+      size_t fNext;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef GEM_Follow
+#define GEM_Follow
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMFollow                                                            //
+//                                                                      //
+// Waiting for a data file which is still being written                 //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+//! Tail of a growing file.
+/*!
+  \brief GEMFollow
+  wait() returns as soon as the file is larger than a given size, or false
+  after idle seconds without growth. On Linux it sleeps on inotify
+  IN_MODIFY events, elsewhere, or if inotify is not available (e.g. on some
+  network file systems), it polls the file size every pollMs milliseconds.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMFollow {
+  public:
+
+      GEMFollow(const std::string& path, int pollMs = 200)
+        : fPath(path), fFd(-1), fWd(-1), fPollMs(pollMs) {
+#ifdef __linux__
+        fFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fFd >= 0) fWd = inotify_add_watch(fFd, path.c_str(), IN_MODIFY | IN_CLOSE_WRITE);
+        if (fWd < 0 && fFd >= 0) { close(fFd); fFd = -1; }
+#endif
+      }
+
+      ~GEMFollow() { if (fFd >= 0) close(fFd); }
+
+      bool inotify() const { return fFd >= 0; }
+
+      //! Current file size, -1 if it cannot be read.
+      int64_t size() const {
+        struct stat st;
+        if (stat(fPath.c_str(), &st) != 0) return -1;
+        return st.st_size;
+      }
+
+      //! Wait until the file is larger than "than", false after idle seconds or when stop is set.
+      bool wait(int64_t than, double idle, const std::atomic<bool>* stop = 0) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (;;) {
+          if (size() > than) return true;
+          if (stop && *stop) return false;
+          double left = idle - std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+          if (left <= 0) return false;
+          // the stop flag and the idle time are looked at least once per second
+          int ms = left < 1. ? (int)(left*1000) + 1 : 1000;
+          if (fFd >= 0) {
+            struct pollfd p = { fFd, POLLIN, 0 };
+            if (poll(&p, 1, ms) > 0) drain();
+          } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms < fPollMs ? ms : fPollMs));
+          }
+        }
+      }
+
+  private:
+
+      void drain() {
+        char buf[4096];
+        while (read(fFd, buf, sizeof(buf)) > 0) {}
+      }
+
+      std::string fPath;
+      int fFd, fWd;
+      int fPollMs;
+};
+
+#endif
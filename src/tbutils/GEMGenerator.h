@@ -0,0 +1,260 @@
+#ifndef GEM_Generator
+#define GEM_Generator
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMGenerator                                                         //
+//                                                                      //
+// Synthetic AMC/GEB/VFAT2 data for load and soak testing               //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "GEMRaw.h"
+#include "GEMCrc.h"
+
+//! Synthetic GEM data generator.
+/*!
+  \brief GEMGenerator
+  Produces events of nChambers GEB blocks with nChips VFAT2 words each, in
+  the hex format read by gem-reading.cc or the binary format of
+  writeVFATdataBinary. Hits come in clusters: the number of clusters per
+  chip is Poisson with mean occupancy*128/clusterSize, the cluster width is
+  1 + Poisson(clusterSize-1). All VFAT CRCs are valid unless an error is
+  injected. The output is fully determined by the seed: events are made in
+  chunks of kChunk, each chunk has its own random stream (seekChunk), so
+  several generators can make different chunks of the same output.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMGenerator {
+  public:
+
+      struct Config {
+        int      nChambers;    /*!<GEB blocks per event */
+        int      nChips;       /*!<VFAT2 chips per GEB, at most 24 */
+        double   occupancy;    /*!<mean fraction of hit channels per chip */
+        double   clusterSize;  /*!<mean number of strips per cluster */
+        double   errorRate;    /*!<probability of a corrupted VFAT word */
+        uint64_t seed;
+        bool     binary;       /*!<binary instead of hex output */
+        bool     amc;          /*!<wrap the GEB blocks into AMC headers and trailers */
+        uint64_t ChamID0;      /*!<ChamID of the first chamber, others follow */
+
+        Config() : nChambers(1), nChips(24), occupancy(0.01), clusterSize(2.),
+                   errorRate(0.), seed(12345), binary(false), amc(false), ChamID0(0xdea) {}
+      };
+
+      //! Kinds of injected errors.
+      enum { kErrCRC, kErrControl, kErrFlag, kErrTruncate, kNErr };
+
+      static const uint64_t kChunk = 4096;   /*!<events per random stream */
+
+      GEMGenerator(const Config& c) : cfg(c), event_(0), nVFAT(0), nErrors(0) {
+        if (cfg.nChips > (int)GEMRaw::kMaxVFAT) cfg.nChips = GEMRaw::kMaxVFAT;
+        if (cfg.nChips < 1) cfg.nChips = 1;
+        if (cfg.clusterSize < 1.) cfg.clusterSize = 1.;
+        poissonTable(cfg.occupancy*128./cfg.clusterSize, nClusterCDF);
+        poissonTable(cfg.clusterSize - 1., widthCDF);
+        // 2^64 - 1 as a double is 2^64, out of the range of uint64_t
+        if (cfg.errorRate >= 1.) errorThreshold = ~0ULL;
+        else if (cfg.errorRate > 0.) errorThreshold = (uint64_t)(cfg.errorRate * 18446744073709551615.);
+        else errorThreshold = 0;
+
+        // distinct ChipIDs on every chamber
+        s0 = splitmix(~cfg.seed);
+        s1 = splitmix(s0);
+        for (int c = 0; c < cfg.nChambers; c++) {
+          std::vector<uint16_t> ids;
+          while ((int)ids.size() < cfg.nChips) {
+            uint16_t id = next() & 0x0fff;
+            bool used = false;
+            for (size_t k = 0; k < ids.size(); k++) used |= (ids[k] == id);
+            if (!used) ids.push_back(id);
+          }
+          chipIDs.push_back(ids);
+        }
+        seekChunk(0);
+      }
+
+      //! Start chunk ichunk, the next event is ichunk*kChunk.
+      void seekChunk(uint64_t ichunk) {
+        event_ = ichunk*kChunk;
+        s0 = splitmix(cfg.seed ^ (ichunk*0xd1b54a32d192ed03ULL));
+        s1 = splitmix(s0 ^ 0x9e3779b97f4a7c15ULL);
+      }
+
+      //! Largest number of bytes one event() call can write.
+      size_t maxEventSize() const {
+        size_t geb = (17 + 1)*2 + cfg.nChips*(3*5 + 2*17 + 5);
+        return (cfg.amc ? 5*17 : 0) + cfg.nChambers*geb;
+      }
+
+      //! Write the next event at out, returns the number of bytes written.
+      size_t event(char* out) {
+        char* p = out;
+        uint16_t BC = 0xa000 | (next() & 0x0fff);
+        uint16_t EC = 0xc000 | ((event_ & 0xff) << 4);
+
+        if (cfg.amc) {
+          uint64_t words = 5 + cfg.nChambers*(2 + 3*cfg.nChips);
+          uint64_t LV1ID = event_ & 0xffffff;
+          uint64_t header1 = (LV1ID << 32) | ((uint64_t)(BC & 0x0fff) << 20) | (words & 0xfffff);
+          uint64_t header2 = 0;
+          uint64_t DAVList = (cfg.nChambers >= 24) ? 0xffffff : ((1ULL << cfg.nChambers) - 1);
+          uint64_t header3 = (DAVList << 40) | ((uint64_t)(cfg.nChambers & 0x1f) << 11);
+          p = word(p, header1); p = word(p, header2); p = word(p, header3);
+        }
+
+        for (int c = 0; c < cfg.nChambers; c++) {
+          uint64_t ZSFlag = 0;
+          for (int k = 0; k < cfg.nChips; k++) ZSFlag |= (1ULL << (23-k));
+          uint64_t ChamID = (cfg.ChamID0 + c) & 0xfff;
+          p = word(p, (ZSFlag << 40) | (ChamID << 28) | cfg.nChips);
+
+          uint16_t OHcrc = 0xffff;
+          const uint16_t* t = GEMCrc::table();
+          bool truncated = false;
+          for (int k = 0; k < cfg.nChips && !truncated; k++) {
+            uint64_t lsData = 0, msData = 0;
+            hits(lsData, msData);
+            uint16_t ChipID = 0xe000 | chipIDs[c][k];
+            uint16_t vEC = EC;
+            uint16_t vBC = BC;
+            nVFAT++;
+
+            int err = kNErr;
+            if (errorThreshold && next() < errorThreshold) {
+              err = next() % kNErr;
+              nErrors++;
+            }
+            if (err == kErrControl) vBC ^= 0x1000 << (next() % 4);
+            if (err == kErrFlag)    vEC |= 1 + (next() & 0x7);
+            if (err == kErrTruncate) truncated = true;
+
+            // the CRC of the words as written, only kErrCRC breaks it
+            uint16_t crc = GEMCrc::vfatCRC(vBC, vEC, ChipID, lsData, msData);
+            if (err == kErrCRC)     crc ^= 1 + (next() & 0x7fff);
+
+            OHcrc = GEMCrc::update(t, OHcrc, crc);
+            p = vfat(p, vBC, vEC, ChipID, lsData, msData, crc, truncated);
+          }
+
+          // OptoHybrid trailer: CRC over the VFAT CRCs, 64 bits word count
+          uint64_t OHwCount = 3*cfg.nChips;
+          p = word(p, ((uint64_t)OHcrc << 48) | (OHwCount << 32));
+        }
+
+        if (cfg.amc) {
+          uint64_t words = 5 + cfg.nChambers*(2 + 3*cfg.nChips);
+          uint64_t trailer2 = 0;
+          uint64_t trailer1 = ((event_ & 0xff) << 24) | (words & 0xfffff);  // AMC crc:32 not computed
+          p = word(p, trailer2); p = word(p, trailer1);
+        }
+        event_++;
+        return p - out;
+      }
+
+      Config   cfg;
+      uint64_t event_;
+      uint64_t nVFAT;     /*!<VFAT words written */
+      uint64_t nErrors;   /*!<VFAT words with an injected error */
+
+  private:
+
+      std::vector< std::vector<uint16_t> > chipIDs;
+      std::vector<double> nClusterCDF, widthCDF;
+      uint64_t errorThreshold;
+      uint64_t s0, s1;
+
+      static uint64_t splitmix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+      }
+
+      //! xorshift128+
+      uint64_t next() {
+        uint64_t x = s0, y = s1;
+        s0 = y;
+        x ^= x << 23;
+        s1 = x ^ y ^ (x >> 17) ^ (y >> 26);
+        return s1 + y;
+      }
+
+      double uniform() { return (next() >> 11) * (1.0/9007199254740992.0); }
+
+      static void poissonTable(double mean, std::vector<double>& cdf) {
+        cdf.clear();
+        if (mean <= 0.) { cdf.push_back(1.); return; }
+        double p = exp(-mean), sum = p;
+        cdf.push_back(sum);
+        for (int k = 1; k < 128 && sum < 1. - 1e-12; k++) {
+          p *= mean/k;
+          sum += p;
+          cdf.push_back(sum);
+        }
+      }
+
+      int poisson(const std::vector<double>& cdf) {
+        double u = uniform();
+        int k = 0;
+        while (k < (int)cdf.size() - 1 && u > cdf[k]) k++;
+        return k;
+      }
+
+      void hits(uint64_t& lsData, uint64_t& msData) {
+        int nClusters = poisson(nClusterCDF);
+        for (int i = 0; i < nClusters; i++) {
+          int first = next() & 0x7f;
+          int width = 1 + poisson(widthCDF);
+          for (int chan = first; chan < first + width && chan < 128; chan++) {
+            if (chan < 64) lsData |= (1ULL << chan);
+            else           msData |= (1ULL << (chan-64));
+          }
+        }
+      }
+
+      //! Lower case hex without leading zeros and a new line, as "outf << hex << x << endl".
+      static char* hexWord(char* p, uint64_t x) {
+        static const char digits[] = "0123456789abcdef";
+        int n = x ? (64 - __builtin_clzll(x) + 3)/4 : 1;
+        for (int i = n - 1; i >= 0; i--) { p[i] = digits[x & 0xf]; x >>= 4; }
+        p[n] = '\n';
+        return p + n + 1;
+      }
+
+      char* word(char* p, uint64_t x) {
+        if (!cfg.binary) return hexWord(p, x);
+        GEMRaw::store64((unsigned char*)p, x);
+        return p + 8;
+      }
+
+      char* vfat(char* p, uint16_t BC, uint16_t EC, uint16_t ChipID,
+                 uint64_t lsData, uint64_t msData, uint16_t crc, bool truncated) {
+        if (cfg.binary) {
+          unsigned char* b = (unsigned char*)p;
+          GEMRaw::store16(b + GEMRaw::kBCOffset,     BC);
+          GEMRaw::store16(b + GEMRaw::kECOffset,     EC);
+          GEMRaw::store16(b + GEMRaw::kChipIDOffset, ChipID);
+          GEMRaw::store64(b + GEMRaw::kLsDataOffset, lsData);
+          GEMRaw::store64(b + GEMRaw::kMsDataOffset, msData);
+          GEMRaw::store16(b + GEMRaw::kCrcOffset,    crc);
+          return p + (truncated ? GEMRaw::kLsDataOffset : GEMRaw::kVFATSize);
+        }
+        p = hexWord(p, BC);
+        p = hexWord(p, EC);
+        p = hexWord(p, ChipID);
+        if (truncated) return p;
+        p = hexWord(p, lsData);
+        p = hexWord(p, msData);
+        return hexWord(p, crc);
+      }
+};
+
+#endif
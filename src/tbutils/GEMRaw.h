@@ -0,0 +1,82 @@
+#ifndef GEM_Raw
+#define GEM_Raw
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMRaw                                                               //
+//                                                                      //
+// Layout of the raw GEB/VFAT stream as written by gem-re-write.cc      //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <cstring>
+
+//! Raw GEB/VFAT stream layout.
+/*!
+  \brief GEMRaw
+  Binary stream (writeGEBheaderBinary, writeVFATdataBinary, writeGEBtrailerBinary):
+
+    GEB header   64 bits   ZSFlag:24 ChamID:12 sumVFAT:28
+    VFAT * sumVFAT, 24 bytes each, packed, host byte order:
+                 BC:16 EC:16 ChipID:16 lsData:64 msData:64 crc:16
+    GEB trailer  64 bits   OHcrc:16 OHwCount:16 ChamStatus:16
+
+  Hex stream (writeGEBheader, writeVFATdata, writeGEBtrailer) has the same
+  fields as whitespace separated hex numbers.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMRaw {
+
+  const int kGEBHeaderSize  = 8;
+  const int kGEBTrailerSize = 8;
+  const int kVFATSize       = 24;
+
+  const int kBCOffset     = 0;
+  const int kECOffset     = 2;
+  const int kChipIDOffset = 4;
+  const int kLsDataOffset = 6;
+  const int kMsDataOffset = 14;
+  const int kCrcOffset    = 22;
+
+  const uint64_t kMaxVFAT = 24;    /*!<one ZSFlag bit per VFAT slot on a GEB */
+  const uint64_t kMaxGEBSize = kGEBHeaderSize + kMaxVFAT*kVFATSize + kGEBTrailerSize;
+
+  const uint16_t k1010 = 0xa;      /*!<BC control bits */
+  const uint16_t k1100 = 0xc;      /*!<EC control bits */
+  const uint16_t k1110 = 0xe;      /*!<ChipID control bits */
+
+  inline uint16_t load16(const unsigned char* p) { uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+  inline uint64_t load64(const unsigned char* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+  inline void store16(unsigned char* p, uint16_t v) { memcpy(p, &v, sizeof(v)); }
+  inline void store64(unsigned char* p, uint64_t v) { memcpy(p, &v, sizeof(v)); }
+
+  inline uint64_t ZSFlag (uint64_t header) { return (0xffffff0000000000 & header) >> 40; }
+  inline uint64_t ChamID (uint64_t header) { return (0x000000fff0000000 & header) >> 28; }
+  inline uint64_t sumVFAT(uint64_t header) { return (0x000000000fffffff & header); }
+
+  //! Control bits 1010/1100/1110 of one VFAT word.
+  inline bool controlBitsOK(uint16_t BC, uint16_t EC, uint16_t ChipID) {
+    return ((BC >> 12) == k1010) && ((EC >> 12) == k1100) && ((ChipID >> 12) == k1110);
+  }
+
+  //! Two of the three control bits right: a VFAT of a damaged block still tells where the block starts.
+  inline bool nearlyOK(uint16_t BC, uint16_t EC, uint16_t ChipID) {
+    return ((BC >> 12) == k1010) + ((EC >> 12) == k1100) + ((ChipID >> 12) == k1110) >= 2;
+  }
+
+  //! GEB header is plausible: at least one and at most kMaxVFAT chips.
+  inline bool headerOK(uint64_t header) {
+    uint64_t n = sumVFAT(header);
+    return (n > 0) && (n <= kMaxVFAT);
+  }
+
+  //! Bytes of a binary GEB block, header and trailer included.
+  inline uint64_t gebSize(uint64_t header) {
+    return kGEBHeaderSize + sumVFAT(header)*kVFATSize + kGEBTrailerSize;
+  }
+
+} // end of GEMRaw
+
+#endif
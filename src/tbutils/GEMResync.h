@@ -0,0 +1,280 @@
+#ifndef GEM_Resync
+#define GEM_Resync
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMResync                                                            //
+//                                                                      //
+// Recovery of a desynchronized GEB/VFAT stream                         //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <istream>
+#include <vector>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "GEMRaw.h"
+
+//! Stream resynchronization.
+/*!
+  \brief GEMResync
+  After a corrupted or truncated VFAT word the reader loses the GEB framing.
+  GEMResync scans ahead for the next GEB header followed by VFAT words with
+  the 1010/1100/1110 control bits, reports the skipped byte range and leaves
+  the stream positioned on that header. Candidates are located 16 bytes at a
+  time with SSE2 compares, the full GEB block is then verified word by word.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMResync {
+  public:
+
+      struct Range {
+        int64_t from;   /*!<first skipped byte */
+        int64_t to;     /*!<first byte after the skipped range */
+      };
+
+      GEMResync() : nSkipped(0), maxPrint(20), growing(false), scanned(0) {}
+
+      std::vector<Range> skipped;   /*!<all skipped byte ranges, in stream order */
+      int64_t nSkipped;             /*!<total number of skipped bytes */
+      int maxPrint;                 /*!<print at most maxPrint ranges while running */
+      bool growing;                 /*!<the stream is still being written, see resync() */
+      int64_t scanned;              /*!<end of the data seen by the last resync() */
+
+      //
+      // Hex stream
+      //
+
+      static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+      static int hexDigit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+      }
+
+      //! Parse one hex token at buf[i], returns offset after it or -1.
+      static long hexToken(const char* buf, long n, long i, uint64_t& value) {
+        value = 0;
+        long j = i;
+        for (; j < n && j - i < 16; j++) {
+          int d = hexDigit(buf[j]);
+          if (d < 0) break;
+          value = (value << 4) | d;
+        }
+        if (j == i) return -1;
+        if (j < n && !isSpace(buf[j])) return -1;
+        return j;
+      }
+
+      static long skipSpace(const char* buf, long n, long i) {
+        while (i < n && isSpace(buf[i])) i++;
+        return i;
+      }
+
+      //! Verify a GEB block whose first VFAT BC token starts at buf[i].
+      /*!
+        Returns the offset of the GEB header token or -1. A block running past
+        the end of the buffer is accepted if everything inside the buffer matches.
+       */
+      static long verifyHex(const char* buf, long n, long i, bool atStart) {
+        // GEB header is the previous token
+        long e = i - 1;
+        while (e >= 0 && isSpace(buf[e])) e--;
+        if (e < 0) return -1;
+        long h = e;
+        while (h >= 0 && hexDigit(buf[h]) >= 0) h--;
+        if (h < 0 && !atStart) return -1;    // header token may continue before the buffer
+        if (h >= 0 && !isSpace(buf[h])) return -1;
+        h++;
+
+        uint64_t header = 0;
+        if (hexToken(buf, n, h, header) != e + 1) return -1;
+        if (!GEMRaw::headerOK(header)) return -1;
+
+        long p = i;
+        uint64_t word[6];
+        for (uint64_t ivfat = 0; ivfat < GEMRaw::sumVFAT(header); ivfat++) {
+          for (int k = 0; k < 6; k++) {
+            p = skipSpace(buf, n, p);
+            if (p >= n) return h;
+            p = hexToken(buf, n, p, word[k]);
+            if (p < 0) return -1;
+          }
+          if (word[0] > 0xffff || word[1] > 0xffff || word[2] > 0xffff || word[5] > 0xffff) return -1;
+          if (!GEMRaw::controlBitsOK(word[0], word[1], word[2])) return -1;
+        }
+        uint64_t trailer = 0;
+        p = skipSpace(buf, n, p);
+        if (p < n && hexToken(buf, n, p, trailer) < 0) return -1;
+        return h;
+      }
+
+      //! Offset of the next valid GEB header token in buf, or -1.
+      /*!
+        A candidate is a whitespace preceded 'a' (first digit of the BC word).
+       */
+      static long findHex(const char* buf, long n, bool atStart) {
+        long i = 1;
+#ifdef __SSE2__
+        const __m128i la = _mm_set1_epi8('a'), ua = _mm_set1_epi8('A');
+        const __m128i nl = _mm_set1_epi8('\n'), sp = _mm_set1_epi8(' ');
+        const __m128i cr = _mm_set1_epi8('\r'), tb = _mm_set1_epi8('\t');
+        for (; i + 16 <= n; i += 16) {
+          __m128i c = _mm_loadu_si128((const __m128i*)(buf + i));
+          __m128i w = _mm_loadu_si128((const __m128i*)(buf + i - 1));
+          __m128i ma = _mm_or_si128(_mm_cmpeq_epi8(c, la), _mm_cmpeq_epi8(c, ua));
+          __m128i ms = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(w, nl), _mm_cmpeq_epi8(w, sp)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(w, cr), _mm_cmpeq_epi8(w, tb)));
+          unsigned int mask = _mm_movemask_epi8(_mm_and_si128(ma, ms));
+          while (mask) {
+            long k = i + __builtin_ctz(mask);
+            long h = verifyHex(buf, n, k, atStart);
+            if (h >= 0) return h;
+            mask &= mask - 1;
+          }
+        }
+#endif
+        for (; i < n; i++) {
+          if ((buf[i] == 'a' || buf[i] == 'A') && isSpace(buf[i-1])) {
+            long h = verifyHex(buf, n, i, atStart);
+            if (h >= 0) return h;
+          }
+        }
+        return -1;
+      }
+
+      //
+      // Binary stream
+      //
+
+      //! Verify a GEB block whose first VFAT word starts at buf[r].
+      /*!
+        With framed, for a resync candidate, the block must also end where
+        the buffer ends or where the next GEB header follows, with two of the
+        three control bits of its first VFAT right: a short "block" made of
+        the header-like bytes of a VFAT word passes the control bits check of
+        its one to three VFATs far too often.
+       */
+      static bool verifyBinary(const unsigned char* buf, long n, long r, bool framed = false) {
+        if (r < GEMRaw::kGEBHeaderSize) return false;
+        uint64_t header = GEMRaw::load64(buf + r - GEMRaw::kGEBHeaderSize);
+        if (!GEMRaw::headerOK(header)) return false;
+        for (uint64_t ivfat = 0; ivfat < GEMRaw::sumVFAT(header); ivfat++) {
+          const unsigned char* v = buf + r + ivfat*GEMRaw::kVFATSize;
+          if (v + GEMRaw::kVFATSize > buf + n) return true;
+          if (!GEMRaw::controlBitsOK(GEMRaw::load16(v + GEMRaw::kBCOffset),
+                                     GEMRaw::load16(v + GEMRaw::kECOffset),
+                                     GEMRaw::load16(v + GEMRaw::kChipIDOffset))) return false;
+        }
+        if (!framed) return true;
+        long next = r - GEMRaw::kGEBHeaderSize + GEMRaw::gebSize(header);
+        if (next + GEMRaw::kGEBHeaderSize > n) return true;
+        if (!GEMRaw::headerOK(GEMRaw::load64(buf + next))) return false;
+        if (next + GEMRaw::kGEBHeaderSize + GEMRaw::kLsDataOffset > n) return true;
+        const unsigned char* v = buf + next + GEMRaw::kGEBHeaderSize;
+        return GEMRaw::nearlyOK(GEMRaw::load16(v + GEMRaw::kBCOffset), GEMRaw::load16(v + GEMRaw::kECOffset),
+                                GEMRaw::load16(v + GEMRaw::kChipIDOffset));
+      }
+
+      //! Offset of the next valid GEB header in a binary buffer, or -1.
+      /*!
+        The high bytes of BC, EC and ChipID are at record offsets 1, 3 and 5
+        (little endian host), three nibble compares give all candidates of a
+        16 byte window at once.
+       */
+      static long findBinary(const unsigned char* buf, long n) {
+        long r = GEMRaw::kGEBHeaderSize;
+#ifdef __SSE2__
+        const __m128i hi = _mm_set1_epi8((char)0xf0);
+        const __m128i a0 = _mm_set1_epi8((char)0xa0);
+        const __m128i c0 = _mm_set1_epi8((char)0xc0);
+        const __m128i e0 = _mm_set1_epi8((char)0xe0);
+        for (; r + 21 <= n; r += 16) {
+          __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(buf + r + 1)), hi);
+          __m128i e = _mm_and_si128(_mm_loadu_si128((const __m128i*)(buf + r + 3)), hi);
+          __m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i*)(buf + r + 5)), hi);
+          unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(b, a0))
+                            & _mm_movemask_epi8(_mm_cmpeq_epi8(e, c0))
+                            & _mm_movemask_epi8(_mm_cmpeq_epi8(c, e0));
+          while (mask) {
+            long k = r + __builtin_ctz(mask);
+            if (verifyBinary(buf, n, k, true)) return k - GEMRaw::kGEBHeaderSize;
+            mask &= mask - 1;
+          }
+        }
+#endif
+        for (; r + 6 <= n; r++) {
+          if ((buf[r+1] & 0xf0) == 0xa0 && (buf[r+3] & 0xf0) == 0xc0 && (buf[r+5] & 0xf0) == 0xe0
+              && verifyBinary(buf, n, r, true)) return r - GEMRaw::kGEBHeaderSize;
+        }
+        return -1;
+      }
+
+      //
+      // Stream recovery
+      //
+
+      //! Position the stream on the next valid GEB header at or after "from".
+      /*!
+        Returns false if the end of the stream is reached, the rest of the
+        stream is then reported as skipped. On a growing stream nothing is
+        reported and the stream is left at "from", to be retried once more
+        data has been written.
+       */
+      bool resync(std::istream& inpf, int64_t from, bool binary) {
+        const long kChunk = 1 << 16, kOverlap = 64;
+        std::vector<char> buf(kChunk);
+        int64_t base = from;
+        for (;;) {
+          inpf.clear();
+          inpf.seekg(base);
+          inpf.read(&buf[0], kChunk);
+          long n = inpf.gcount();
+          if (n <= 0) break;
+          long off = binary ? findBinary((const unsigned char*)&buf[0], n)
+                            : findHex(&buf[0], n, base == 0);
+          if (off >= 0) {
+            addRange(from, base + off);
+            inpf.clear();
+            inpf.seekg(base + off);
+            return true;
+          }
+          if (n < kChunk) { base += n; break; }
+          base += kChunk - kOverlap;
+        }
+        scanned = base;
+        inpf.clear();
+        if (growing) {
+          inpf.seekg(from);
+          return false;
+        }
+        inpf.seekg(0, std::ios::end);
+        int64_t end = inpf.tellg();
+        addRange(from, end > base ? end : base);
+        return false;
+      }
+
+      void addRange(int64_t from, int64_t to) {
+        if (to <= from) return;
+        Range r = { from, to };
+        skipped.push_back(r);
+        nSkipped += to - from;
+        if ((int)skipped.size() <= maxPrint) {
+          std::cout << "resync: skipped bytes [" << from << ", " << to << ") " << to - from << std::endl;
+        }
+      }
+
+      void Print() const {
+        std::cout << "resync: " << skipped.size() << " ranges, " << nSkipped << " bytes skipped" << std::endl;
+      }
+};
+
+#endif
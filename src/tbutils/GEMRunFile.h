@@ -0,0 +1,451 @@
+#ifndef GEM_RunFile
+#define GEM_RunFile
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMRunFile                                                           //
+//                                                                      //
+// Self-describing binary run format: run header, checksummed blocks    //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "GEMRaw.h"
+#include "GEMWriter.h"
+#include "GEMByteOrder.h"
+
+//! Binary run file.
+/*!
+  \brief GEMRunFile
+  A run is a run header followed by blocks of whole binary GEB blocks
+  (GEMRaw layout, unchanged). Runs may follow each other in one file, as
+  gem-re-write appends to its output.
+
+    run header   64 bytes   kMagic, kByteOrder as written by the host,
+                            version, header size, flags, run number,
+                            date (yyyymmdd), time (hhmmss), AppHeader
+                            (minTh, maxTh, stepSize), crc32 of bytes 0-55
+    block        32 bytes   kBlockMagic, GEB bytes, GEB blocks, VFATs,
+                            first event, crc32 of the payload, crc32 of
+                            bytes 0-27 of the block header
+                 GEB blocks
+                 with kDelVT: delVT of every VFAT, 8 bytes each
+
+  The block header gives the size of the block, so a reader steps over a
+  block, or finds the one holding an event, from the headers alone, and
+  drops a block with a wrong payload crc without looking at the next one.
+  Only a damaged block header makes the reader search for the next magic.
+  A run written on a host of the other byte order is read as well: kMagic
+  and kByteOrder come out reversed, the header fields are swapped on
+  reading, the GEB blocks through GEMByteOrder::swapBlocks.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMRunFile {
+
+  const uint64_t kMagic      = 0x20204e5552204d47ULL;   /*!<"GM RUN  " */
+  const uint64_t kByteOrder  = 0x0102030405060708ULL;
+  const uint32_t kBlockMagic = 0x4b425247;              /*!<"GRBK" */
+  const uint32_t kVersion    = 1;
+  const size_t   kHeaderSize = 64;
+  const size_t   kBlockHeaderSize = 32;
+
+  enum Flags { kDelVT = 1 };
+
+  inline void put32(unsigned char* p, uint32_t v) { memcpy(p, &v, 4); }
+  inline uint32_t get32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+  inline uint32_t get32(const unsigned char* p, bool swap) { return swap ? __builtin_bswap32(get32(p)) : get32(p); }
+  inline uint64_t get64(const unsigned char* p, bool swap) { return swap ? __builtin_bswap64(GEMRaw::load64(p)) : GEMRaw::load64(p); }
+
+  //! A run magic, of either byte order.
+  inline bool isMagic(const unsigned char* p) { return GEMRaw::load64(p) == kMagic || GEMRaw::load64(p) == __builtin_bswap64(kMagic); }
+  inline bool isBlockMagic(const unsigned char* p) { return get32(p) == kBlockMagic || get32(p) == __builtin_bswap32(kBlockMagic); }
+
+  //! What the run header describes.
+  struct RunHeader {
+    uint32_t version, flags;
+    int32_t  run, date, time;
+    int32_t  minTh, maxTh, stepSize;   /*!<threshold scan AppHeader */
+    uint32_t size;                     /*!<bytes of the header, as read */
+    bool     swapped;                  /*!<written with the other byte order, as read */
+    RunHeader() : version(kVersion), flags(0), run(0), date(0), time(0), minTh(0), maxTh(0), stepSize(0), size(kHeaderSize), swapped(false) {}
+
+    //! date and time of now, local time.
+    void Now() {
+      time_t t = ::time(0);
+      struct tm tm;
+      localtime_r(&t, &tm);
+      date = (tm.tm_year + 1900)*10000 + (tm.tm_mon + 1)*100 + tm.tm_mday;
+      this->time = tm.tm_hour*10000 + tm.tm_min*100 + tm.tm_sec;
+    }
+  };
+
+  inline void packHeader(const RunHeader& r, unsigned char* h) {
+    memset(h, 0, kHeaderSize);
+    GEMRaw::store64(h, kMagic);
+    GEMRaw::store64(h + 8, kByteOrder);
+    put32(h + 16, r.version);
+    put32(h + 20, kHeaderSize);
+    put32(h + 24, r.flags);
+    put32(h + 28, r.run);
+    put32(h + 32, r.date);
+    put32(h + 36, r.time);
+    put32(h + 40, r.minTh);
+    put32(h + 44, r.maxTh);
+    put32(h + 48, r.stepSize);
+    put32(h + 56, crc32(0, h, 56));
+  }
+
+  //! false if h is not a valid run header of either byte order.
+  inline bool unpackHeader(const unsigned char* h, RunHeader& r, std::string& error) {
+    if (!isMagic(h)) { error = "not a GEM run file"; return false; }
+    bool swap = GEMRaw::load64(h) != kMagic;
+    if (get64(h + 8, swap) != kByteOrder) { error = "byte order mark"; return false; }
+    if (get32(h + 56, swap) != crc32(0, h, 56)) { error = "run header crc"; return false; }
+    r.version  = get32(h + 16, swap);
+    if (r.version != kVersion) { error = "unknown version"; return false; }
+    r.size     = get32(h + 20, swap);
+    r.flags    = get32(h + 24, swap);
+    r.run      = get32(h + 28, swap);
+    r.date     = get32(h + 32, swap);
+    r.time     = get32(h + 36, swap);
+    r.minTh    = get32(h + 40, swap);
+    r.maxTh    = get32(h + 44, swap);
+    r.stepSize = get32(h + 48, swap);
+    r.swapped  = swap;
+    return true;
+  }
+
+  //! One block as told by its header.
+  struct Block {
+    uint32_t gebBytes, nGEB, nVFAT, crc;
+    uint64_t firstEvent;
+    uint64_t size(uint32_t flags) const { return kBlockHeaderSize + gebBytes + ((flags & kDelVT) ? 8ULL*nVFAT : 0); }
+  };
+
+  inline void packBlock(const Block& b, unsigned char* h) {
+    put32(h, kBlockMagic);
+    put32(h + 4,  b.gebBytes);
+    put32(h + 8,  b.nGEB);
+    put32(h + 12, b.nVFAT);
+    GEMRaw::store64(h + 16, b.firstEvent);
+    put32(h + 24, b.crc);
+    put32(h + 28, crc32(0, h, 28));
+  }
+
+  //! swap: the run was written with the other byte order.
+  inline bool unpackBlock(const unsigned char* h, Block& b, bool swap = false) {
+    if (get32(h, swap) != kBlockMagic || get32(h + 28, swap) != crc32(0, h, 28)) return false;
+    b.gebBytes   = get32(h + 4, swap);
+    b.nGEB       = get32(h + 8, swap);
+    b.nVFAT      = get32(h + 12, swap);
+    b.firstEvent = get64(h + 16, swap);
+    b.crc        = get32(h + 24, swap);
+    return true;
+  }
+
+} // end of GEMRunFile
+
+//! Writes runs of a GEMRunFile.
+/*!
+  \brief GEMRunWriter
+  Has the put/binary/endBlock calls of GEMWriter for the gem-re-write.cc
+  write functions; the delVT of the VFATs of a GEB block are given with
+  delVT() before its endBlock(). A block is closed once blockSize GEB bytes
+  are collected.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMRunWriter {
+  public:
+
+      GEMRunWriter() : nBlocks(0), nEvents(0), fBlockSize(1 << 20), fStart(0), fVFATs(0), fGEBs(0) {}
+
+      ~GEMRunWriter() { close(); }
+
+      //! Open path, appending a new run to it or truncating it, and write the run header.
+      bool open(const std::string& path, const GEMRunFile::RunHeader& run, bool append = true, size_t blockSize = 1 << 20) {
+        fRun = run;
+        fBlockSize = blockSize ? blockSize : 1 << 20;
+        if (!fFile.open(path, append)) { error = fFile.error; return false; }
+        unsigned char h[GEMRunFile::kHeaderSize];
+        GEMRunFile::packHeader(fRun, h);
+        fFile.put(h, sizeof(h));
+        return fFile.flush();
+      }
+
+      bool is_open() const { return fFile.is_open(); }
+      bool ok() const { return error.empty() && fFile.ok(); }
+
+      void put(const void* p, size_t n) { fRaw.insert(fRaw.end(), (const char*)p, (const char*)p + n); }
+      template <class T> void binary(T v) { put(&v, sizeof(v)); }
+      void hex(uint64_t) { error = "a run file is binary"; }
+
+      //! delVT of the next VFAT, kDelVT runs only.
+      void delVT(double v) { fDelVT.push_back(v); }
+
+      //! End of a GEB block.
+      bool endBlock() {
+        if (fRaw.size() >= fStart + GEMRaw::kGEBHeaderSize) fVFATs += GEMRaw::sumVFAT(GEMRaw::load64((const unsigned char*)&fRaw[fStart]));
+        fStart = fRaw.size();
+        fGEBs++;
+        if ((fRun.flags & GEMRunFile::kDelVT) && fDelVT.size() != fVFATs) error = "delVT not given for every VFAT";
+        if (fRaw.size() >= fBlockSize) return flushBlock();
+        return ok();
+      }
+
+      //! Last block of the run.
+      bool close() {
+        if (!fFile.is_open()) return ok();
+        flushBlock();
+        bool good = fFile.close() && ok();
+        if (!fFile.ok()) error = fFile.error;
+        return good;
+      }
+
+      uint64_t nBlocks;    /*!<blocks written */
+      uint64_t nEvents;    /*!<GEB blocks */
+      uint64_t bytes() const { return fFile.nBytes; }
+      std::string error;
+
+  private:
+
+      bool flushBlock() {
+        if (!fGEBs) return ok();
+        GEMRunFile::Block b;
+        b.gebBytes   = fStart;
+        b.nGEB       = fGEBs;
+        b.nVFAT      = fVFATs;
+        b.firstEvent = nEvents;
+        b.crc = crc32(0, (const Bytef*)&fRaw[0], fStart);
+        bool withDelVT = fRun.flags & GEMRunFile::kDelVT;
+        if (withDelVT && !fDelVT.empty()) b.crc = crc32(b.crc, (const Bytef*)&fDelVT[0], 8*fDelVT.size());
+        unsigned char h[GEMRunFile::kBlockHeaderSize];
+        GEMRunFile::packBlock(b, h);
+        fFile.put(h, sizeof(h));
+        fFile.put(&fRaw[0], fStart);
+        if (withDelVT && !fDelVT.empty()) fFile.put(&fDelVT[0], 8*fDelVT.size());
+        fFile.endBlock();
+        nBlocks++;
+        nEvents += fGEBs;
+        fRaw.clear();
+        fDelVT.clear();
+        fStart = fVFATs = fGEBs = 0;
+        return ok();
+      }
+
+      GEMWriter fFile;
+      GEMRunFile::RunHeader fRun;
+      size_t fBlockSize;
+      std::vector<char> fRaw;
+      std::vector<double> fDelVT;
+      size_t fStart;
+      uint64_t fVFATs;
+      uint32_t fGEBs;
+};
+
+//! Reads a GEMRunFile block by block.
+/*!
+  \brief GEMRunReader
+  next() returns the GEB bytes of the next good block; run() is the header
+  of the run it belongs to. seek() walks the block headers only. A block
+  with a wrong payload crc is stepped over and counted, a damaged block
+  header is searched past for the next block or run header, the bytes in
+  between are counted as skipped.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMRunReader {
+  public:
+
+      GEMRunReader(const std::string& path)
+        : nCorrupt(0), nSkipped(0), nRuns(0), fFd(-1), fPos(0), fSize(0), fRunBase(0), fEnd(0), fSkip(0), fRawPos(0), fVFAT(0), fEvent(0) {
+        fFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fFd < 0) { error = path + ": " + strerror(errno); return; }
+        struct stat st;
+        fSize = fstat(fFd, &st) == 0 ? st.st_size : 0;
+        if (!readRunHeader()) error = path + ": " + error;
+      }
+
+      ~GEMRunReader() { if (fFd >= 0) ::close(fFd); }
+
+      //! First bytes of path are a run header.
+      static bool IsRunFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        unsigned char h[8];
+        bool is = pread(fd, h, 8, 0) == 8 && GEMRunFile::isMagic(h);
+        ::close(fd);
+        return is;
+      }
+
+      bool good() const { return error.empty(); }
+      bool hex() const { return false; }
+      const GEMRunFile::RunHeader& run() const { return fRun; }
+
+      //! Continue with the block holding event, counted from the start of the file; nextGEB() skips the events before it.
+      bool seek(uint64_t event) {
+        fPos = fRunBase = fEnd = 0;
+        fRaw.clear();
+        fRawPos = 0;
+        nRuns = 0;
+        if (!readRunHeader()) return false;
+        GEMRunFile::Block b;
+        uint64_t at;
+        while (header(b, at)) {
+          if (b.firstEvent + b.nGEB > event) {
+            fPos = at;
+            fSkip = event > b.firstEvent ? event - b.firstEvent : 0;
+            return true;
+          }
+          fPos = at + b.size(fRun.flags);
+        }
+        return false;
+      }
+
+      //! GEB bytes of the next good block, false at the end; delVT as well if given and the run has them.
+      bool next(std::vector<char>& raw, uint64_t& firstEvent, uint32_t& nEvents, std::vector<double>* delVT = 0) {
+        GEMRunFile::Block b;
+        uint64_t at;
+        while (header(b, at)) {
+          uint64_t size = b.size(fRun.flags);
+          fPos = at + size;
+          std::vector<char> payload(size - GEMRunFile::kBlockHeaderSize);
+          if (!payload.empty() && pread(fFd, &payload[0], payload.size(), at + GEMRunFile::kBlockHeaderSize) != (ssize_t)payload.size()) return false;
+          if (crc32(0, (const Bytef*)(payload.empty() ? 0 : &payload[0]), payload.size()) != b.crc) { nCorrupt++; continue; }
+          raw.assign(payload.begin(), payload.begin() + b.gebBytes);
+          if (fRun.swapped && !raw.empty()) GEMByteOrder::swapBlocks((unsigned char*)&raw[0], raw.size());
+          if (delVT) {
+            delVT->resize((fRun.flags & GEMRunFile::kDelVT) ? b.nVFAT : 0);
+            if (!delVT->empty()) memcpy(&(*delVT)[0], &payload[b.gebBytes], 8*b.nVFAT);
+            if (fRun.swapped) {
+              for (size_t i = 0; i < delVT->size(); i++) {
+                uint64_t v;
+                memcpy(&v, &(*delVT)[i], 8);
+                v = __builtin_bswap64(v);
+                memcpy(&(*delVT)[i], &v, 8);
+              }
+            }
+          }
+          firstEvent = b.firstEvent;
+          nEvents = b.nGEB;
+          return true;
+        }
+        return false;
+      }
+
+      //! Next GEB block in the binary layout, 0 at the end; delVT points to the delVT of its VFATs, or is 0.
+      const unsigned char* nextGEB(size_t& n, uint64_t* event = 0, const double** delVT = 0) {
+        for (;;) {
+          if (fRawPos >= fRaw.size()) {
+            uint32_t nev;
+            fRawPos = fVFAT = 0;
+            if (!next(fRaw, fEvent, nev, &fDelVT)) { fRaw.clear(); return 0; }
+          }
+          const unsigned char* p = (const unsigned char*)&fRaw[fRawPos];
+          size_t left = fRaw.size() - fRawPos;
+          uint64_t h = left >= GEMRaw::kGEBHeaderSize ? GEMRaw::load64(p) : 0;
+          n = GEMRaw::headerOK(h) ? GEMRaw::gebSize(h) : 0;
+          if (!n || n > left) {
+            nSkipped += left;
+            fRawPos = fRaw.size();
+            continue;
+          }
+          fRawPos += n;
+          size_t v = fVFAT;
+          fVFAT += GEMRaw::sumVFAT(h);
+          uint64_t ev = fEvent++;
+          if (fSkip) { fSkip--; continue; }
+          if (event) *event = ev;
+          if (delVT) *delVT = fVFAT <= fDelVT.size() ? &fDelVT[v] : 0;
+          return p;
+        }
+      }
+
+      uint64_t nCorrupt;   /*!<blocks with a wrong payload crc */
+      uint64_t nSkipped;   /*!<bytes searched past after a damaged header */
+      uint64_t nRuns;      /*!<run headers read */
+      std::string error;
+
+  private:
+
+      //! Run header at fPos.
+      bool readRunHeader() {
+        unsigned char h[GEMRunFile::kHeaderSize];
+        if (pread(fFd, h, sizeof(h), fPos) != (ssize_t)sizeof(h)) { error = "no run header"; return false; }
+        if (!GEMRunFile::unpackHeader(h, fRun, error)) return false;
+        fPos += fRun.size;
+        nRuns++;
+        return true;
+      }
+
+      //! Next block header from fPos on, through run headers and damaged bytes; at is where it starts.
+      bool header(GEMRunFile::Block& b, uint64_t& at) {
+        unsigned char h[GEMRunFile::kHeaderSize];
+        while (fPos + GEMRunFile::kBlockHeaderSize <= fSize) {
+          ssize_t got = pread(fFd, h, sizeof(h), fPos);
+          if (got < (ssize_t)GEMRunFile::kBlockHeaderSize) return false;
+          if (GEMRunFile::unpackBlock(h, b, fRun.swapped) && fPos + b.size(fRun.flags) <= fSize) {
+            // event numbers go on from one run to the next
+            b.firstEvent += fRunBase;
+            fEnd = b.firstEvent + b.nGEB;
+            at = fPos;
+            return true;
+          }
+          if (got == (ssize_t)sizeof(h) && GEMRunFile::isMagic(h)) {
+            std::string e;
+            GEMRunFile::RunHeader r;
+            if (GEMRunFile::unpackHeader(h, r, e)) {
+              fRun = r;
+              fPos += r.size;
+              fRunBase = fEnd;
+              nRuns++;
+              continue;
+            }
+          }
+          // damaged: the next magic of either kind, 4 bytes aligned as everything is written
+          uint64_t from = fPos;
+          fPos = find(fPos + 4);
+          nSkipped += fPos - from;
+        }
+        return false;
+      }
+
+      //! Offset of the next block or run magic from pos on, the end of the file if none.
+      uint64_t find(uint64_t pos) {
+        std::vector<unsigned char> w(1 << 16);
+        while (pos + 8 <= fSize) {
+          ssize_t got = pread(fFd, &w[0], w.size(), pos);
+          if (got < 8) break;
+          for (ssize_t i = 0; i + 8 <= got; i += 4) {
+            if (GEMRunFile::isBlockMagic(&w[i]) || GEMRunFile::isMagic(&w[i])) return pos + i;
+          }
+          pos += (got - 4) & ~(ssize_t)3;
+        }
+        return fSize;
+      }
+
+      int fFd;
+      uint64_t fPos, fSize;
+      uint64_t fRunBase, fEnd;   /*!<events in the runs before this one, after the last block found */
+      GEMRunFile::RunHeader fRun;
+      uint64_t fSkip;
+      std::vector<char> fRaw;
+      std::vector<double> fDelVT;
+      size_t fRawPos, fVFAT;
+      uint64_t fEvent;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef GEM_Sampler
+#define GEM_Sampler
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMSampler                                                           //
+//                                                                      //
+// Load shedding: the events which get the expensive analysis           //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+//! Prescale or reservoir sampling of events, with the weights which keep the histograms normalized.
+/*!
+  \brief GEMSampler
+  The cheap part of an event (counters, control bits, CRC) is done for
+  every event by the caller, the expensive part (histogram fills, the
+  tree) only for the events the sampler hands out:
+
+    kAll        every event now, weight 1
+    kPrescale   1 of every n events now, weight n
+    kReservoir  k events per window of sec seconds, chosen uniformly
+                among the events of the window (algorithm R), handed out
+                at the end of the window with weight seen/kept
+
+  The weights of the events handed out add up to the number of events
+  seen, so a weighted histogram has the entries of the full analysis. In
+  kReservoir mode the expensive part costs at most k events per window
+  whatever the input rate, the analysis cannot fall behind real time.
+  \author Sergey.Baranov@cern.ch
+*/
+
+template <class T> class GEMSampler {
+  public:
+
+      enum Mode { kAll, kPrescale, kReservoir };
+
+      GEMSampler() : nSeen(0), nAnalysed(0), fMode(kAll), fN(1), fCount(0), fWindow(0), fRng(0x9e3779b97f4a7c15ULL) {}
+
+      void prescale(uint32_t n) {
+        fMode = n > 1 ? kPrescale : kAll;
+        fN = n > 1 ? n : 1;
+      }
+
+      void reservoir(uint32_t k, double sec) {
+        fMode = k > 0 ? kReservoir : kAll;
+        fN = k;
+        fPeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(sec));
+        fEnd = Clock::now() + fPeriod;
+        fKept.clear();
+        fKept.reserve(k);
+      }
+
+      Mode mode() const { return fMode; }
+
+      //! kAll, kPrescale: the event is analysed now, with weight().
+      bool take() {
+        nSeen++;
+        if (fMode == kReservoir || fCount++ % fN) return false;
+        nAnalysed++;
+        return true;
+      }
+
+      double weight() const { return fN > 1 && fMode == kPrescale ? fN : 1.; }
+
+      //! kReservoir: x is kept, or not, for the end of its window.
+      void offer(const T& x) {
+        nSeen++;
+        fWindow++;
+        if (fKept.size() < fN) { fKept.push_back(x); return; }
+        uint64_t j = next() % fWindow;
+        if (j < fN) fKept[j] = x;
+      }
+
+      //! kReservoir: at the end of the window, or now if force, f(x, weight) for the kept events.
+      template <class F> void drain(F f, bool force = false) {
+        if (fMode != kReservoir || (!force && Clock::now() < fEnd)) return;
+        if (!fKept.empty()) {
+          double w = (double)fWindow/fKept.size();
+          for (size_t i = 0; i < fKept.size(); i++) f(fKept[i], w);
+          nAnalysed += fKept.size();
+        }
+        fKept.clear();
+        fWindow = 0;
+        fEnd = Clock::now() + fPeriod;
+      }
+
+      uint64_t nSeen, nAnalysed;
+
+  private:
+
+      typedef std::chrono::steady_clock Clock;
+
+      //! xorshift64*, plenty for picking reservoir slots.
+      uint64_t next() {
+        fRng ^= fRng >> 12;
+        fRng ^= fRng << 25;
+        fRng ^= fRng >> 27;
+        return fRng*0x2545f4914f6cdd1dULL;
+      }
+
+      Mode fMode;
+      uint32_t fN;
+      uint64_t fCount, fWindow, fRng;
+      Clock::duration fPeriod;
+      Clock::time_point fEnd;
+      std::vector<T> fKept;
+};
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef GEM_ShmRing
+#define GEM_ShmRing
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMShmRing                                                           //
+//                                                                      //
+// Shared memory ring of binary GEB blocks between a DAQ and a reader   //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GEMRaw.h"
+
+//! Single producer, single consumer ring in POSIX shared memory.
+/*!
+  \brief GEMShmRing
+  The producer copies whole binary GEB blocks (GEMRaw layout) into the ring
+  and publishes them by moving head; the reader decodes them where they are
+  and frees them by moving tail. head and tail only grow, each is written
+  by one side only, so there are no locks: a release store after the copy,
+  an acquire load on the other side. A block never wraps: when it does not
+  fit before the end of the ring the producer writes a kPad word and starts
+  again at offset 0. A producer which must not block (the DAQ) drops the
+  block when the reader is too far behind and counts an overrun.
+  The reader creates the ring (Create) and removes it when done, the
+  producer attaches to it (Attach).
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMShmRing {
+  public:
+
+      static const uint64_t kMagic   = 0x474e4952204d4547ULL;   /*!<"GEM RING" */
+      static const uint32_t kVersion = 1;
+      static const uint64_t kPad     = ~0ULL;                   /*!<rest of the ring is unused */
+
+      struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t capacity;                       /*!<bytes of data, a power of 2 */
+        alignas(64) std::atomic<uint64_t> head;  /*!<written by the producer */
+        alignas(64) std::atomic<uint64_t> tail;  /*!<written by the reader */
+        alignas(64) std::atomic<uint64_t> overruns;
+        std::atomic<uint64_t> blocks;
+        std::atomic<uint32_t> done;              /*!<the producer has finished */
+      };
+
+      //! New ring of at least capacity bytes, for the reader.
+      static GEMShmRing* Create(const std::string& name, uint64_t capacity, std::string& error) {
+        uint64_t cap = 1 << 16;
+        while (cap < capacity) cap <<= 1;
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+        if (fd < 0) { error = std::string("shm_open: ") + strerror(errno); return 0; }
+        size_t size = sizeof(Header) + cap;
+        if (ftruncate(fd, size) != 0) {
+          error = std::string("ftruncate: ") + strerror(errno);
+          close(fd);
+          shm_unlink(name.c_str());
+          return 0;
+        }
+        GEMShmRing* r = map(fd, size, name, true, error);
+        if (!r) return 0;
+        Header* h = r->fHeader;
+        h->version    = kVersion;
+        h->headerSize = sizeof(Header);
+        h->capacity   = cap;
+        h->head       = 0;
+        h->tail       = 0;
+        h->overruns   = 0;
+        h->blocks     = 0;
+        h->done       = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic      = kMagic;
+        r->init();
+        return r;
+      }
+
+      //! Existing ring, for the producer.
+      static GEMShmRing* Attach(const std::string& name, std::string& error) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) { error = std::string("shm_open: ") + strerror(errno); return 0; }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+          error = "not a GEM ring";
+          close(fd);
+          return 0;
+        }
+        GEMShmRing* r = map(fd, st.st_size, name, false, error);
+        if (!r) return 0;
+        Header* h = r->fHeader;
+        if (h->magic != kMagic || h->version != kVersion || h->headerSize != sizeof(Header)
+            || sizeof(Header) + h->capacity > (uint64_t)st.st_size) {
+          error = "not a GEM ring or a different version";
+          delete r;
+          return 0;
+        }
+        r->init();
+        return r;
+      }
+
+      ~GEMShmRing() {
+        munmap(fHeader, fSize);
+        if (fOwner) shm_unlink(fName.c_str());
+      }
+
+      //
+      // Producer
+      //
+
+      //! Copy one GEB block of n bytes into the ring, wait for space or drop it and count an overrun.
+      bool write(const void* p, uint64_t n, bool wait) {
+        if (n > fCapacity/2 || (n & 7)) return false;
+        Header* h = fHeader;
+        int spins = 0;
+        for (;;) {
+          uint64_t head = h->head.load(std::memory_order_relaxed);
+          uint64_t off  = head & fMask;
+          uint64_t pad  = (off + n > fCapacity) ? fCapacity - off : 0;
+          uint64_t tail = h->tail.load(std::memory_order_acquire);
+          if (fCapacity - (head - tail) >= pad + n) {
+            if (pad) {
+              GEMRaw::store64(fData + off, kPad);
+              head += pad;
+              off = 0;
+            }
+            memcpy(fData + off, p, n);
+            h->head.store(head + n, std::memory_order_release);
+            h->blocks.store(h->blocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return true;
+          }
+          if (!wait) {
+            h->overruns.fetch_add(1, std::memory_order_relaxed);
+            return false;
+          }
+          backoff(spins);
+        }
+      }
+
+      //! No more blocks will come.
+      void finish() { fHeader->done.store(1, std::memory_order_release); }
+
+      //
+      // Reader
+      //
+
+      //! Next GEB block in place and its size, waits for one; 0 when the producer has finished or stop is set.
+      const unsigned char* next(uint64_t& n, const std::atomic<bool>* stop = 0) {
+        Header* h = fHeader;
+        int spins = 0;
+        for (;;) {
+          uint64_t tail = h->tail.load(std::memory_order_relaxed);
+          uint64_t head = h->head.load(std::memory_order_acquire);
+          if (tail != head) {
+            uint64_t off = tail & fMask;
+            uint64_t word = GEMRaw::load64(fData + off);
+            if (word == kPad) {
+              h->tail.store(tail + fCapacity - off, std::memory_order_release);
+              continue;
+            }
+            n = GEMRaw::headerOK(word) ? GEMRaw::gebSize(word) : 0;
+            if (!n || n > head - tail || off + n > fCapacity) {
+              // not written by a GEMShmRing producer, nothing to resynchronize on
+              nCorrupt++;
+              h->tail.store(head, std::memory_order_release);
+              continue;
+            }
+            fPending = n;
+            return fData + off;
+          }
+          if (h->done.load(std::memory_order_acquire) && h->head.load(std::memory_order_acquire) == tail) return 0;
+          if (stop && *stop) return 0;
+          backoff(spins);
+        }
+      }
+
+      //! Give the block returned by next() back to the producer.
+      void release() {
+        Header* h = fHeader;
+        h->tail.store(h->tail.load(std::memory_order_relaxed) + fPending, std::memory_order_release);
+        fPending = 0;
+      }
+
+      uint64_t used() const {
+        return fHeader->head.load(std::memory_order_relaxed) - fHeader->tail.load(std::memory_order_relaxed);
+      }
+      uint64_t capacity() const { return fCapacity; }
+      uint64_t overruns() const { return fHeader->overruns.load(std::memory_order_relaxed); }
+      uint64_t blocks()   const { return fHeader->blocks.load(std::memory_order_relaxed); }
+
+      uint64_t nCorrupt;   /*!<times the reader found something else than a GEB header */
+
+  private:
+
+      GEMShmRing() : nCorrupt(0), fHeader(0), fData(0), fSize(0), fCapacity(0), fMask(0), fPending(0), fOwner(false) {}
+
+      static GEMShmRing* map(int fd, size_t size, const std::string& name, bool owner, std::string& error) {
+        void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+          error = std::string("mmap: ") + strerror(errno);
+          if (owner) shm_unlink(name.c_str());
+          return 0;
+        }
+        GEMShmRing* r = new GEMShmRing();
+        r->fHeader = (Header*)p;
+        r->fSize   = size;
+        r->fName   = name;
+        r->fOwner  = owner;
+        return r;
+      }
+
+      void init() {
+        fCapacity = fHeader->capacity;
+        fMask     = fCapacity - 1;
+        fData     = (unsigned char*)fHeader + sizeof(Header);
+      }
+
+      //! Spin a little, then sleep: a waiting side costs no CPU, a busy one no system call.
+      static void backoff(int& spins) {
+        if (spins < 1024) spins++;
+        if (spins < 256) return;
+        std::this_thread::sleep_for(std::chrono::microseconds(spins < 1024 ? 10 : 200));
+      }
+
+      Header* fHeader;
+      unsigned char* fData;
+      size_t fSize;
+      uint64_t fCapacity, fMask;
+      uint64_t fPending;
+      std::string fName;
+      bool fOwner;
+};
+
+#endif
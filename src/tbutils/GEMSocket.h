@@ -0,0 +1,347 @@
+#ifndef GEM_Socket
+#define GEM_Socket
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMSocket                                                            //
+//                                                                      //
+// Binary GEB/VFAT stream from a local UNIX domain or TCP/UDP socket    //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "GEMRaw.h"
+#include "GEMResync.h"
+
+//! Socket address and connection set up.
+/*!
+  \brief GEMSocket
+  Addresses are "unix:/path" and "tcp:[host:]port" for byte streams,
+  "unixgram:/path" and "udp:[host:]port" for datagrams, each datagram
+  holding whole GEB blocks. The host defaults to localhost. The reader
+  listens (Listen), the DAQ or gem-replay connects (Connect).
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMSocket {
+  public:
+
+      GEMSocket(const std::string& address) : fUnix(false), fStream(true), fPort(0) {
+        std::string a = address;
+        size_t colon = a.find(':');
+        std::string kind = a.substr(0, colon);
+        std::string rest = colon == std::string::npos ? "" : a.substr(colon + 1);
+        if (kind == "unix" || kind == "unixgram") {
+          fUnix = true;
+          fStream = (kind == "unix");
+          fPath = rest;
+        } else if (kind == "tcp" || kind == "udp") {
+          fStream = (kind == "tcp");
+          size_t c = rest.rfind(':');
+          fHost = c == std::string::npos ? "localhost" : rest.substr(0, c);
+          fPort = atoi(c == std::string::npos ? rest.c_str() : rest.c_str() + c + 1);
+        } else {
+          error = "unknown socket address " + address;
+        }
+      }
+
+      bool stream() const { return fStream; }
+
+      //! Bind, and for streams wait for one connection. Returns the descriptor to read, -1 on error.
+      int Listen() {
+        if (!error.empty()) return -1;
+        int fd = open(true);
+        if (fd < 0) return -1;
+        int size = 8 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        if (!fStream) return fd;
+        if (::listen(fd, 1) != 0) return fail(fd, "listen");
+        int c = ::accept(fd, 0, 0);
+        ::close(fd);
+        if (c < 0) error = std::string("accept: ") + strerror(errno);
+        return c;
+      }
+
+      //! Connect to a listening reader. Returns the descriptor to write, -1 on error.
+      int Connect() {
+        if (!error.empty()) return -1;
+        return open(false);
+      }
+
+      std::string error;   /*!<why the last call failed */
+
+  private:
+
+      int fail(int fd, const char* what) {
+        error = std::string(what) + ": " + strerror(errno);
+        if (fd >= 0) ::close(fd);
+        return -1;
+      }
+
+      int open(bool server) {
+        int type = fStream ? SOCK_STREAM : SOCK_DGRAM;
+        if (fUnix) {
+          struct sockaddr_un sa;
+          memset(&sa, 0, sizeof(sa));
+          sa.sun_family = AF_UNIX;
+          if (fPath.size() >= sizeof(sa.sun_path)) { error = "socket path too long"; return -1; }
+          strcpy(sa.sun_path, fPath.c_str());
+          int fd = socket(AF_UNIX, type, 0);
+          if (fd < 0) return fail(fd, "socket");
+          if (server) {
+            unlink(fPath.c_str());
+            if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) return fail(fd, "bind");
+          } else if (::connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) return fail(fd, "connect");
+          return fd;
+        }
+
+        struct addrinfo hints, *res = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = type;
+        char port[16];
+        snprintf(port, sizeof(port), "%d", fPort);
+        if (getaddrinfo(fHost.c_str(), port, &hints, &res) != 0 || !res) { error = "unknown host " + fHost; return -1; }
+        int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (fd < 0) { freeaddrinfo(res); return fail(fd, "socket"); }
+        int ok;
+        if (server) {
+          int one = 1;
+          setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+          ok = bind(fd, res->ai_addr, res->ai_addrlen);
+        } else {
+          ok = ::connect(fd, res->ai_addr, res->ai_addrlen);
+        }
+        freeaddrinfo(res);
+        if (ok != 0) return fail(fd, server ? "bind" : "connect");
+        return fd;
+      }
+
+      bool fUnix, fStream;
+      std::string fPath, fHost;
+      int fPort;
+};
+
+//! Pooled, batched socket reader.
+/*!
+  \brief GEMSocketReader
+  A pool of kBlocks buffers of kBlockSize bytes is filled by one readv()
+  (streams) or recvmmsg() (datagrams, one per buffer) covering every free
+  buffer, so a single system call can bring in megabytes. peek(n) returns n
+  contiguous bytes in place; only a record which straddles two stream
+  buffers is copied, into a small spill buffer. GEB blocks are decoded
+  directly from the pool with the GEMRaw layout.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMSocketReader {
+  public:
+
+      enum { kBlocks = 16, kBlockSize = 1 << 18 };
+      static const size_t kMaxGEBSize = GEMRaw::kMaxGEBSize;
+
+      GEMSocketReader(int fd, bool stream)
+        : nReads(0), nBytes(0), nDatagrams(0), nTruncated(0), nSkipped(0),
+          fFd(fd), fStream(stream), fFirst(0), fFilled(0), fEnd(false) {
+        fBlocks.resize(kBlocks);
+        for (int i = 0; i < kBlocks; i++) fBlocks[i].data.resize(kBlockSize);
+      }
+
+      ~GEMSocketReader() { if (fFd >= 0) ::close(fFd); }
+
+      //! The peer has closed the connection and all data was consumed.
+      bool eof() const { return fEnd && !fFilled; }
+
+      //! n contiguous bytes at the read position, 0 at the end of the data or of a datagram.
+      /*!
+        A datagram shorter than n is counted as truncated and left in
+        place; resync() or drop() discards it.
+       */
+      const unsigned char* peek(size_t n) {
+        for (;;) {
+          if (!fFilled && !fill()) return 0;
+          Block& b = fBlocks[fFirst];
+          if (b.size - b.pos >= n) return &b.data[b.pos];
+          if (!fStream) {
+            // a GEB block never spans two datagrams
+            nTruncated++;
+            return 0;
+          }
+          if (available() >= n) break;
+          if (fFilled == kBlocks || !fill()) return 0;
+        }
+        fSpill.resize(n);
+        size_t done = 0;
+        for (int k = 0; done < n; k++) {
+          Block& b = fBlocks[(fFirst + k) % kBlocks];
+          size_t take = std::min(n - done, b.size - b.pos);
+          memcpy(&fSpill[done], &b.data[b.pos], take);
+          done += take;
+        }
+        return &fSpill[0];
+      }
+
+      void consume(size_t n) {
+        while (n && fFilled) {
+          Block& b = fBlocks[fFirst];
+          size_t take = std::min(n, b.size - b.pos);
+          b.pos += take;
+          n -= take;
+          if (b.pos == b.size) next();
+        }
+      }
+
+      //! Drop the rest of the current buffer (datagram).
+      void drop() {
+        if (!fFilled) return;
+        Block& b = fBlocks[fFirst];
+        nSkipped += b.size - b.pos;
+        next();
+      }
+
+      //! Skip to the next valid GEB block after the read position, false at the end of the data.
+      /*!
+        For datagrams the rest of the current datagram is dropped, the next
+        one starts with a GEB block.
+       */
+      bool resync() {
+        if (!fStream) { drop(); return !eof(); }
+        consume(1);
+        nSkipped++;
+        for (;;) {
+          size_t n = 2*kMaxGEBSize;
+          const unsigned char* w = peek(n);
+          if (!w) {
+            // the end of the stream: search the shorter tail, it may still hold short blocks
+            n = available();
+            w = n ? peek(n) : 0;
+          }
+          long off = w ? GEMResync::findBinary(w, n) : -1;
+          if (off < 0 && n < 2*kMaxGEBSize) {
+            size_t rest = available();
+            nSkipped += rest;
+            consume(rest);
+            return false;
+          }
+          if (off >= 0) {
+            consume(off);
+            nSkipped += off;
+            return true;
+          }
+          consume(kMaxGEBSize);
+          nSkipped += kMaxGEBSize;
+        }
+      }
+
+      uint64_t nReads;       /*!<readv/recvmmsg calls */
+      uint64_t nBytes;       /*!<bytes received */
+      uint64_t nDatagrams;   /*!<datagrams received */
+      uint64_t nTruncated;   /*!<datagrams ending inside a GEB block */
+      uint64_t nSkipped;     /*!<bytes skipped by resync() */
+
+  private:
+
+      struct Block {
+        std::vector<unsigned char> data;
+        size_t size, pos;
+        Block() : size(0), pos(0) {}
+      };
+
+      size_t available() const {
+        size_t n = 0;
+        for (int k = 0; k < fFilled; k++) n += fBlocks[(fFirst + k) % kBlocks].size - fBlocks[(fFirst + k) % kBlocks].pos;
+        return n;
+      }
+
+      void next() {
+        fBlocks[fFirst].size = fBlocks[fFirst].pos = 0;
+        fFirst = (fFirst + 1) % kBlocks;
+        fFilled--;
+      }
+
+      //! One system call into all free buffers, false at the end of the stream.
+      bool fill() {
+        if (fEnd) return false;
+        struct iovec iov[kBlocks + 1];
+        int idx[kBlocks + 1];
+        int nio = 0;
+        if (fStream && fFilled) {
+          // append to the last buffer first
+          int t = (fFirst + fFilled - 1) % kBlocks;
+          if (fBlocks[t].size < kBlockSize) {
+            iov[nio].iov_base = &fBlocks[t].data[fBlocks[t].size];
+            iov[nio].iov_len  = kBlockSize - fBlocks[t].size;
+            idx[nio++] = t;
+          }
+        }
+        for (int k = fFilled; k < kBlocks; k++) {
+          int b = (fFirst + k) % kBlocks;
+          fBlocks[b].size = fBlocks[b].pos = 0;
+          iov[nio].iov_base = &fBlocks[b].data[0];
+          iov[nio].iov_len  = kBlockSize;
+          idx[nio++] = b;
+        }
+        if (!nio) return false;
+
+        if (fStream) {
+          ssize_t n;
+          do { n = readv(fFd, iov, nio); } while (n < 0 && errno == EINTR);
+          nReads++;
+          if (n <= 0) { fEnd = true; return false; }
+          nBytes += n;
+          for (int j = 0; j < nio && n > 0; j++) {
+            size_t take = std::min((size_t)n, iov[j].iov_len);
+            Block& b = fBlocks[idx[j]];
+            if (!b.size) fFilled++;
+            b.size += take;
+            n -= take;
+          }
+          return true;
+        }
+
+        std::vector<struct mmsghdr> msgs(nio);
+        memset(&msgs[0], 0, nio*sizeof(struct mmsghdr));
+        for (int j = 0; j < nio; j++) {
+          msgs[j].msg_hdr.msg_iov = &iov[j];
+          msgs[j].msg_hdr.msg_iovlen = 1;
+        }
+        int m;
+        do { m = recvmmsg(fFd, &msgs[0], nio, MSG_WAITFORONE, 0); } while (m < 0 && errno == EINTR);
+        nReads++;
+        if (m <= 0) { fEnd = true; return false; }
+        for (int j = 0; j < m; j++) {
+          // an empty datagram marks the end of the run
+          if (!msgs[j].msg_len) { fEnd = true; break; }
+          fBlocks[idx[j]].size = msgs[j].msg_len;
+          nBytes += msgs[j].msg_len;
+          nDatagrams++;
+          fFilled++;
+        }
+        return fFilled > 0;
+      }
+
+      int fFd;
+      bool fStream;
+      std::vector<Block> fBlocks;
+      int fFirst, fFilled;
+      bool fEnd;
+      std::vector<unsigned char> fSpill;
+};
+
+#endif
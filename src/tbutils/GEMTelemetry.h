@@ -0,0 +1,289 @@
+#ifndef GEM_Telemetry
+#define GEM_Telemetry
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMTelemetry                                                         //
+//                                                                      //
+// Per stage timing and throughput counters of the GEM readers          //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <TDirectory.h>
+#include <TTree.h>
+#include <TH1.h>
+#include <TString.h>
+
+//! Hot path instrumentation.
+/*!
+  \brief GEMTelemetry
+  Every thread owns a block of counters (registered on first use) which only
+  it writes, so counting is a relaxed load and store without locked
+  instructions. Stage times are taken with the TSC (steady_clock where there
+  is no TSC) and converted to seconds at report time. Report() sums all
+  threads, appends one line to a text metrics file and one entry to the
+  "Telemetry" TTree; it is cheap to call often, it only reports once per
+  period.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMTelemetry {
+  public:
+
+      enum Stage   { kRead, kDecode, kCRC, kFill, kTree, kDraw, kNStages };
+      enum Counter { kEvents, kBytes, kVFATs, kCRCErrors, kControlErrors, kResyncs, kNCounters };
+      enum { kNBuckets = 40 };   /*!<per event latency, log2(ticks) buckets */
+
+      static const char* stageName(int s) {
+        static const char* names[kNStages] = { "read", "decode", "crc", "fill", "tree", "draw" };
+        return names[s];
+      }
+      static const char* counterName(int c) {
+        static const char* names[kNCounters] = { "events", "bytes", "vfats", "crcErr", "ctrlErr", "resync" };
+        return names[c];
+      }
+
+      //! Counters of one thread.
+      struct Counters {
+        std::atomic<uint64_t> ticks[kNStages];
+        std::atomic<uint64_t> count[kNCounters];
+        std::atomic<uint64_t> latency[kNBuckets];
+        Counters() {
+          for (int i = 0; i < kNStages;   i++) ticks[i]   = 0;
+          for (int i = 0; i < kNCounters; i++) count[i]   = 0;
+          for (int i = 0; i < kNBuckets;  i++) latency[i] = 0;
+        }
+      };
+
+      static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+      }
+
+      GEMTelemetry(const std::string& file, double period = 5.)
+        : fSerial(nextSerial()), fPeriod(period), fTree(0), fQueueDepth(0) {
+        fOut.open(file.c_str(), std::ios_base::app);
+        fTsc0 = fTscLast = now();
+        fClock0 = fClockLast = std::chrono::steady_clock::now();
+
+        // first estimate of the tick rate, refined at every report
+        std::chrono::steady_clock::time_point c;
+        do { c = std::chrono::steady_clock::now(); } while (c - fClock0 < std::chrono::milliseconds(2));
+        fTicksPerSec = (now() - fTsc0)/std::chrono::duration<double>(c - fClock0).count();
+        fNextReport = fTsc0 + (uint64_t)(fPeriod*fTicksPerSec);
+        for (int i = 0; i < kNCounters; i++) fLast[i] = 0;
+        for (int i = 0; i < kNStages;   i++) fLastTicks[i] = 0;
+        fRow.time = 0;
+      }
+
+      ~GEMTelemetry() {
+        for (size_t i = 0; i < fThreads.size(); i++) delete fThreads[i];
+      }
+
+      //! Counters of the calling thread in this instance.
+      /*!
+        The counters are kept per instance by thread id; the thread only
+        caches the last ones it used, tagged with the serial number of the
+        instance, which a later instance at the same address does not reuse.
+       */
+      Counters& local() {
+        static thread_local Counters* c = 0;
+        static thread_local uint64_t owner = 0;
+        if (owner != fSerial) {
+          std::lock_guard<std::mutex> lock(fMutex);
+          Counters*& mine = fByThread[std::this_thread::get_id()];
+          if (!mine) {
+            mine = new Counters();
+            fThreads.push_back(mine);
+          }
+          c = mine;
+          owner = fSerial;
+        }
+        return *c;
+      }
+
+      static void add(std::atomic<uint64_t>& a, uint64_t n) {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+      }
+
+      void count(Counter c, uint64_t n = 1) { add(local().count[c], n); }
+      void stage(Stage s, uint64_t ticks)   { add(local().ticks[s], ticks); }
+
+      //! Per event latency in ticks.
+      void latency(uint64_t ticks) {
+        int b = ticks ? 63 - __builtin_clzll(ticks) : 0;
+        add(local().latency[b < kNBuckets ? b : kNBuckets-1], 1);
+      }
+
+      //! Depth of the input queue, the last value set is reported.
+      void queueDepth(uint64_t depth) { fQueueDepth.store(depth, std::memory_order_relaxed); }
+
+      //! Times a stage from construction to destruction.
+      class Scope {
+        public:
+          Scope(GEMTelemetry& t, Stage s) : fT(t), fS(s), fStart(now()) {}
+          ~Scope() { fT.stage(fS, now() - fStart); }
+        private:
+          GEMTelemetry& fT;
+          Stage fS;
+          uint64_t fStart;
+      };
+
+      //! The "Telemetry" tree, one entry per report; a tree read back from a file (gem-reading --resume) is continued.
+      void BookTree(TTree* tree) {
+        fTree = tree;
+        auto branch = [this](const char* name, void* address, const char* leaves) {
+          if (fTree->GetBranch(name)) fTree->SetBranchAddress(name, address);
+          else fTree->Branch(name, address, leaves);
+        };
+        branch("time",     &fRow.time,     "time/D");
+        branch("evps",     &fRow.evps,     "evps/D");
+        branch("MBps",     &fRow.MBps,     "MBps/D");
+        branch("total",    fRow.total,     TString::Format("total[%d]/l", kNCounters));
+        branch("stage_ns", fRow.stage_ns,  TString::Format("stage_ns[%d]/D", kNStages));
+        branch("lat_p50",  &fRow.lat_p50,  "lat_p50/D");
+        branch("lat_p99",  &fRow.lat_p99,  "lat_p99/D");
+        branch("queue",    &fRow.queue,    "queue/l");
+      }
+
+      //! Report if the period has elapsed (or always if force).
+      void Report(bool force = false) {
+        uint64_t t = now();
+        if (!force && t < fNextReport) return;
+
+        std::chrono::steady_clock::time_point c = std::chrono::steady_clock::now();
+        double sec = std::chrono::duration<double>(c - fClockLast).count();
+        double total = std::chrono::duration<double>(c - fClock0).count();
+        if (total > 0.01) fTicksPerSec = (t - fTsc0)/total;
+
+        uint64_t sum[kNCounters] = {0}, ticks[kNStages] = {0}, lat[kNBuckets] = {0};
+        {
+          std::lock_guard<std::mutex> lock(fMutex);
+          for (size_t i = 0; i < fThreads.size(); i++) {
+            Counters& k = *fThreads[i];
+            for (int j = 0; j < kNCounters; j++) sum[j]   += k.count[j].load(std::memory_order_relaxed);
+            for (int j = 0; j < kNStages;   j++) ticks[j] += k.ticks[j].load(std::memory_order_relaxed);
+            for (int j = 0; j < kNBuckets;  j++) lat[j]   += k.latency[j].load(std::memory_order_relaxed);
+          }
+        }
+
+        uint64_t dEvents = sum[kEvents] - fLast[kEvents];
+        fRow.time    = total;
+        fRow.evps    = sec > 0 ? dEvents/sec : 0;
+        fRow.MBps    = sec > 0 ? (sum[kBytes] - fLast[kBytes])/1e6/sec : 0;
+        for (int j = 0; j < kNCounters; j++) fRow.total[j] = sum[j];
+        for (int j = 0; j < kNStages; j++)
+          fRow.stage_ns[j] = dEvents ? (ticks[j] - fLastTicks[j])*1e9/fTicksPerSec/dEvents : 0;
+        fRow.lat_p50 = percentile(lat, 0.50);
+        fRow.lat_p99 = percentile(lat, 0.99);
+        fRow.queue   = fQueueDepth.load(std::memory_order_relaxed);
+
+        if (fOut.is_open()) {
+          fOut << std::fixed << std::setprecision(1) << "t=" << fRow.time
+               << " events/s=" << fRow.evps << " MB/s=" << std::setprecision(2) << fRow.MBps;
+          for (int j = 0; j < kNStages; j++)
+            fOut << " " << stageName(j) << "_ns/ev=" << std::setprecision(0) << fRow.stage_ns[j];
+          for (int j = 0; j < kNCounters; j++) fOut << " " << counterName(j) << "=" << sum[j];
+          fOut << " lat_p50_us=" << std::setprecision(1) << fRow.lat_p50
+               << " lat_p99_us=" << fRow.lat_p99 << " queue=" << fRow.queue << "\n";
+          fOut.flush();
+        }
+        if (fTree) fTree->Fill();
+
+        for (int j = 0; j < kNCounters; j++) fLast[j] = sum[j];
+        for (int j = 0; j < kNStages; j++) fLastTicks[j] = ticks[j];
+        fTscLast = t;
+        fClockLast = c;
+        fNextReport = t + (uint64_t)(fPeriod*fTicksPerSec);
+      }
+
+      //! Latency histogram summed over threads, bucket b counts events of [2^b, 2^(b+1)) ticks.
+      std::vector<uint64_t> latencyBuckets() {
+        std::vector<uint64_t> lat(kNBuckets, 0);
+        std::lock_guard<std::mutex> lock(fMutex);
+        for (size_t i = 0; i < fThreads.size(); i++)
+          for (int j = 0; j < kNBuckets; j++) lat[j] += fThreads[i]->latency[j].load(std::memory_order_relaxed);
+        return lat;
+      }
+
+      //! Per event latency histogram, in microseconds on a log2 scale, attached to dir.
+      /*!
+        dir is given explicitly: the caller may be a worker thread, whose
+        gDirectory is gROOT once ROOT::EnableThreadSafety() is on.
+       */
+      TH1F* LatencyHistogram(const char* name, TDirectory* dir) {
+        std::vector<uint64_t> lat = latencyBuckets();
+        TH1F* h = new TH1F(name, "Per event latency, log2(us)", kNBuckets, -30., kNBuckets - 30.);
+        h->SetDirectory(dir);
+        double offset = log2(1e6/fTicksPerSec);
+        for (int j = 0; j < kNBuckets; j++) if (lat[j]) h->Fill(j + offset, (double)lat[j]);
+        return h;
+      }
+
+      double ticksPerSec() const { return fTicksPerSec; }
+
+  private:
+
+      //! Instance serial numbers, from 1 on.
+      static uint64_t nextSerial() {
+        static std::atomic<uint64_t> serial(0);
+        return ++serial;
+      }
+
+      //! Upper edge of the bucket holding fraction q of all events, in microseconds.
+      double percentile(const uint64_t* lat, double q) const {
+        uint64_t n = 0;
+        for (int j = 0; j < kNBuckets; j++) n += lat[j];
+        if (!n) return 0;
+        uint64_t acc = 0;
+        for (int j = 0; j < kNBuckets; j++) {
+          acc += lat[j];
+          if (acc >= q*n) return (double)(2ULL << j)*1e6/fTicksPerSec;
+        }
+        return 0;
+      }
+
+      struct Row {
+        Double_t  time, evps, MBps;
+        ULong64_t total[kNCounters];
+        Double_t  stage_ns[kNStages];
+        Double_t  lat_p50, lat_p99;
+        ULong64_t queue;
+      };
+
+      const uint64_t fSerial;
+      double fPeriod;
+      TTree* fTree;
+      Row fRow;
+      std::ofstream fOut;
+      std::mutex fMutex;
+      std::vector<Counters*> fThreads;
+      std::map<std::thread::id, Counters*> fByThread;
+      std::atomic<uint64_t> fQueueDepth;
+      uint64_t fTsc0, fTscLast, fNextReport;
+      std::chrono::steady_clock::time_point fClock0, fClockLast;
+      double fTicksPerSec;
+      uint64_t fLast[kNCounters], fLastTicks[kNStages];
+};
+
+#endif
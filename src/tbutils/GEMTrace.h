@@ -0,0 +1,348 @@
+#ifndef GEM_Trace
+#define GEM_Trace
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMTrace                                                             //
+//                                                                      //
+// Always on binary trace rings of decoded words, dumped on errors      //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//! Debug trace of the decoded GEB/VFAT words.
+/*!
+  \brief GEMTrace
+  Every thread which records gets its own ring of the last N records of
+  48 bytes (GEB header, VFAT words with the CRC the reader computed, GEB
+  trailer, resync), a record is one copy into the ring and a TSC read.
+  Nothing is printed while the rings are filled. A dump turns the rings
+  into text, the newest records of every thread, in a background thread
+  which appends them to a file:
+
+    trigger()   an error (CRC, control bits, resync); the dump is taken
+                after post more records of the thread, so it holds the
+                records before and after the error
+    request()   from a signal handler (SIGUSR1 in gem-reading.cc), the
+                dump is taken at the next poll()
+    dump()      right now
+
+  Dumps are rate limited: at most one every minInterval seconds and
+  maxDumps in all, the others are only counted.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMTrace {
+
+  enum Kind { kGEBHeader = 1, kVFAT, kGEBTrailer, kResync };
+  enum Flags { kCRCError = 1, kControlError = 2 };
+
+  struct Record {
+    uint64_t tsc;
+    uint32_t event;
+    uint16_t kind, index;          /*!<Kind, VFAT number in the GEB block */
+    uint16_t BC, EC, ChipID, crc;  /*!<raw VFAT words */
+    uint64_t ls, ms;               /*!<VFAT data words; header, trailer or byte offset in ls otherwise */
+    uint16_t checked;              /*!<CRC computed by the reader */
+    uint16_t flags;                /*!<Flags */
+    uint32_t spare;
+  };
+
+  static_assert(sizeof(Record) == 48, "GEMTrace::Record is 48 bytes");
+
+  inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  //! The last records of one thread, written by it only.
+  class Ring {
+    public:
+
+      Ring(size_t n, int id) : id(id), fHead(0), fPost(-1), fReason(0) {
+        size_t size = 1;
+        while (size < n) size <<= 1;
+        fRec.resize(size);
+        fMask = size - 1;
+      }
+
+      void put(const Record& r) {
+        uint64_t h = fHead.load(std::memory_order_relaxed);
+        fRec[h & fMask] = r;
+        fHead.store(h + 1, std::memory_order_release);
+      }
+
+      //! The records still in the ring, oldest first.
+      void snapshot(std::vector<Record>& out) const {
+        uint64_t h = fHead.load(std::memory_order_acquire);
+        uint64_t n = h < fRec.size() ? h : fRec.size();
+        out.resize(n);
+        for (uint64_t i = 0; i < n; i++) out[i] = fRec[(h - n + i) & fMask];
+      }
+
+      const int id;
+
+    private:
+
+      friend class Tracer;
+      std::vector<Record> fRec;
+      size_t fMask;
+      std::atomic<uint64_t> fHead;
+      int fPost;              /*!<records until a triggered dump, -1 if none */
+      const char* fReason;
+  };
+
+  //! The rings of all threads and the dumps.
+  class Tracer {
+    public:
+
+      Tracer() : nDumps(0), nSuppressed(0), fRecords(4096), fPost(64), fMaxDumps(100), fMinInterval(1.),
+                 fFile("DQMtrace.txt"), fRequest(0), fDone(false), fWriter(0) {
+        fTsc0 = now();
+        fClock0 = std::chrono::steady_clock::now();
+        fLast = -3600e9;
+      }
+
+      ~Tracer() { Done(); }
+
+      //! Before the first record: ring size, output file, post trigger records, rate limit.
+      void configure(size_t records, const std::string& file, int post = 64, double minInterval = 1., int maxDumps = 100) {
+        fRecords = records;
+        fFile = file;
+        fPost = post;
+        fMinInterval = minInterval;
+        fMaxDumps = maxDumps;
+      }
+
+      bool enabled() const { return fRecords > 0; }
+
+      //! The ring of the calling thread, made on its first record.
+      Ring* ring() {
+        static thread_local Ring* mine = 0;
+        if (!mine) {
+          std::lock_guard<std::mutex> lock(fMutex);
+          fRings.push_back(std::unique_ptr<Ring>(new Ring(fRecords, fRings.size())));
+          mine = fRings.back().get();
+        }
+        return mine;
+      }
+
+      void record(const Record& rec) {
+        if (!fRecords) return;
+        Ring* r = ring();
+        r->put(rec);
+        if (r->fPost >= 0 && r->fPost-- == 0) dump(r->fReason, true);
+      }
+
+      void record(Kind kind, uint32_t event, uint64_t word, uint16_t flags = 0) {
+        Record r = {};
+        r.tsc = now();
+        r.event = event;
+        r.kind = kind;
+        r.ls = word;
+        r.flags = flags;
+        record(r);
+      }
+
+      void vfat(uint32_t event, uint16_t index, uint16_t BC, uint16_t EC, uint16_t ChipID,
+                uint64_t ls, uint64_t ms, uint16_t crc, uint16_t checked, uint16_t flags) {
+        Record r;
+        r.tsc = now();
+        r.event = event;
+        r.kind = kVFAT;
+        r.index = index;
+        r.BC = BC; r.EC = EC; r.ChipID = ChipID; r.crc = crc;
+        r.ls = ls; r.ms = ms;
+        r.checked = checked;
+        r.flags = flags;
+        r.spare = 0;
+        record(r);
+      }
+
+      //! An error in the calling thread: dump after fPost more of its records, unless one is pending or rate limited.
+      void trigger(const char* reason) {
+        if (!fRecords) return;
+        Ring* r = ring();
+        if (r->fPost >= 0) return;
+        if (limited()) { nSuppressed++; return; }
+        r->fPost = fPost;
+        r->fReason = reason;
+      }
+
+      //! Async signal safe: ask for a dump at the next poll().
+      void request() { fRequest = 1; }
+
+      void poll() {
+        if (fRequest) {
+          fRequest = 0;
+          dump("on request", true);
+        }
+      }
+
+      //! Snapshot of all rings, written to the file by the writer thread.
+      void dump(const char* reason, bool force = false) {
+        if (!fRecords) return;
+        std::unique_ptr<Dump> d(new Dump);
+        {
+          std::lock_guard<std::mutex> lock(fMutex);
+          if (!force && limited()) { nSuppressed++; return; }
+          fLast = sinceStart();
+          nDumps++;
+          d->reason = reason;
+          d->number = nDumps;
+          d->tsc = now();
+          d->rings.resize(fRings.size());
+          for (size_t i = 0; i < fRings.size(); i++) fRings[i]->snapshot(d->rings[i]);
+          fQueue.push_back(std::move(d));
+          if (!fWriter) fWriter = new std::thread(&Tracer::write, this);
+        }
+        fCond.notify_one();
+      }
+
+      //! Write the pending dumps and stop the writer thread.
+      /*!
+        A trigger still waiting for its post records, an error in the last
+        events of the data such as a block truncated at the end, is dumped
+        now with what its ring has.
+       */
+      void Done() {
+        std::vector<const char*> pending;
+        {
+          std::lock_guard<std::mutex> lock(fMutex);
+          for (size_t i = 0; i < fRings.size(); i++) {
+            if (fRings[i]->fPost < 0) continue;
+            pending.push_back(fRings[i]->fReason);
+            fRings[i]->fPost = -1;
+          }
+        }
+        for (size_t i = 0; i < pending.size(); i++) dump(pending[i], true);
+        {
+          std::lock_guard<std::mutex> lock(fMutex);
+          fDone = true;
+        }
+        fCond.notify_one();
+        if (fWriter) {
+          fWriter->join();
+          delete fWriter;
+          fWriter = 0;
+        }
+      }
+
+      std::atomic<uint64_t> nDumps, nSuppressed;
+
+  private:
+
+      struct Dump {
+        std::string reason;
+        uint64_t number, tsc;
+        std::vector<std::vector<Record> > rings;
+      };
+
+      double sinceStart() const {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - fClock0).count();
+      }
+
+      bool limited() const { return nDumps >= (uint64_t)fMaxDumps || sinceStart() - fLast < fMinInterval*1e9; }
+
+      void write() {
+        std::ofstream out(fFile.c_str(), std::ios_base::app);
+        std::unique_lock<std::mutex> lock(fMutex);
+        for (;;) {
+          fCond.wait(lock, [this] { return fDone || !fQueue.empty(); });
+          if (fQueue.empty()) return;
+          std::unique_ptr<Dump> d = std::move(fQueue.front());
+          fQueue.pop_front();
+          lock.unlock();
+          format(out, *d);
+          out.flush();
+          lock.lock();
+        }
+      }
+
+      //! Ticks to microseconds, from the run so far.
+      double usPerTick(uint64_t tsc) const {
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - fClock0).count();
+        return tsc > fTsc0 && us > 0. ? us/(tsc - fTsc0) : 1e-3;
+      }
+
+      void format(std::ofstream& out, const Dump& d) const {
+        char line[256];
+        double us = usPerTick(d.tsc);
+        out << "=== dump " << d.number << ": " << d.reason << "\n";
+        for (size_t t = 0; t < d.rings.size(); t++) {
+          if (d.rings[t].empty()) continue;
+          out << "--- thread " << t << ", " << d.rings[t].size() << " records, time in us before the dump\n";
+          for (size_t i = 0; i < d.rings[t].size(); i++) {
+            const Record& r = d.rings[t][i];
+            double dt = r.tsc < d.tsc ? (d.tsc - r.tsc)*us : 0.;
+            const char* err = (r.flags & kCRCError) ? " CRC ERROR" : (r.flags & kControlError) ? " CONTROL BITS ERROR" : "";
+            switch (r.kind) {
+              case kGEBHeader:
+                snprintf(line, sizeof(line), "%12.1f event %u GEB header  0x%016llx%s", dt, r.event, (unsigned long long)r.ls, err);
+                break;
+              case kGEBTrailer:
+                snprintf(line, sizeof(line), "%12.1f event %u GEB trailer 0x%016llx", dt, r.event, (unsigned long long)r.ls);
+                break;
+              case kResync:
+                snprintf(line, sizeof(line), "%12.1f event %u resync at byte %llu", dt, r.event, (unsigned long long)r.ls);
+                break;
+              default:
+                snprintf(line, sizeof(line), "%12.1f event %u VFAT %2u BC 0x%04x EC 0x%04x ChipID 0x%04x"
+                         " <127:64> 0x%016llx <63:0> 0x%016llx crc 0x%04x computed 0x%04x%s",
+                         dt, r.event, r.index, r.BC, r.EC, r.ChipID, (unsigned long long)r.ms, (unsigned long long)r.ls,
+                         r.crc, r.checked, err);
+            }
+            out << line << "\n";
+          }
+        }
+      }
+
+      size_t fRecords;
+      int fPost, fMaxDumps;
+      double fMinInterval;
+      std::string fFile;
+      volatile sig_atomic_t fRequest;
+      bool fDone;
+      uint64_t fTsc0;
+      std::chrono::steady_clock::time_point fClock0;
+      std::atomic<double> fLast;   /*!<ns since fClock0 of the last dump */
+      std::mutex fMutex;
+      std::condition_variable fCond;
+      std::vector<std::unique_ptr<Ring> > fRings;
+      std::deque<std::unique_ptr<Dump> > fQueue;
+      std::thread* fWriter;
+  };
+
+  //! The tracer of the process.
+  inline Tracer& tracer() {
+    static Tracer t;
+    return t;
+  }
+
+  //! For signal(): a dump at the next poll().
+  inline void onSignal(int) { tracer().request(); }
+
+} // end of GEMTrace
+
+#endif
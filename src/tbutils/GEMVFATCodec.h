@@ -0,0 +1,347 @@
+#ifndef GEM_VFATCodec
+#define GEM_VFATCodec
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMVFATCodec                                                         //
+//                                                                      //
+// GEM aware encoding of binary GEB/VFAT streams                        //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "GEMRaw.h"
+#include "GEMCrc.h"
+#include "GEMResync.h"
+
+//! Delta, dictionary and sparse hit encoding of binary GEB blocks.
+/*!
+  \brief GEMVFATCodec
+  Every GEB block of the stream becomes one record, all numbers relative to
+  the previous block of the same stream:
+
+    flags        1 byte    0x80 | kCrcDropped | kSameChips | kSameBCEC,
+                           0x00 for a literal: varint length and the bytes
+    header       varint    XOR with the previous header
+    trailer      varint    XOR with the previous trailer
+    BC, EC       varints   first VFAT: zigzag delta to the previous block,
+                           the others (unless kSameBCEC) to the VFAT before
+    ChipIDs      (unless kSameChips, the list of the previous block)
+                 varint dictionary size, 2 bytes per entry, one index byte
+                 per VFAT when the dictionary has more than one entry
+    dense        varint    one bit per VFAT with more than kMaxSparse hits,
+                           lsData, msData of these as they are, 16 bytes each
+    hits         varint    number of hits of the other VFATs, then 2 bytes per
+                           hit: VFAT << 7 | channel (0-63 lsData, 64-127 msData)
+    crc          (unless kCrcDropped) 2 bytes per VFAT
+
+  The CRCs are dropped only when GEMCrc::vfatCRC gives all of them back, so
+  the stream is restored bit for bit, corrupted words included. Whatever is
+  not a GEB block is kept as a literal. Decoding writes the 24 bytes VFAT
+  records in place, then sets the hits of the whole GEB block in one loop
+  without branches on the occupancy: with SSE2 each is OR-ed into its 128
+  bits data word from a table of one-bit masks, and a dropped CRC is
+  rebuilt from the hits alone. Used as the "vfat" and "vfat+zlib" codecs
+  of GEMBlockFile.h.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMVFATCodec {
+
+  enum { kCrcDropped = 0x01, kSameChips = 0x02, kSameBCEC = 0x04, kBlock = 0x80 };
+
+  const int kMaxSparse = 8;     /*!<more hits than this are stored as 16 bytes */
+
+  inline void putVarint(std::vector<char>& out, uint64_t v) {
+    while (v >= 0x80) { out.push_back((char)(v | 0x80)); v >>= 7; }
+    out.push_back((char)v);
+  }
+
+  inline bool getVarint(const unsigned char*& p, const unsigned char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+      unsigned char b = *p++;
+      v |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  inline uint16_t zigzag(uint16_t from, uint16_t to) {
+    int16_t d = (int16_t)(uint16_t)(to - from);
+    // the shift on the unsigned value, d << 1 is undefined for a negative d
+    return (uint16_t)((uint16_t)((uint16_t)d << 1) ^ (uint16_t)(d >> 15));
+  }
+
+  inline uint16_t unzigzag(uint16_t from, uint64_t z) {
+    uint16_t d = (uint16_t)((z >> 1) ^ (~(z & 1) + 1));
+    return (uint16_t)(from + d);
+  }
+
+  //! State carried from one GEB block to the next.
+  struct Context {
+    uint64_t header, trailer;
+    uint16_t BC, EC;
+    uint16_t chips[GEMRaw::kMaxVFAT];
+    uint16_t chipCRC[GEMRaw::kMaxVFAT];   /*!<what the ChipIDs add to the CRC, decoder only */
+    int nChips;
+    Context() : header(0), trailer(0), BC(0), EC(0), nChips(0) {}
+  };
+
+  inline void literal(const unsigned char* p, size_t n, std::vector<char>& out) {
+    out.push_back(0);
+    putVarint(out, n);
+    out.insert(out.end(), (const char*)p, (const char*)p + n);
+  }
+
+  //! Encode one GEB block of size bytes.
+  inline void encodeGEB(const unsigned char* b, Context& x, std::vector<char>& out) {
+    uint64_t header = GEMRaw::load64(b);
+    int n = GEMRaw::sumVFAT(header);
+    const unsigned char* v = b + GEMRaw::kGEBHeaderSize;
+    uint64_t trailer = GEMRaw::load64(v + n*GEMRaw::kVFATSize);
+
+    uint16_t BC[GEMRaw::kMaxVFAT] = { 0 }, EC[GEMRaw::kMaxVFAT] = { 0 }, chip[GEMRaw::kMaxVFAT];
+    bool crcOK = true, sameBCEC = true, sameChips = (n == x.nChips);
+    for (int i = 0; i < n; i++) {
+      const unsigned char* r = v + i*GEMRaw::kVFATSize;
+      BC[i]   = GEMRaw::load16(r + GEMRaw::kBCOffset);
+      EC[i]   = GEMRaw::load16(r + GEMRaw::kECOffset);
+      chip[i] = GEMRaw::load16(r + GEMRaw::kChipIDOffset);
+      sameBCEC  &= (BC[i] == BC[0] && EC[i] == EC[0]);
+      sameChips &= (chip[i] == x.chips[i]);
+      if (crcOK)
+        crcOK = GEMCrc::vfatCRC(BC[i], EC[i], chip[i], GEMRaw::load64(r + GEMRaw::kLsDataOffset),
+                                GEMRaw::load64(r + GEMRaw::kMsDataOffset)) == GEMRaw::load16(r + GEMRaw::kCrcOffset);
+    }
+
+    out.push_back((char)(kBlock | (crcOK ? kCrcDropped : 0) | (sameChips ? kSameChips : 0) | (sameBCEC ? kSameBCEC : 0)));
+    putVarint(out, header ^ x.header);
+    putVarint(out, trailer ^ x.trailer);
+    putVarint(out, zigzag(x.BC, BC[0]));
+    putVarint(out, zigzag(x.EC, EC[0]));
+    if (!sameBCEC) {
+      for (int i = 1; i < n; i++) {
+        putVarint(out, zigzag(BC[i-1], BC[i]));
+        putVarint(out, zigzag(EC[i-1], EC[i]));
+      }
+    }
+    if (!sameChips) {
+      uint16_t dict[GEMRaw::kMaxVFAT];
+      unsigned char idx[GEMRaw::kMaxVFAT];
+      int nDict = 0;
+      for (int i = 0; i < n; i++) {
+        int k = 0;
+        while (k < nDict && dict[k] != chip[i]) k++;
+        if (k == nDict) dict[nDict++] = chip[i];
+        idx[i] = k;
+      }
+      putVarint(out, nDict);
+      for (int k = 0; k < nDict; k++) out.insert(out.end(), (const char*)&dict[k], (const char*)&dict[k] + 2);
+      if (nDict > 1) out.insert(out.end(), (const char*)idx, (const char*)idx + n);
+    }
+    uint64_t dense = 0;
+    uint16_t hits[GEMRaw::kMaxVFAT*kMaxSparse];
+    int nHits = 0;
+    for (int i = 0; i < n; i++) {
+      const unsigned char* d = v + i*GEMRaw::kVFATSize + GEMRaw::kLsDataOffset;
+      uint64_t ls = GEMRaw::load64(d), ms = GEMRaw::load64(d + 8);
+      if (__builtin_popcountll(ls) + __builtin_popcountll(ms) > kMaxSparse) {
+        dense |= 1ULL << i;
+        continue;
+      }
+      for (; ls; ls &= ls - 1) hits[nHits++] = i << 7 | __builtin_ctzll(ls);
+      for (; ms; ms &= ms - 1) hits[nHits++] = i << 7 | (64 + __builtin_ctzll(ms));
+    }
+    putVarint(out, dense);
+    for (int i = 0; i < n; i++)
+      if (dense >> i & 1) out.insert(out.end(), (const char*)v + i*GEMRaw::kVFATSize + GEMRaw::kLsDataOffset,
+                                     (const char*)v + i*GEMRaw::kVFATSize + GEMRaw::kLsDataOffset + 16);
+    putVarint(out, nHits);
+    out.insert(out.end(), (const char*)hits, (const char*)(hits + nHits));
+    if (!crcOK) {
+      for (int i = 0; i < n; i++)
+        out.insert(out.end(), (const char*)v + i*GEMRaw::kVFATSize + GEMRaw::kCrcOffset,
+                   (const char*)v + i*GEMRaw::kVFATSize + GEMRaw::kCrcOffset + 2);
+    }
+
+    x.header  = header;
+    x.trailer = trailer;
+    x.BC = BC[0];
+    x.EC = EC[0];
+    x.nChips = n;
+    memcpy(x.chips, chip, n*sizeof(uint16_t));
+  }
+
+  //! Encode a binary stream of n bytes; anything which is not a GEB block is kept as it is.
+  /*!
+    After bytes which are not a GEB block the next block is looked for with
+    GEMResync::findBinary, only the bytes in between become a literal.
+   */
+  inline void encode(const unsigned char* b, size_t n, std::vector<char>& out) {
+    out.clear();
+    out.reserve(n/4 + 16);
+    Context x;
+    size_t pos = 0;
+    while (pos + GEMRaw::kGEBHeaderSize <= n) {
+      uint64_t header = GEMRaw::load64(b + pos);
+      if (GEMRaw::headerOK(header) && pos + GEMRaw::gebSize(header) <= n) {
+        encodeGEB(b + pos, x, out);
+        pos += GEMRaw::gebSize(header);
+        continue;
+      }
+      long off = GEMResync::findBinary(b + pos + 1, n - pos - 1);
+      if (off < 0) break;
+      literal(b + pos, off + 1, out);
+      pos += off + 1;
+    }
+    if (pos < n) literal(b + pos, n - pos, out);
+  }
+
+  //! 128 one-bit masks, the hits of the lsData/msData word, and what each adds to the CRC.
+  /*!
+    The CRC is linear in the data bits (GEMCrc::VFATTables), so the CRC of a
+    sparse VFAT is the CRC of its BC, EC and ChipID with no hits XOR-ed with
+    one table entry per hit.
+   */
+  struct Masks {
+    uint64_t m[128][2];
+    uint16_t crc[128];
+    Masks() {
+      memset(m, 0, sizeof(m));
+      uint16_t none = GEMCrc::vfatCRC(0, 0, 0, 0, 0);
+      for (int i = 0; i < 128; i++) {
+        m[i][i >> 6] = 1ULL << (i & 63);
+        crc[i] = GEMCrc::vfatCRC(0, 0, 0, m[i][0], m[i][1]) ^ none;
+      }
+    }
+  };
+
+  //! Decode into dst of exactly rawSize bytes, false if the input is not valid.
+  inline bool decode(const unsigned char* p, size_t n, unsigned char* dst, size_t rawSize) {
+    static const Masks masks;
+    const GEMCrc::VFATTables& T = GEMCrc::vfatTables();
+    const unsigned char* end = p + n;
+    unsigned char* o = dst;
+    unsigned char* oend = dst + rawSize;
+    Context x;
+    uint64_t u;
+    while (p < end) {
+      unsigned char flags = *p++;
+      if (!(flags & kBlock)) {
+        if (!getVarint(p, end, u) || u > (uint64_t)(end - p) || u > (uint64_t)(oend - o)) return false;
+        memcpy(o, p, u);
+        p += u;
+        o += u;
+        continue;
+      }
+      uint64_t dh, dt;
+      if (!getVarint(p, end, dh) || !getVarint(p, end, dt)) return false;
+      uint64_t header = x.header ^ dh;
+      if (!GEMRaw::headerOK(header) || GEMRaw::gebSize(header) > (uint64_t)(oend - o)) return false;
+      int nv = GEMRaw::sumVFAT(header);
+      uint64_t trailer = x.trailer ^ dt;
+      GEMRaw::store64(o, header);
+      unsigned char* v = o + GEMRaw::kGEBHeaderSize;
+
+      // BC and EC
+      uint16_t BC[GEMRaw::kMaxVFAT], EC[GEMRaw::kMaxVFAT];
+      uint64_t zb, ze;
+      if (!getVarint(p, end, zb) || !getVarint(p, end, ze)) return false;
+      BC[0] = x.BC = unzigzag(x.BC, zb);
+      EC[0] = x.EC = unzigzag(x.EC, ze);
+      for (int i = 1; i < nv; i++) {
+        if (flags & kSameBCEC) { BC[i] = BC[0]; EC[i] = EC[0]; continue; }
+        if (!getVarint(p, end, zb) || !getVarint(p, end, ze)) return false;
+        BC[i] = unzigzag(BC[i-1], zb);
+        EC[i] = unzigzag(EC[i-1], ze);
+      }
+
+      // ChipIDs, with their part of the CRC
+      if (!(flags & kSameChips)) {
+        uint64_t nDict;
+        if (!getVarint(p, end, nDict) || nDict < 1 || nDict > (uint64_t)nv) return false;
+        if ((uint64_t)(end - p) < 2*nDict + (nDict > 1 ? nv : 0)) return false;
+        uint16_t dict[GEMRaw::kMaxVFAT];
+        memcpy(dict, p, 2*nDict);
+        p += 2*nDict;
+        for (int i = 0; i < nv; i++) {
+          unsigned k = nDict > 1 ? *p++ : 0;
+          if (k >= nDict) return false;
+          x.chips[i] = dict[k];
+          x.chipCRC[i] = T.pos[4][dict[k] & 0xff] ^ T.pos[5][dict[k] >> 8];
+        }
+        x.nChips = nv;
+      } else if (x.nChips != nv) {
+        return false;
+      }
+
+      // the VFAT records, no hits yet; dense data words as they are
+      bool crc = flags & kCrcDropped;
+      uint64_t dense, nHits;
+      if (!getVarint(p, end, dense) || dense >> nv) return false;
+      uint16_t c[GEMRaw::kMaxVFAT], bcec = 0;
+      for (int i = 0; i < nv; i++) {
+        unsigned char* r = v + i*GEMRaw::kVFATSize;
+        unsigned char* d = r + GEMRaw::kLsDataOffset;
+        GEMRaw::store16(r + GEMRaw::kBCOffset, BC[i]);
+        GEMRaw::store16(r + GEMRaw::kECOffset, EC[i]);
+        GEMRaw::store16(r + GEMRaw::kChipIDOffset, x.chips[i]);
+        if (i == 0 || !(flags & kSameBCEC))
+          bcec = T.zero ^ T.pos[0][BC[i] & 0xff] ^ T.pos[1][BC[i] >> 8] ^ T.pos[2][EC[i] & 0xff] ^ T.pos[3][EC[i] >> 8];
+        c[i] = bcec ^ x.chipCRC[i];
+        if (dense >> i & 1) {
+          if (end - p < 16) return false;
+          memcpy(d, p, 16);
+          p += 16;
+          if (crc) c[i] = GEMCrc::vfatCRC(BC[i], EC[i], x.chips[i], GEMRaw::load64(d), GEMRaw::load64(d + 8));
+        } else {
+#ifdef __SSE2__
+          _mm_storeu_si128((__m128i*)d, _mm_setzero_si128());
+#else
+          memset(d, 0, 16);
+#endif
+        }
+      }
+
+      // the hits of all sparse VFATs in one loop
+      if (!getVarint(p, end, nHits) || nHits > (uint64_t)(end - p)/2) return false;
+      for (uint64_t j = 0; j < nHits; j++, p += 2) {
+        unsigned h = GEMRaw::load16(p);
+        unsigned i = h >> 7, ch = h & 127;
+        if (i >= (unsigned)nv) return false;
+        unsigned char* d = v + i*GEMRaw::kVFATSize + GEMRaw::kLsDataOffset;
+#ifdef __SSE2__
+        _mm_storeu_si128((__m128i*)d, _mm_or_si128(_mm_loadu_si128((const __m128i*)d), _mm_loadu_si128((const __m128i*)masks.m[ch])));
+#else
+        GEMRaw::store64(d,     GEMRaw::load64(d)     | masks.m[ch][0]);
+        GEMRaw::store64(d + 8, GEMRaw::load64(d + 8) | masks.m[ch][1]);
+#endif
+        c[i] ^= masks.crc[ch];
+      }
+
+      // crc, given back or stored
+      if (crc) {
+        for (int i = 0; i < nv; i++) GEMRaw::store16(v + i*GEMRaw::kVFATSize + GEMRaw::kCrcOffset, c[i]);
+      } else {
+        if (end - p < 2*nv) return false;
+        for (int i = 0; i < nv; i++, p += 2) memcpy(v + i*GEMRaw::kVFATSize + GEMRaw::kCrcOffset, p, 2);
+      }
+      GEMRaw::store64(v + nv*GEMRaw::kVFATSize, trailer);
+      o = v + nv*GEMRaw::kVFATSize + GEMRaw::kGEBTrailerSize;
+      x.header  = header;
+      x.trailer = trailer;
+    }
+    return o == oend;
+  }
+
+} // end of GEMVFATCodec
+
+#endif
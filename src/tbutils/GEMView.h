@@ -0,0 +1,147 @@
+#ifndef GEM_View
+#define GEM_View
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMView                                                              //
+//                                                                      //
+// Lazy views of binary GEB blocks and VFAT words                       //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <bitset>
+
+#include "GEMRaw.h"
+#include "GEMCrc.h"
+
+//! Read-only views over the binary GEB/VFAT layout.
+/*!
+  \brief GEMView
+  A view is a pointer to the raw bytes (GEMRaw layout), every accessor
+  loads only the field it returns, nothing is decoded in advance. A
+  selection on ChipID reads 2 bytes of every 24 bytes VFAT record, a
+  control bits check 6; the data words are read when hits are asked for,
+  and stay a 128 bits mask: hit(), nHits() and forEachHit() work on the
+  two words without expanding them into channels.
+  The bytes must stay where they are while the view is used.
+  \author Sergey.Baranov@cern.ch
+*/
+
+namespace GEMView {
+
+  //! One bit per 12 bits ChipID.
+  typedef std::bitset<0x1000> ChipSet;
+
+  //! The 128 channels of one VFAT, lsData channels 0-63, msData 64-127.
+  struct HitMask {
+    uint64_t ls, ms;
+
+    bool hit(int chan) const { return ((chan < 64 ? ls >> chan : ms >> (chan - 64)) & 1) != 0; }
+    bool any() const { return (ls | ms) != 0; }
+    int  nHits() const { return __builtin_popcountll(ls) + __builtin_popcountll(ms); }
+
+    //! f(chan) for every channel with a hit, in increasing order.
+    template <class F> void forEachHit(F f) const {
+      for (uint64_t w = ls; w; w &= w - 1) f(__builtin_ctzll(w));
+      for (uint64_t w = ms; w; w &= w - 1) f(64 + __builtin_ctzll(w));
+    }
+  };
+
+  //! One 24 bytes VFAT record.
+  class VFAT {
+    public:
+
+      explicit VFAT(const unsigned char* p) : fP(p) {}
+
+      //! Raw 16 bits words, control bits included.
+      uint16_t BCword()     const { return GEMRaw::load16(fP + GEMRaw::kBCOffset); }
+      uint16_t ECword()     const { return GEMRaw::load16(fP + GEMRaw::kECOffset); }
+      uint16_t ChipIDword() const { return GEMRaw::load16(fP + GEMRaw::kChipIDOffset); }
+
+      uint16_t b1010()  const { return BCword() >> 12; }
+      uint16_t b1100()  const { return ECword() >> 12; }
+      uint16_t b1110()  const { return ChipIDword() >> 12; }
+      uint16_t BC()     const { return BCword() & 0x0fff; }
+      uint16_t EC()     const { return (ECword() >> 4) & 0xff; }
+      uint16_t Flag()   const { return ECword() & 0x000f; }
+      uint16_t ChipID() const { return ChipIDword() & 0x0fff; }
+      uint64_t lsData() const { return GEMRaw::load64(fP + GEMRaw::kLsDataOffset); }
+      uint64_t msData() const { return GEMRaw::load64(fP + GEMRaw::kMsDataOffset); }
+      uint16_t crc()    const { return GEMRaw::load16(fP + GEMRaw::kCrcOffset); }
+
+      bool controlBitsOK() const { return GEMRaw::controlBitsOK(BCword(), ECword(), ChipIDword()); }
+
+      //! Only the data word holding chan is read.
+      bool hit(int chan) const { return ((chan < 64 ? lsData() >> chan : msData() >> (chan - 64)) & 1) != 0; }
+      HitMask hits() const { HitMask m = { lsData(), msData() }; return m; }
+
+      //! CRC of the record as the chip computes it, the whole record is read.
+      uint16_t checkedCRC() const { return GEMCrc::vfatCRC(BCword(), ECword(), ChipIDword(), lsData(), msData()); }
+      bool crcOK() const { return crc() == checkedCRC(); }
+
+      const unsigned char* data() const { return fP; }
+
+    private:
+
+      const unsigned char* fP;
+  };
+
+  //! One binary GEB block: header, sumVFAT VFAT records, trailer.
+  class GEB {
+    public:
+
+      explicit GEB(const unsigned char* p) : fP(p), fHeader(GEMRaw::load64(p)) {}
+
+      uint64_t header()  const { return fHeader; }
+      uint64_t ZSFlag()  const { return GEMRaw::ZSFlag(fHeader); }
+      uint64_t ChamID()  const { return GEMRaw::ChamID(fHeader); }
+      uint64_t sumVFAT() const { return GEMRaw::sumVFAT(fHeader); }
+      bool headerOK()    const { return GEMRaw::headerOK(fHeader); }
+      //! Bytes of the block, valid once headerOK().
+      size_t size()      const { return GEMRaw::gebSize(fHeader); }
+
+      VFAT vfat(size_t i) const { return VFAT(fP + GEMRaw::kGEBHeaderSize + i*GEMRaw::kVFATSize); }
+
+      uint64_t trailer()    const { return GEMRaw::load64(fP + size() - GEMRaw::kGEBTrailerSize); }
+      uint64_t OHcrc()      const { return (0xffff000000000000 & trailer()) >> 48; }
+      uint64_t OHwCount()   const { return (0x0000ffff00000000 & trailer()) >> 32; }
+      uint64_t ChamStatus() const { return (0x00000000ffff0000 & trailer()) >> 16; }
+
+      //! Control bits of every VFAT, the first bad one stops.
+      bool controlBitsOK() const {
+        for (size_t i = 0; i < sumVFAT(); i++) if (!vfat(i).controlBitsOK()) return false;
+        return true;
+      }
+
+      //! Some VFAT has a ChipID of chips.
+      bool hasChip(const ChipSet& chips) const {
+        for (size_t i = 0; i < sumVFAT(); i++) if (chips.test(vfat(i).ChipID())) return true;
+        return false;
+      }
+
+      //! VFATs with a wrong CRC.
+      int nBadCRC() const {
+        int n = 0;
+        for (size_t i = 0; i < sumVFAT(); i++) n += !vfat(i).crcOK();
+        return n;
+      }
+
+      //! Hits of all the VFATs.
+      int nHits() const {
+        int n = 0;
+        for (size_t i = 0; i < sumVFAT(); i++) n += vfat(i).hits().nHits();
+        return n;
+      }
+
+      const unsigned char* data() const { return fP; }
+
+    private:
+
+      const unsigned char* fP;
+      uint64_t fHeader;
+  };
+
+} // end of GEMView
+
+#endif
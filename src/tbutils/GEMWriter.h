@@ -0,0 +1,157 @@
+#ifndef GEM_Writer
+#define GEM_Writer
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GEMWriter                                                            //
+//                                                                      //
+// Long-lived buffered output for hex and binary GEB/VFAT streams       //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//! Buffered output file.
+/*!
+  \brief GEMWriter
+  The file is opened once. Records are appended to a chain of kChunkSize
+  user-space buffers and nothing is written inside a GEB block: endBlock()
+  writes the whole chain with one writev() once flushAt bytes are waiting,
+  so a reader following the file (gem-reading --follow) always sees whole
+  blocks. With preallocate > 0 the disk space is reserved ahead in steps of
+  that many bytes (fallocate, Linux only), which keeps large scan files
+  contiguous. Hex numbers are formatted like "outf << hex << v << endl"
+  used to do, one per line, without the flush.
+  \author Sergey.Baranov@cern.ch
+*/
+
+class GEMWriter {
+  public:
+
+      enum { kChunkSize = 1 << 20, kMaxIov = 64 };
+
+      GEMWriter() : nWrites(0), nBytes(0), fFd(-1), fFlushAt(4 << 20), fPrealloc(0), fAllocated(0), fOffset(0), fUsed(0) {}
+
+      ~GEMWriter() { close(); }
+
+      //! Open path for writing, appending to it as before or truncating it.
+      bool open(const std::string& path, bool append = true, int64_t preallocate = 0, size_t flushAt = 4 << 20) {
+        close();
+        fFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+        if (fFd < 0) { error = path + ": " + strerror(errno); return false; }
+        struct stat st;
+        fOffset = (fstat(fFd, &st) == 0) ? st.st_size : 0;
+        fAllocated = fOffset;
+        fPrealloc = preallocate;
+        fFlushAt = flushAt ? flushAt : 1;
+        reserve();
+        return true;
+      }
+
+      bool is_open() const { return fFd >= 0; }
+
+      //! Append n bytes, never written before the next endBlock()/flush().
+      void put(const void* p, size_t n) {
+        const char* c = (const char*)p;
+        while (n) {
+          if (fUsed == fChunks.size()*(size_t)kChunkSize) fChunks.push_back(std::vector<char>(kChunkSize));
+          std::vector<char>& b = fChunks[fUsed/kChunkSize];
+          size_t off  = fUsed % kChunkSize;
+          size_t take = std::min(n, (size_t)kChunkSize - off);
+          memcpy(&b[off], c, take);
+          fUsed += take;
+          c += take;
+          n -= take;
+        }
+      }
+
+      template <class T> void binary(T v) { put(&v, sizeof(v)); }
+
+      //! v in lower case hex without leading zeros and a new line.
+      void hex(uint64_t v) {
+        char s[17];
+        int i = 16;
+        s[i] = '\n';
+        do { s[--i] = "0123456789abcdef"[v & 0xf]; v >>= 4; } while (v);
+        put(s + i, 17 - i);
+      }
+
+      //! End of a GEB block or event: write out once enough is buffered.
+      bool endBlock() { return fUsed >= fFlushAt ? flush() : ok(); }
+
+      //! Write everything buffered.
+      bool flush() {
+        if (fFd < 0 || !fUsed) return ok();
+        size_t done = 0;
+        while (done < fUsed) {
+          struct iovec iov[kMaxIov];
+          int nio = 0;
+          for (size_t p = done; p < fUsed && nio < kMaxIov; nio++) {
+            size_t off = p % kChunkSize;
+            size_t len = std::min(fUsed - p, (size_t)kChunkSize - off);
+            iov[nio].iov_base = &fChunks[p/kChunkSize][off];
+            iov[nio].iov_len  = len;
+            p += len;
+          }
+          ssize_t n = writev(fFd, iov, nio);
+          if (n < 0 && errno == EINTR) continue;
+          nWrites++;
+          if (n <= 0) {
+            error = std::string("write: ") + strerror(n < 0 ? errno : EIO);
+            fUsed = 0;
+            return false;
+          }
+          done += n;
+        }
+        nBytes  += fUsed;
+        fOffset += fUsed;
+        fUsed = 0;
+        reserve();
+        // give back what an exceptionally long block added
+        if (fChunks.size() > (fFlushAt + kChunkSize - 1)/kChunkSize + 1) fChunks.resize((fFlushAt + kChunkSize - 1)/kChunkSize + 1);
+        return ok();
+      }
+
+      bool close() {
+        if (fFd < 0) return ok();
+        bool good = flush();
+        if (::close(fFd) != 0 && good) { error = std::string("close: ") + strerror(errno); good = false; }
+        fFd = -1;
+        return good;
+      }
+
+      bool ok() const { return error.empty(); }
+
+      uint64_t nWrites;    /*!<writev calls */
+      uint64_t nBytes;     /*!<bytes written */
+      std::string error;   /*!<why the last write failed */
+
+  private:
+
+      //! Keep fPrealloc bytes reserved past the write position, the file size is not changed.
+      void reserve() {
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+        if (fPrealloc <= 0 || fOffset + fPrealloc/2 < fAllocated) return;
+        if (fallocate(fFd, FALLOC_FL_KEEP_SIZE, fOffset, fPrealloc) == 0) fAllocated = fOffset + fPrealloc;
+        else fPrealloc = 0;   // not supported by this file system
+#endif
+      }
+
+      int fFd;
+      std::vector<std::vector<char> > fChunks;
+      size_t fFlushAt;
+      int64_t fPrealloc, fAllocated, fOffset;
+      size_t fUsed;
+};
+
+#endif
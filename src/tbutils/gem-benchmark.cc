@@ -0,0 +1,360 @@
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <unistd.h>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TH1.h>
+#include <TROOT.h>
+#include <TBenchmark.h>
+#include <TString.h>
+
+#include "Event.h"
+#include "GEMRaw.h"
+#include "GEMCrc.h"
+#include "GEMGenerator.h"
+#include "GEMDecoder.h"
+
+/**
+* ... Benchmarks of the decode and analysis hot paths of the GEM readers ...
+*/
+
+/*! \file */
+/*!
+  Micro and macro benchmarks for the hot paths of gem-reading.cc: hex
+  parsing, binary parsing, CRC, channel bit extraction, histogram filling,
+  Event building and TTree::Fill. The input is made by GEMGenerator with a
+  fixed seed, so every run measures the same bytes.
+
+  gem-root-application/scripts/with_root_compile.sh gem-root-application/src/tbutils/gem-benchmark.cc
+
+  Options:
+    -size S           hex input size in MB (64)
+    -baseline FILE    baseline to compare with (gem-benchmark-baseline.json)
+    -save             write the results as the new baseline
+    -tolerance F      allowed slow down before a regression is flagged (0.10)
+
+  The rates depend on the machine, so no baseline is kept with the sources:
+  make one with -save on the machine the benchmark runs on. The baseline
+  records that machine (host name and CPU); one from another machine is
+  shown but not compared. The exit code is 1 if any benchmark is slower
+  than a baseline of this machine.
+  \author Sergey.Baranov@cern.ch
+*/
+
+using namespace std;
+
+// the decoders of gem-reading.cc
+typedef GEMDecoder::Decoder<GEMDecoder::GEBFramed, GEMDecoder::Hex>    HexDecoder;
+typedef GEMDecoder::Decoder<GEMDecoder::GEBFramed, GEMDecoder::Binary> BinaryDecoder;
+typedef HexDecoder::VFATData VFATData;
+typedef HexDecoder::GEBData  GEBData;
+
+//! One benchmark result.
+struct Result {
+  string   name;
+  double   events;    /*!<GEB blocks processed */
+  double   bytes;     /*!<input bytes processed */
+  double   seconds;
+  double   evps()  const { return seconds > 0 ? events/seconds : 0; }
+  double   mbps()  const { return seconds > 0 ? bytes/1e6/seconds : 0; }
+};
+
+//! Host name and CPU model of this machine, the baselines are only valid on it.
+static string machine()
+{
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  string cpu;
+  ifstream info("/proc/cpuinfo");
+  string line;
+  while (getline(info, line)) {
+    if (line.compare(0, 10, "model name") != 0) continue;
+    size_t c = line.find(':');
+    if (c != string::npos && c + 2 <= line.size()) cpu = line.substr(c + 2);
+    break;
+  }
+  string m = string(host) + ", " + cpu;
+  for (size_t i = 0; i < m.size(); i++) if (m[i] == '"' || m[i] == '\\') m[i] = ' ';
+  return m;
+}
+
+//! Results of a previous run, "machine": "...", "name": {"events_per_s": x, "MB_per_s": y}
+static map<string, double> readBaseline(const string& file, string& measuredOn)
+{
+  map<string, double> base;
+  ifstream inpf(file.c_str());
+  if (!inpf.is_open()) return base;
+  stringstream ss;
+  ss << inpf.rdbuf();
+  string s = ss.str();
+  size_t p = 0;
+  size_t m = s.find("\"machine\"");
+  if (m != string::npos) {
+    size_t b = s.find('"', s.find(':', m) + 1);
+    size_t e = b == string::npos ? b : s.find('"', b + 1);
+    if (e != string::npos) {
+      measuredOn = s.substr(b + 1, e - b - 1);
+      p = e + 1;
+    }
+  }
+  while ((p = s.find('"', p)) != string::npos) {
+    size_t e = s.find('"', p+1);
+    if (e == string::npos) break;
+    string name = s.substr(p+1, e-p-1);
+    size_t k = s.find("\"events_per_s\"", e);
+    size_t next = s.find('}', e);
+    if (name != "events_per_s" && name != "MB_per_s" && k != string::npos && k < next) {
+      base[name] = atof(s.c_str() + s.find(':', k) + 1);
+      p = next;
+    } else {
+      p = e + 1;
+    }
+  }
+  return base;
+}
+
+static void writeBaseline(const string& file, const vector<Result>& results)
+{
+  ofstream outf(file.c_str());
+  outf << "{\n";
+  outf << "  \"machine\": \"" << machine() << "\",\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    outf << "  \"" << results[i].name << "\": { \"events_per_s\": " << setprecision(6) << results[i].evps()
+         << ", \"MB_per_s\": " << results[i].mbps() << " }" << (i+1 < results.size() ? "," : "") << "\n";
+  }
+  outf << "}\n";
+}
+
+TROOT root("",""); // static TROOT object
+
+//! main function.
+/*!
+C++ any documents
+*/
+
+int main(int argc, char** argv)
+{ cout<<"---> Main()"<<endl;
+
+  double sizeMB = 64;
+  string baselineFile = "gem-benchmark-baseline.json";
+  bool save = false;
+  double tolerance = 0.10;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool more = (i+1 < argc);
+    if      (a == "-size"      && more) sizeMB       = atof(argv[++i]);
+    else if (a == "-baseline"  && more) baselineFile = argv[++i];
+    else if (a == "-save")              save         = true;
+    else if (a == "-tolerance" && more) tolerance    = atof(argv[++i]);
+  }
+
+  /*
+   * Inputs, same events in hex and binary
+   */
+  GEMGenerator::Config cfg;
+  cfg.nChambers = 1;
+  cfg.nChips    = 24;
+  GEMGenerator hexGen(cfg);
+  cfg.binary = true;
+  GEMGenerator binGen(cfg);
+
+  string hexInput, binInput;
+  vector<char> buf(hexGen.maxEventSize());
+  uint64_t nEvents = 0;
+  while (hexInput.size() < sizeMB*1e6) {
+    hexInput.append(&buf[0], hexGen.event(&buf[0]));
+    binInput.append(&buf[0], binGen.event(&buf[0]));
+    nEvents++;
+  }
+  cout << "input: " << nEvents << " GEB blocks, hex " << hexInput.size() << " bytes, binary "
+       << binInput.size() << " bytes" << endl;
+
+  TBenchmark bench;
+  vector<Result> results;
+  vector<GEBData> gebs;
+  gebs.reserve(nEvents);
+  uint64_t sink = 0;   // keeps the optimizer from dropping the loops
+
+  // hex parsing, GEMOnline::readGEBheader/readEvent/readGEBtrailer
+  {
+    istringstream inpf(hexInput);
+    GEBData geb;
+    VFATData vfat;
+    bench.Start("hexParse");
+    for (uint64_t ievent = 0; ievent < nEvents; ievent++) {
+      HexDecoder::readGEBheader(inpf, geb);
+      for (uint64_t ivfat = 0; ivfat < GEMRaw::sumVFAT(geb.header); ivfat++) {
+        HexDecoder::readEvent(inpf, ievent, vfat);
+        sink += vfat.crc;
+      }
+      HexDecoder::readGEBtrailer(inpf, geb);
+    }
+    bench.Stop("hexParse");
+    Result r = { "hexParse", (double)nEvents, (double)hexInput.size(), bench.GetRealTime("hexParse") };
+    results.push_back(r);
+  }
+
+  // binary parsing, GEMOnline::decodeGEB on the writeVFATdataBinary layout
+  {
+    const unsigned char* p = (const unsigned char*)binInput.data();
+    bench.Start("binaryParse");
+    for (uint64_t ievent = 0; ievent < nEvents; ievent++) {
+      GEBData geb;
+      BinaryDecoder::readGEB(p, geb);
+      gebs.push_back(geb);
+    }
+    bench.Stop("binaryParse");
+    Result r = { "binaryParse", (double)nEvents, (double)binInput.size(), bench.GetRealTime("binaryParse") };
+    results.push_back(r);
+  }
+
+  const double binBytes = binInput.size();
+
+  // CRC, bit serial reference and table driven as in gem-reading.cc
+  {
+    bench.Start("crcSerial");
+    for (size_t i = 0; i < gebs.size(); i++)
+      for (size_t k = 0; k < gebs[i].vfats.size(); k++) {
+        const VFATData& v = gebs[i].vfats[k];
+        sink += (GEMCrc::vfatCRCSerial(v.BC, v.EC, v.ChipID, v.lsData, v.msData) == v.crc);
+      }
+    bench.Stop("crcSerial");
+    Result r = { "crcSerial", (double)nEvents, binBytes, bench.GetRealTime("crcSerial") };
+    results.push_back(r);
+
+    bench.Start("crcTable");
+    for (size_t i = 0; i < gebs.size(); i++)
+      for (size_t k = 0; k < gebs[i].vfats.size(); k++) {
+        const VFATData& v = gebs[i].vfats[k];
+        sink += (GEMCrc::vfatCRC(v.BC, v.EC, v.ChipID, v.lsData, v.msData) == v.crc);
+      }
+    bench.Stop("crcTable");
+    Result t = { "crcTable", (double)nEvents, binBytes, bench.GetRealTime("crcTable") };
+    results.push_back(t);
+  }
+
+  // channel bit extraction, the 128 channels loop
+  {
+    bench.Start("channelBits");
+    for (size_t i = 0; i < gebs.size(); i++)
+      for (size_t k = 0; k < gebs[i].vfats.size(); k++) {
+        const VFATData& v = gebs[i].vfats[k];
+        for (int chan = 0; chan < 128; ++chan) {
+          if (chan < 64) sink += ((v.lsData >> chan) & 0x1);
+          else           sink += ((v.msData >> (chan-64)) & 0x1);
+        }
+      }
+    bench.Stop("channelBits");
+    Result r = { "channelBits", (double)nEvents, binBytes, bench.GetRealTime("channelBits") };
+    results.push_back(r);
+  }
+
+  // histogram filling, the per VFAT fills of gem-reading.cc
+  {
+    TH1::AddDirectory(kFALSE);
+    TH1F hiChip("ChipID", "ChipID", 100, 0x0, 0xfff);
+    TH1F hiCh128("Ch128", "all channels", 128, 0., 128.);
+    vector<TH1F*> histos;
+    for (int hi = 0; hi < 128; ++hi)
+      histos.push_back(new TH1F(TString::Format("channel%d", hi+1), "channel", 100, 0., 0xf));
+
+    bench.Start("histFill");
+    for (size_t i = 0; i < gebs.size(); i++)
+      for (size_t k = 0; k < gebs[i].vfats.size(); k++) {
+        const VFATData& v = gebs[i].vfats[k];
+        hiChip.Fill(v.ChipID & 0x0fff);
+        for (int chan = 0; chan < 128; ++chan) {
+          uint8_t chan0xf = (chan < 64) ? ((v.lsData >> chan) & 0x1) : ((v.msData >> (chan-64)) & 0x1);
+          histos[chan]->Fill(chan0xf);
+          if (!chan0xf) hiCh128.Fill(chan);
+        }
+      }
+    bench.Stop("histFill");
+    Result r = { "histFill", (double)nEvents, binBytes, bench.GetRealTime("histFill") };
+    results.push_back(r);
+    for (int hi = 0; hi < 128; ++hi) delete histos[hi];
+  }
+
+  // Event building and TTree::Fill
+  {
+    TFile* hfile = new TFile("gem-benchmark.root", "RECREATE", "GEM benchmark");
+    TTree* GEMtree = new TTree("GEMtree", "A Tree with GEM Events");
+    Event* ev = new Event();
+    GEMtree->Branch("GEMEvents", &ev);
+
+    // building alone, then building and filling; TTree::Fill is the difference
+    for (int pass = 0; pass < 2; pass++) {
+      const char* name = pass ? "treeFill" : "eventBuild";
+      bench.Start(name);
+      for (size_t i = 0; i < gebs.size(); i++) {
+        const GEBData& geb = gebs[i];
+        GEBdata GEBdata_(GEMRaw::ZSFlag(geb.header), GEMRaw::ChamID(geb.header));
+        for (size_t k = 0; k < geb.vfats.size(); k++) {
+          const VFATData& v = geb.vfats[k];
+          VFATdata VFATdata_(v.BC >> 12, v.EC >> 12, v.ChipID & 0x0fff, v.EC & 0xf, v.ChipID >> 12, v.crc);
+          GEBdata_.addVFATData(VFATdata_);
+        }
+        GEBdata_.setTrailer(geb.trailer >> 48, (geb.trailer >> 32) & 0xffff, (geb.trailer >> 16) & 0xffff);
+        ev->Build(0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0);
+        ev->addGEBdata(GEBdata_);
+        if (pass) GEMtree->Fill();
+        ev->Clear();
+      }
+      bench.Stop(name);
+    }
+    double buildTime = bench.GetRealTime("eventBuild");
+    double fillTime  = bench.GetRealTime("treeFill") - buildTime;
+    Result b = { "eventBuild", (double)nEvents, binBytes, buildTime };
+    Result f = { "treeFill",   (double)nEvents, binBytes, fillTime };
+    results.push_back(b);
+    results.push_back(f);
+    hfile->Write();
+    hfile->Close();
+    delete hfile;
+  }
+
+  /*
+   * Report and compare with the baseline
+   */
+  string measuredOn, here = machine();
+  map<string, double> base = readBaseline(baselineFile, measuredOn);
+  bool OKcompare = !base.empty() && measuredOn == here;
+  int nRegressions = 0;
+  cout << "\n" << setw(14) << left << "benchmark" << right << setw(14) << "events/s" << setw(12) << "MB/s"
+       << setw(14) << "baseline" << setw(10) << "ratio" << endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    cout << setw(14) << left << r.name << right << fixed << setprecision(0) << setw(14) << r.evps()
+         << setprecision(1) << setw(12) << r.mbps();
+    if (base.count(r.name) && base[r.name] > 0) {
+      double ratio = r.evps()/base[r.name];
+      cout << setprecision(0) << setw(14) << base[r.name] << setprecision(2) << setw(10) << ratio;
+      if (OKcompare && ratio < 1. - tolerance) { cout << "  REGRESSION"; nRegressions++; }
+    }
+    cout << endl;
+  }
+  cout << "(checksum " << sink << ")" << endl;
+
+  if (save) {
+    writeBaseline(baselineFile, results);
+    cout << "baseline written to " << baselineFile << endl;
+  } else if (base.empty()) {
+    cout << "no baseline in " << baselineFile << ", use -save to store one" << endl;
+  } else if (!OKcompare) {
+    cout << "baseline " << baselineFile << " was measured on " << (measuredOn.empty() ? "an unknown machine" : measuredOn)
+         << ", not on " << here << ": not compared, use -save to store one for this machine" << endl;
+  }
+  if (nRegressions) cout << nRegressions << " regression(s) against " << baselineFile << endl;
+
+  return nRegressions ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <cstdint>
+#include <chrono>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GEMRaw.h"
+#include "GEMConvert.h"
+#include "GEMResync.h"
+#include "GEMView.h"
+#include "GEMBlockFile.h"
+#include "GEMRunFile.h"
+#include "GEMCatalog.h"
+
+/**
+* ... Run catalog: per-run summaries of many runs in one index file, and queries on it ...
+*/
+
+/*! \file */
+/*!
+  Queries a run catalog (GEMCatalog.h) filled by gem-reading --catalog and
+  thldread --catalog while they process a run, or by -add here for a raw,
+  block or run file which was processed before. The catalog is mapped into
+  memory and its records are looked at in place, thousands of runs take
+  milliseconds.
+
+  g++ -O2 -std=c++11 gem-catalog.cc -o gem-catalog -lz <br>
+  ./gem-reading -b --catalog runs.gcat --run 1234 <br>
+  ./gem-catalog -c runs.gcat -add DataParker.bin -run 1235 <br>
+  ./gem-catalog -c runs.gcat -chip 68 -crc <br>
+  ./gem-catalog -c runs.gcat -date 20150101:20150131 -chips
+
+  Options:
+    -c FILE       the catalog (runs.gcat)
+    -add FILE     catalog a hex, binary, block or run file, then query
+    -run N        run number of -add, taken from a run file by default
+    -runs LO:HI   runs with a number in [LO, HI]
+    -date LO:HI   runs taken in [LO, HI], yyyymmdd
+    -chip ID      runs which saw this ChipID (hex); -crc and -control then
+                  apply to this chip
+    -crc          runs with CRC errors
+    -control      runs with control bits errors
+    -events N     runs with at least N events
+    -chips        the ChipID counters of every run too
+
+  \author Sergey.Baranov@cern.ch
+*/
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+//! One GEB block into the summary.
+static void addBlock(GEMCatalogBuilder& b, const GEMView::GEB& g) {
+  for (size_t i = 0; i < g.sumVFAT(); i++) {
+    GEMView::VFAT v = g.vfat(i);
+    b.vfat(v.BCword(), v.ECword(), v.ChipIDword(), v.crcOK());
+  }
+  b.event();
+}
+
+//! Catalog a hex or binary file, mapped into memory; blocks with wrong control bits are counted too.
+static bool addRaw(GEMCatalogBuilder& b, const string& file) {
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat sb;
+  if (fd < 0 || fstat(fd, &sb) != 0) return false;
+  size_t n = sb.st_size;
+  void* m = n ? mmap(0, n, PROT_READ, MAP_PRIVATE, fd, 0) : 0;
+  ::close(fd);
+  if (m == MAP_FAILED) return false;
+  const char* p = (const char*)m;
+  // hex files are whitespace and hex digits only
+  bool hex = n > 0;
+  for (size_t i = 0; i < n && i < 64; i++) hex &= (GEMResync::isSpace(p[i]) || GEMResync::hexDigit(p[i]) >= 0);
+  uint64_t skipped = 0;
+  if (hex) {
+    auto block = [&](const char*, size_t, const uint64_t* words) {
+      unsigned char bin[GEMRaw::kMaxGEBSize];
+      GEMConvert::wordsToBinary(words, bin);
+      addBlock(b, GEMView::GEB(bin));
+    };
+    size_t pos = GEMConvert::frameHex(p, n, skipped, block, ~(size_t)0, true);
+    if (pos < n) {
+      // the last token may lack its new line
+      vector<char> tail(p + pos, p + n);
+      tail.push_back('\n');
+      size_t end = GEMConvert::frameHex(&tail[0], tail.size(), skipped, block, ~(size_t)0, true);
+      skipped += tail.size() - end;
+    }
+  } else if (n) {
+    size_t pos = GEMConvert::frameBinary((const unsigned char*)p, n, skipped,
+      [&](const unsigned char* q, size_t) { addBlock(b, GEMView::GEB(q)); }, ~(size_t)0, true);
+    skipped += n - pos;
+  }
+  b.skipped(skipped);
+  if (n) munmap(m, n);
+  return true;
+}
+
+template <class Reader> void addBlocks(GEMCatalogBuilder& b, Reader& r) {
+  size_t n = 0;
+  while (const unsigned char* p = r.nextGEB(n)) addBlock(b, GEMView::GEB(p));
+  b.skipped(r.nSkipped);
+}
+
+int main(int argc, char** argv)
+{ cerr<<"---> Main()"<<endl;
+
+  string catalog = "runs.gcat", add;
+  int run = -1, runLo = INT32_MIN, runHi = INT32_MAX, dateLo = 0, dateHi = INT32_MAX, chip = -1;
+  bool crc = false, control = false, chips = false;
+  uint64_t minEvents = 0;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool more = (i+1 < argc);
+    if      (a == "-c"       && more) catalog   = argv[++i];
+    else if (a == "-add"     && more) add       = argv[++i];
+    else if (a == "-run"     && more) run       = atoi(argv[++i]);
+    else if (a == "-runs"    && more) sscanf(argv[++i], "%d:%d", &runLo, &runHi);
+    else if (a == "-date"    && more) sscanf(argv[++i], "%d:%d", &dateLo, &dateHi);
+    else if (a == "-chip"    && more) chip      = strtoul(argv[++i], 0, 16) & 0x0fff;
+    else if (a == "-crc")             crc       = true;
+    else if (a == "-control")         control   = true;
+    else if (a == "-events"  && more) minEvents = strtoull(argv[++i], 0, 0);
+    else if (a == "-chips")           chips     = true;
+    else {
+      cout << "unknown option " << a << endl;
+      return 1;
+    }
+  }
+
+  if (!add.empty()) {
+    GEMCatalogBuilder b;
+    Clock::time_point t0 = Clock::now();
+    b.run(run);
+    if (GEMBlockReader::IsBlockFile(add)) {
+      GEMBlockReader r(add);
+      if (!r.good()) { cout << "\n" << r.error << "\n" << endl; return 1; }
+      addBlocks(b, r);
+    } else if (GEMRunReader::IsRunFile(add)) {
+      GEMRunReader r(add);
+      if (!r.good()) { cout << "\n" << r.error << "\n" << endl; return 1; }
+      const GEMRunFile::RunHeader& h = r.run();
+      b.run(run >= 0 ? run : h.run, h.date, h.time);
+      b.scan(h.minTh, h.maxTh, h.stepSize);
+      addBlocks(b, r);
+    } else if (!addRaw(b, add)) {
+      cout << "\nThe file: " << add << " is missing.\n" << endl;
+      return 1;
+    }
+    b.source(add);
+    if (!b.append(catalog)) {
+      cout << "\nThe catalog: " << b.error << "\n" << endl;
+      return 1;
+    }
+    cerr << "added " << add << ": run " << b.summary().run << ", " << b.summary().nEvents << " events in "
+         << fixed << setprecision(2) << chrono::duration<double>(Clock::now() - t0).count() << " s" << endl;
+  }
+
+  Clock::time_point t0 = Clock::now();
+  GEMCatalogReader cat(catalog);
+  if (!cat.good()) {
+    cout << "\nThe catalog: " << cat.error << "\n" << endl;
+    return 1;
+  }
+
+  printf("%8s %8s %6s %10s %12s %8s %8s %7s %9s %11s %s\n",
+         "run", "date", "time", "events", "VFATs", "CRC", "control", "EC", "BC", "scan", "source");
+  size_t nFound = 0;
+  for (size_t i = 0; i < cat.runs().size(); i++) {
+    const GEMCatalog::Run& r = *cat.runs()[i];
+    if (r.run < runLo || r.run > runHi || r.date < dateLo || r.date > dateHi || r.nEvents < minEvents) continue;
+    uint64_t nCRC = r.nCRC, nControl = r.nControl;
+    if (chip >= 0) {
+      const GEMCatalog::Chip* c = r.chip(chip);
+      if (!c) continue;
+      nCRC = c->nCRC;
+      nControl = c->nControl;
+    }
+    if ((crc && !nCRC) || (control && !nControl)) continue;
+    nFound++;
+    char ec[16], bc[16], scan[24];
+    snprintf(ec, sizeof(ec), "%u-%u", r.ECmin, r.ECmax);
+    snprintf(bc, sizeof(bc), "%u-%u", r.BCmin, r.BCmax);
+    if (r.stepSize) snprintf(scan, sizeof(scan), "%d-%d/%d", r.minTh, r.maxTh, r.stepSize);
+    else snprintf(scan, sizeof(scan), "-");
+    printf("%8d %8d %06d %10llu %12llu %8llu %8llu %7s %9s %11s %.*s\n",
+           r.run, r.date, r.time, (unsigned long long)r.nEvents, (unsigned long long)r.nVFAT,
+           (unsigned long long)r.nCRC, (unsigned long long)r.nControl, ec, bc, scan,
+           (int)sizeof(r.source), r.source);
+    if (!chips) continue;
+    for (uint32_t k = 0; k < r.nChips; k++) {
+      const GEMCatalog::Chip& c = r.chips()[k];
+      if (chip >= 0 && c.ChipID != chip) continue;
+      printf("%8s ChipID 0x%03x %10u VFATs %8u CRC %8u control\n", "", c.ChipID, c.nVFAT, c.nCRC, c.nControl);
+    }
+  }
+  cerr << " " << nFound << " of " << cat.runs().size() << " runs in " << fixed << setprecision(3)
+       << chrono::duration<double>(Clock::now() - t0).count()*1e3 << " ms";
+  if (cat.nCorrupt) cerr << ", " << cat.nCorrupt << " bytes of damaged records";
+  cerr << endl;
+  return 0;
+}
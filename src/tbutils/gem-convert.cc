@@ -0,0 +1,546 @@
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <map>
+#include <deque>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TROOT.h>
+
+#if defined(__CINT__) && !defined(__MAKECINT__)
+#include "libEvent.so"
+#else
+#include "Event.h"
+#endif
+#include "GEMRaw.h"
+#include "GEMResync.h"
+#include "GEMConvert.h"
+#include "GEMWriter.h"
+#include "GEMBlockFile.h"
+#include "GEMRunFile.h"
+#include "GEMByteOrder.h"
+
+/**
+* ... Parallel converter of GEB/VFAT data files: hex <-> binary, and to ROOT GEMtree ...
+*/
+
+/*! \file */
+/*!
+  Converts a hex (gem-reading.cc input, DataParker.dat) or binary
+  (writeVFATdataBinary) file into the other raw format, the same format
+  (garbage removed), or a ROOT file with the GEMtree of gem-reading.cc.
+
+  The input is read in chunks cut at GEB block boundaries (GEMResync::findHex
+  for hex, the GEB header sizes for binary). Worker threads decode and
+  encode the chunks independently, a sequencer hands them to the writer in
+  the order of the input, so the output is the same as a single thread
+  would write. The ROOT tree is filled by the main thread only.
+
+  A GEMBlockFile input (gem-re-write --compress, or -compress here) is
+  detected too; its blocks are decompressed ahead by GEMBlockReader and
+  become the chunks, and -first/-events start at an event found in its
+  index without reading what is before. With -compress each chunk is
+  compressed by its worker into one block of a GEMBlockFile output.
+  A GEMRunFile input (gem-re-write --run) is read the same way, block by
+  block from its headers, blocks with a wrong crc are left out; the run
+  number and date go into the EventHeader of a ROOT output.
+
+  A binary input written with the other byte order (a big endian DAQ) is
+  detected from its first blocks and turned around block by block by the
+  reader (GEMByteOrder::swapBlocks) before it is cut into chunks.
+
+  scripts/with_root_compile.sh gem-convert.cc <br>
+  ./gem-convert -i DataParker.dat -o DataParker.bin <br>
+  ./gem-convert -i DataParker.bin -o DataParker.root -j 8 <br>
+  ./gem-convert -i DataParker.dat -o DataParker.gbk -to binary -compress vfat+zlib
+
+  Options:
+    -i FILE       input file, hex or binary, the format is detected (DataParker.dat)
+    -o FILE       output file (DataParker.bin)
+    -to FORMAT    hex, binary or root; by default root for a .root output,
+                  otherwise the other raw format
+    -j N          worker threads (number of cores)
+    -chunk MB     input chunk size (4), one compressed block per chunk
+    -compress C   write a GEMBlockFile compressed with C: none, zlib, lz4, zstd,
+                  or for binary output vfat, vfat+zlib (GEMVFATCodec.h)
+    -first N      start at GEB block N of a block or run file input (0)
+    -events N     convert at most N GEB blocks of a block or run file input (all)
+
+  \author Sergey.Baranov@cern.ch
+*/
+
+using namespace std;
+
+enum Format { kHex, kBinary, kRoot };
+
+//! One piece of the input, cut at a GEB block boundary, and what it became.
+struct Chunk {
+  uint64_t seq;
+  vector<char> in;          /*!<input bytes, the last hex chunk ends with a new line */
+  size_t end;               /*!<blocks starting at in[end] belong to the next chunk */
+  vector<char> out;         /*!<hex or binary output */
+  vector<GEBdata> gebs;     /*!<ROOT output */
+  uint64_t blocks, vfats, skipped;
+  uint64_t skip, keep;      /*!<GEB blocks not converted at the start, at most converted */
+  int run, date;            /*!<of a run file input */
+  Chunk() : seq(0), end(0), blocks(0), vfats(0), skipped(0), skip(0), keep(~0ULL), run(0), date(0) {}
+};
+
+//! The input file in chunks of whole GEB blocks.
+class ChunkReader {
+  public:
+
+      ChunkReader(const string& file, size_t chunk) : fChunk(chunk), fHave(0), fHex(false), fSwap(false), fDone(0), fSeq(0) {
+        fInpf.open(file.c_str(), ios::binary);
+        vector<char> c(1 << 16);
+        fInpf.read(&c[0], c.size());
+        // hex files are whitespace and hex digits only
+        fHex = fInpf.gcount() > 0;
+        for (int i = 0; i < fInpf.gcount() && i < 64; i++) fHex &= (GEMResync::isSpace(c[i]) || GEMResync::hexDigit(c[i]) >= 0);
+        if (!fHex) fSwap = GEMByteOrder::detect((const unsigned char*)&c[0], fInpf.gcount()) == GEMByteOrder::kSwapped;
+        fInpf.clear();
+        fInpf.seekg(0);
+        fBuf.resize(fChunk + 2*GEMConvert::kMaxHexGEB + 1);
+      }
+
+      bool good() const { return fInpf.is_open(); }
+      bool hex() const { return fHex; }
+      bool swapped() const { return fSwap; }
+
+      //! Next chunk, 0 at the end of the file.
+      Chunk* next() {
+        fInpf.read(&fBuf[fHave], fChunk);
+        size_t n = fHave + fInpf.gcount();
+        bool last = (fInpf.gcount() == 0) || fInpf.eof();
+        if (!n) return 0;
+        if (fSwap) {
+          // only what is in host order already is cut and converted
+          fDone += GEMByteOrder::swapBlocks((unsigned char*)&fBuf[fDone], n - fDone);
+          if (!last) n = fDone;
+        }
+
+        size_t cut = n;
+        if (!last) cut = fHex ? cutHex(n) : cutBinary(n);
+
+        // the worker sees what the cut was decided on, the bytes after it are read again
+        Chunk* c = new Chunk();
+        c->seq = fSeq++;
+        c->in.assign(&fBuf[0], &fBuf[0] + n);
+        if (last && fHex) c->in.push_back('\n');   // the last token may lack its new line
+        c->end = last ? c->in.size() : cut;
+        fHave = fHave + fInpf.gcount() - cut;
+        memmove(&fBuf[0], &fBuf[cut], fHave);
+        fDone = fSwap && !last ? fDone - cut : 0;
+        return c;
+      }
+
+  private:
+
+      //! Start of a GEB header token near the end of the buffer.
+      size_t cutHex(size_t n) {
+        size_t from = n > 2*GEMConvert::kMaxHexGEB ? n - 2*GEMConvert::kMaxHexGEB : 0;
+        long h = GEMResync::findHex(&fBuf[from], n - from, from == 0);
+        if (h >= 0) return from + h;
+        // no block starts there, keep what may still be the start of one
+        return n > GEMConvert::kMaxHexGEB ? n - GEMConvert::kMaxHexGEB : n;
+      }
+
+      //! End of the last GEB block which fits, found from the header sizes.
+      size_t cutBinary(size_t n) {
+        uint64_t skipped = 0;
+        return GEMConvert::frameBinary((const unsigned char*)&fBuf[0], n, skipped,
+                                       [](const unsigned char*, size_t) {});
+      }
+
+      ifstream fInpf;
+      size_t fChunk;
+      vector<char> fBuf;
+      size_t fHave;
+      bool fHex;
+      bool fSwap;      /*!<binary input in the other byte order */
+      size_t fDone;    /*!<bytes at the start of fBuf in host order */
+      uint64_t fSeq;
+};
+
+//! Hands chunks from the reader to the workers and back to the writer in order.
+/*!
+  At most fLimit chunks are between the reader and the writer at any time,
+  so memory stays bounded when the writer is the slow side.
+*/
+class Sequencer {
+  public:
+
+      Sequencer(size_t limit) : fLimit(limit), fInFlight(0), fNext(0), fClosed(false) {}
+
+      //! Reader: queue a chunk for the workers, waits while too many are in flight.
+      void push(Chunk* c) {
+        unique_lock<mutex> lock(fMutex);
+        fSpace.wait(lock, [&]{ return fInFlight < fLimit; });
+        fInFlight++;
+        fTodo.push_back(c);
+        fWork.notify_one();
+      }
+
+      //! Reader: no more chunks.
+      void close() {
+        lock_guard<mutex> lock(fMutex);
+        fClosed = true;
+        fWork.notify_all();
+        fDone.notify_all();
+      }
+
+      //! Worker: next chunk to convert, 0 when there are no more.
+      Chunk* take() {
+        unique_lock<mutex> lock(fMutex);
+        fWork.wait(lock, [&]{ return !fTodo.empty() || fClosed; });
+        if (fTodo.empty()) return 0;
+        Chunk* c = fTodo.front();
+        fTodo.pop_front();
+        return c;
+      }
+
+      //! Worker: the chunk is converted.
+      void done(Chunk* c) {
+        lock_guard<mutex> lock(fMutex);
+        fReady[c->seq] = c;
+        if (c->seq == fNext) fDone.notify_all();
+      }
+
+      //! Writer: the next chunk in input order, 0 at the end.
+      Chunk* next() {
+        unique_lock<mutex> lock(fMutex);
+        fDone.wait(lock, [&]{ return fReady.count(fNext) || (fClosed && !fInFlight); });
+        map<uint64_t, Chunk*>::iterator it = fReady.find(fNext);
+        if (it == fReady.end()) return 0;
+        Chunk* c = it->second;
+        fReady.erase(it);
+        fNext++;
+        return c;
+      }
+
+      //! Writer: the chunk is written.
+      void release(Chunk* c) {
+        delete c;
+        lock_guard<mutex> lock(fMutex);
+        fInFlight--;
+        fSpace.notify_one();
+        if (fClosed && !fInFlight) fDone.notify_all();
+      }
+
+  private:
+
+      mutex fMutex;
+      condition_variable fSpace, fWork, fDone;
+      size_t fLimit, fInFlight;
+      deque<Chunk*> fTodo;
+      map<uint64_t, Chunk*> fReady;
+      uint64_t fNext;
+      bool fClosed;
+};
+
+//! One GEB block as gem-reading.cc puts it into GEMtree.
+static void addGEB(Chunk& c, uint64_t header, uint64_t trailer, const uint16_t* w16, int n) {
+  uint64_t ZSFlag  = (0xffffff0000000000 & header) >> 40;
+  uint64_t ChamID  = (0x000000fff0000000 & header) >> 28;
+  GEBdata geb(ZSFlag, ChamID);
+  for (int ivfat = 0; ivfat < n; ivfat++) {
+    // BC, EC, ChipID, crc of one VFAT
+    const uint16_t* v = w16 + 4*ivfat;
+    uint8_t  b1010  = (0xf000 & v[0]) >> 12;
+    uint8_t  b1100  = (0xf000 & v[1]) >> 12;
+    uint8_t  Flag   = (0x000f & v[1]);
+    uint8_t  b1110  = (0xf000 & v[2]) >> 12;
+    uint16_t ChipID = (0x0fff & v[2]);
+    if ((b1010 == 0xa) && (b1100 == 0xc) && (b1110 == 0xe))
+      geb.addVFATData(VFATdata(b1010, b1100, ChipID, Flag, b1110, v[3]));
+  }
+  uint64_t OHcrc      = (0xffff000000000000 & trailer) >> 48;
+  uint64_t OHwCount   = (0x0000ffff00000000 & trailer) >> 32;
+  uint64_t ChamStatus = (0x00000000ffff0000 & trailer) >> 16;
+  geb.setTrailer(OHcrc, OHwCount, ChamStatus);
+  c.gebs.push_back(geb);
+}
+
+//! Decode and encode one chunk, runs in the worker threads.
+static void convert(Chunk& c, bool inHex, Format to, int codec) {
+  size_t n = c.in.size();
+  size_t pos;
+  uint16_t w16[4*GEMRaw::kMaxVFAT];
+  if (to != kRoot) c.out.reserve(inHex ? (to == kBinary ? c.end/2 : c.end) : (to == kHex ? c.end*5/2 : c.end));
+  if (inHex) {
+    pos = GEMConvert::frameHex(&c.in[0], n, c.skipped,
+      [&](const char* text, size_t len, const uint64_t* words) {
+        if (c.skip) { c.skip--; return; }
+        if (c.blocks >= c.keep) return;
+        int nv = GEMRaw::sumVFAT(words[0]);
+        c.blocks++;
+        c.vfats += nv;
+        if (to == kHex) {
+          c.out.insert(c.out.end(), text, text + len);
+          if (text[len-1] != '\n') c.out.push_back('\n');
+        } else if (to == kBinary) {
+          unsigned char bin[GEMRaw::kMaxGEBSize];
+          size_t size = GEMConvert::wordsToBinary(words, bin);
+          c.out.insert(c.out.end(), (const char*)bin, (const char*)bin + size);
+        } else {
+          for (int i = 0; i < nv; i++) {
+            const uint64_t* v = words + 1 + 6*i;
+            w16[4*i] = v[0]; w16[4*i+1] = v[1]; w16[4*i+2] = v[2]; w16[4*i+3] = v[5];
+          }
+          addGEB(c, words[0], words[1 + 6*nv], w16, nv);
+        }
+      }, c.end);
+  } else {
+    pos = GEMConvert::frameBinary((const unsigned char*)&c.in[0], n, c.skipped,
+      [&](const unsigned char* p, size_t size) {
+        if (c.skip) { c.skip--; return; }
+        if (c.blocks >= c.keep) return;
+        uint64_t header = GEMRaw::load64(p);
+        int nv = GEMRaw::sumVFAT(header);
+        c.blocks++;
+        c.vfats += nv;
+        if (to == kBinary) {
+          c.out.insert(c.out.end(), (const char*)p, (const char*)p + size);
+        } else if (to == kHex) {
+          char text[GEMConvert::kMaxHexGEB];
+          c.out.insert(c.out.end(), text, text + GEMConvert::binaryToHex(p, text));
+        } else {
+          const unsigned char* r = p + GEMRaw::kGEBHeaderSize;
+          for (int i = 0; i < nv; i++, r += GEMRaw::kVFATSize) {
+            w16[4*i]   = GEMRaw::load16(r + GEMRaw::kBCOffset);
+            w16[4*i+1] = GEMRaw::load16(r + GEMRaw::kECOffset);
+            w16[4*i+2] = GEMRaw::load16(r + GEMRaw::kChipIDOffset);
+            w16[4*i+3] = GEMRaw::load16(r + GEMRaw::kCrcOffset);
+          }
+          addGEB(c, header, GEMRaw::load64(r), w16, nv);
+        }
+      }, c.end);
+  }
+  // what is left before the end of the chunk is not a block
+  if (pos < c.end) {
+    c.skipped += c.end - pos;
+    if (inHex && c.end == n) c.skipped--;   // the new line added by ChunkReader
+  }
+  vector<char>().swap(c.in);
+  if (codec >= 0 && !c.out.empty()) {
+    vector<char> rec;
+    GEMBlockFile::pack(codec, 0, &c.out[0], c.out.size(), c.blocks, rec);
+    c.out.swap(rec);
+  }
+}
+
+//! Run number and date of the block just read.
+static void runOf(const GEMBlockReader&, Chunk&) {}
+static void runOf(const GEMRunReader& r, Chunk& c) { c.run = r.run().run; c.date = r.run().date; }
+
+//! The blocks of a GEMBlockReader or GEMRunReader are the chunks, from the one holding event first on.
+template <class Reader> static void feedBlocks(Reader& r, Sequencer& seq, uint64_t first, uint64_t nEvents)
+{
+  vector<char> raw;
+  uint64_t firstEvent, left = nEvents, s = 0;
+  uint32_t nev;
+  r.seek(first);
+  while (left && r.next(raw, firstEvent, nev)) {
+    Chunk* c = new Chunk();
+    c->seq = s++;
+    c->in.swap(raw);
+    if (r.hex()) c->in.push_back('\n');
+    c->end  = c->in.size();
+    c->skip = first > firstEvent ? first - firstEvent : 0;
+    c->keep = left;
+    runOf(r, *c);
+    left -= min(left, nev > c->skip ? nev - c->skip : 0);
+    seq.push(c);
+  }
+}
+
+//! main function.
+/*!
+C++ any documents
+*/
+
+int main(int argc, char** argv)
+{ cerr<<"---> Main()"<<endl;
+
+  string inFile = "DataParker.dat", outFile = "DataParker.bin", to, compress;
+  int nThreads = thread::hardware_concurrency();
+  double chunkMB = 4.;
+  uint64_t first = 0, nEvents = ~0ULL;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool more = (i+1 < argc);
+    if      (a == "-i"     && more) inFile   = argv[++i];
+    else if (a == "-o"     && more) outFile  = argv[++i];
+    else if (a == "-to"    && more) to       = argv[++i];
+    else if (a == "-j"     && more) nThreads = atoi(argv[++i]);
+    else if (a == "-chunk" && more) chunkMB  = atof(argv[++i]);
+    else if (a == "-compress" && more) compress = argv[++i];
+    else if (a == "-first"  && more) first   = strtoull(argv[++i], 0, 0);
+    else if (a == "-events" && more) nEvents = strtoull(argv[++i], 0, 0);
+    else {
+      cout << "unknown option " << a << endl;
+      return 1;
+    }
+  }
+  if (nThreads < 1) nThreads = 1;
+  size_t chunk = chunkMB > 0. ? (size_t)(chunkMB*(1 << 20)) : 4 << 20;
+  if (chunk < 4*GEMConvert::kMaxHexGEB) chunk = 4*GEMConvert::kMaxHexGEB;
+
+  GEMBlockReader* blocks = 0;
+  GEMRunReader* runs = 0;
+  if (GEMBlockReader::IsBlockFile(inFile)) {
+    blocks = new GEMBlockReader(inFile, nThreads);
+    if (!blocks->good()) {
+      cout << "\n" << blocks->error << "\n" << endl;
+      return 1;
+    }
+  } else if (GEMRunReader::IsRunFile(inFile)) {
+    runs = new GEMRunReader(inFile);
+    if (!runs->good()) {
+      cout << "\n" << runs->error << "\n" << endl;
+      return 1;
+    }
+    cout << " run " << runs->run().run << " of " << runs->run().date << " " << runs->run().time
+         << ", scan " << runs->run().minTh << "-" << runs->run().maxTh << " step " << runs->run().stepSize << endl;
+  } else if (first || nEvents != ~0ULL) {
+    cout << "-first and -events need a block or run file input" << endl;
+    return 1;
+  }
+  ChunkReader reader(blocks || runs ? string() : inFile, chunk);
+  if (!blocks && !runs && !reader.good()) {
+    cout << "\nThe file: " << inFile << " is missing.\n" << endl;
+    return 1;
+  }
+  bool inHex = blocks ? blocks->hex() : runs ? runs->hex() : reader.hex();
+
+  Format format = inHex ? kBinary : kHex;
+  bool dotRoot = outFile.size() > 5 && outFile.compare(outFile.size() - 5, 5, ".root") == 0;
+  if      (to == "hex")    format = kHex;
+  else if (to == "binary") format = kBinary;
+  else if (to == "root" || (to.empty() && dotRoot)) format = kRoot;
+  else if (!to.empty()) {
+    cout << "unknown format " << to << ", use hex, binary or root" << endl;
+    return 1;
+  }
+  int codec = -1;
+  if (!compress.empty()) {
+    codec = GEMBlockFile::codecByName(compress);
+    if (codec < 0 || format == kRoot) {
+      cout << "cannot compress " << (format == kRoot ? "a ROOT output" : "with " + compress) << endl;
+      return 1;
+    }
+  }
+  static const char* names[] = { "hex", "binary", "root" };
+  cerr << "convert " << inFile << (inHex ? " (hex" : reader.swapped() ? " (binary, other byte order" : " (binary") << (blocks ? " blocks)" : runs ? " run)" : ")") << " to " << outFile
+       << " (" << names[format] << (codec >= 0 ? string(" ") + GEMBlockFile::codecName(codec) : "") << ") with "
+       << nThreads << " threads" << endl;
+
+  GEMWriter out;
+  GEMBlockWriter bout;
+  TFile* hfile = 0;
+  TTree* GEMtree = 0;
+  Event* ev = 0;
+  if (format == kRoot) {
+    hfile = new TFile(outFile.c_str(), "RECREATE", "GEM events converted by gem-convert");
+    GEMtree = new TTree("GEMtree", "A Tree with GEM Events");
+    ev = new Event();
+    GEMtree->Branch("GEMEvents", &ev);
+  } else if (codec >= 0 ? !bout.open(outFile, codec, format == kHex ? GEMBlockFile::kHex : GEMBlockFile::kBinary)
+                        : !out.open(outFile, false)) {
+    cout << "\nCannot open the output " << (codec >= 0 ? bout.error : out.error) << "\n" << endl;
+    return 1;
+  }
+
+  chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+  Sequencer seq(2*nThreads + 2);
+
+  thread readThread([&]{
+      if (blocks) {
+        feedBlocks(*blocks, seq, first, nEvents);
+      } else if (runs) {
+        feedBlocks(*runs, seq, first, nEvents);
+      } else {
+        while (Chunk* c = reader.next()) seq.push(c);
+      }
+      seq.close();
+  });
+  vector<thread> workers;
+  for (int k = 0; k < nThreads; k++)
+    workers.push_back(thread([&]{
+        while (Chunk* c = seq.take()) {
+          convert(*c, inHex, format, codec);
+          seq.done(c);
+        }
+    }));
+
+  // the writer, in input order
+  uint64_t nChunks = 0, nBlocks = 0, nVFATs = 0, nSkipped = 0, nEvent = first;
+  bool ok = true;
+  while (Chunk* c = seq.next()) {
+    nChunks++;
+    nBlocks  += c->blocks;
+    nVFATs   += c->vfats;
+    nSkipped += c->skipped;
+    if (format == kRoot) {
+      for (size_t j = 0; j < c->gebs.size(); j++) {
+        ev->Build(0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0);
+        if (runs) ev->SetHeader(nEvent, c->run, c->date);
+        nEvent++;
+        ev->addGEBdata(c->gebs[j]);
+        GEMtree->Fill();
+        ev->Clear();
+      }
+    } else if (ok && !c->out.empty()) {
+      if (codec >= 0) {
+        ok = bout.writePacked(c->out);
+      } else {
+        out.put(&c->out[0], c->out.size());
+        ok = out.endBlock();
+      }
+    }
+    seq.release(c);
+  }
+  readThread.join();
+  for (size_t k = 0; k < workers.size(); k++) workers[k].join();
+
+  if (format == kRoot) {
+    hfile->Write(0, TObject::kOverwrite);
+    hfile->Close();
+    cout << "=== hfile->Write()" << endl;
+  } else if (codec >= 0 ? (!bout.close() || !ok) : (!out.close() || !ok)) {
+    cout << "\nOutput " << outFile << ": " << (codec >= 0 ? bout.error : out.error) << endl;
+    return 1;
+  }
+
+  double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+  struct stat st;
+  double inMB = stat(inFile.c_str(), &st) == 0 ? st.st_size/1048576. : 0.;
+  cout << " " << nBlocks << " GEB blocks, " << nVFATs << " VFATs in " << nChunks << " chunks, "
+       << nSkipped << " bytes skipped" << endl;
+  if (codec >= 0)
+    cout << " " << bout.nBlocks << " compressed blocks, " << bout.nRaw << " -> " << bout.bytes() << " bytes" << endl;
+  if (blocks) {
+    if (blocks->nCorrupt) cout << " " << blocks->nCorrupt << " corrupt input blocks skipped" << endl;
+    delete blocks;
+  }
+  if (runs) {
+    if (runs->nCorrupt || runs->nSkipped)
+      cout << " " << runs->nCorrupt << " blocks with a wrong crc, " << runs->nSkipped << " bytes of damaged headers skipped" << endl;
+    delete runs;
+  }
+  cout << " " << fixed << setprecision(2) << sec << " s, " << (sec > 0. ? inMB/sec : 0.) << " MB/s" << endl;
+  return 0;
+}
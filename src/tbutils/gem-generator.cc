@@ -0,0 +1,183 @@
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+
+#include "GEMGenerator.h"
+
+/**
+* ... Synthetic GEM data generator, makes reproducible multi-GB inputs for the readers ...
+*/
+
+/*! \file */
+/*!
+  Synthetic GEB/VFAT2 data with valid VFAT CRCs, hex (gem-reading.cc input)
+  or binary (writeVFATdataBinary layout) format.
+
+  g++ -O2 -std=c++11 -pthread gem-generator.cc -o gem-generator <br>
+  ./gem-generator -size 4G -chambers 4 -chips 24 -occupancy 0.02 -cluster 2 -errors 1e-5 -o DataParker.dat
+
+  Options:
+    -n N            number of events (default 100000)
+    -size S         at most S bytes, whole events, k/M/G suffixes allowed, overrides -n
+    -chambers N     GEB blocks per event (1)
+    -chips N        VFAT2 chips per GEB, at most 24 (24)
+    -occupancy F    mean fraction of hit channels (0.01)
+    -cluster F      mean cluster size in strips (2)
+    -errors F       probability of a corrupted VFAT word (0)
+    -seed N         random seed (12345)
+    -binary         binary instead of hex output
+    -amc            wrap the GEB blocks into AMC headers and trailers
+    -threads N      generator threads (1), the output does not depend on it
+    -o FILE         output file (DataParkerSynthetic.dat), "-" for stdout
+
+  \author Sergey.Baranov@cern.ch
+*/
+
+using namespace std;
+
+//! One chunk of GEMGenerator::kChunk events, made by a worker thread.
+struct Chunk {
+  vector<char> buf;
+  size_t       size;
+  uint64_t     nVFAT, nErrors, nEvents;
+  vector<size_t>   ends;           /*!<end of every event in buf */
+  vector<uint64_t> vfats, errors;  /*!<nVFAT, nErrors up to the end of every event */
+
+  //! The first k events only, for -size.
+  void cut(uint64_t k) {
+    size    = k ? ends[k-1] : 0;
+    nVFAT   = k ? vfats[k-1] : 0;
+    nErrors = k ? errors[k-1] : 0;
+    nEvents = k;
+  }
+};
+
+static void makeChunk(GEMGenerator* gen, uint64_t ichunk, uint64_t nEvents, Chunk* c)
+{
+  gen->seekChunk(ichunk);
+  uint64_t vfat0 = gen->nVFAT, err0 = gen->nErrors;
+  size_t n = 0;
+  uint64_t ievent = ichunk*GEMGenerator::kChunk;
+  uint64_t last = ievent + GEMGenerator::kChunk;
+  if (last > nEvents) last = nEvents;
+  c->nEvents = last > ievent ? last - ievent : 0;
+  c->ends.clear();
+  c->vfats.clear();
+  c->errors.clear();
+  for (; ievent < last; ievent++) {
+    n += gen->event(&c->buf[n]);
+    c->ends.push_back(n);
+    c->vfats.push_back(gen->nVFAT - vfat0);
+    c->errors.push_back(gen->nErrors - err0);
+  }
+  c->size    = n;
+  c->nVFAT   = gen->nVFAT - vfat0;
+  c->nErrors = gen->nErrors - err0;
+}
+
+static uint64_t parseSize(const char* s)
+{
+  char* end = 0;
+  double v = strtod(s, &end);
+  if (end && (*end == 'k' || *end == 'K')) v *= 1024.;
+  if (end && (*end == 'm' || *end == 'M')) v *= 1024.*1024.;
+  if (end && (*end == 'g' || *end == 'G')) v *= 1024.*1024.*1024.;
+  return (uint64_t)v;
+}
+
+//! main function.
+/*!
+C++ any documents
+*/
+
+int main(int argc, char** argv)
+{ cerr<<"---> Main()"<<endl;
+
+  GEMGenerator::Config cfg;
+  uint64_t nEvents  = 100000;
+  uint64_t maxBytes = 0;
+  string file = "DataParkerSynthetic.dat";
+  int nThreads = 1;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool more = (i+1 < argc);
+    if      (a == "-n"         && more) nEvents         = strtoull(argv[++i], 0, 0);
+    else if (a == "-size"      && more) maxBytes        = parseSize(argv[++i]);
+    else if (a == "-chambers"  && more) cfg.nChambers   = atoi(argv[++i]);
+    else if (a == "-chips"     && more) cfg.nChips      = atoi(argv[++i]);
+    else if (a == "-occupancy" && more) cfg.occupancy   = atof(argv[++i]);
+    else if (a == "-cluster"   && more) cfg.clusterSize = atof(argv[++i]);
+    else if (a == "-errors"    && more) cfg.errorRate   = atof(argv[++i]);
+    else if (a == "-seed"      && more) cfg.seed        = strtoull(argv[++i], 0, 0);
+    else if (a == "-binary")            cfg.binary      = true;
+    else if (a == "-amc")               cfg.amc         = true;
+    else if (a == "-threads"   && more) nThreads        = atoi(argv[++i]);
+    else if (a == "-o"         && more) file            = argv[++i];
+    else {
+      cout << "unknown option " << a << endl;
+      return 1;
+    }
+  }
+  if (maxBytes) nEvents = ~0ULL;
+
+  FILE* outf = (file == "-") ? stdout : fopen(file.c_str(), "wb");
+  if (!outf) {
+    cout << "\nThe file: " << file << " can not be opened.\n" << endl;
+    return 1;
+  }
+
+  if (nThreads < 1) nThreads = 1;
+  vector<GEMGenerator> gens(nThreads, GEMGenerator(cfg));
+  vector<Chunk> chunks(nThreads);
+  for (int t = 0; t < nThreads; t++) chunks[t].buf.resize(GEMGenerator::kChunk*gens[t].maxEventSize());
+
+  // every thread makes one chunk per round, the chunks are written in order
+  uint64_t nBytes = 0, ievent = 0, nVFAT = 0, nErrors = 0, ichunk = 0;
+  bool done = false;
+
+  chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+  while (!done) {
+    vector<thread> workers;
+    for (int t = 1; t < nThreads; t++) workers.push_back(thread(makeChunk, &gens[t], ichunk + t, nEvents, &chunks[t]));
+    makeChunk(&gens[0], ichunk, nEvents, &chunks[0]);
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+    for (int t = 0; t < nThreads && !done; t++) {
+      Chunk& c = chunks[t];
+      if (maxBytes && nBytes + c.size >= maxBytes) {
+        // whole events only, the last one which ends within maxBytes
+        c.cut(upper_bound(c.ends.begin(), c.ends.end(), maxBytes - nBytes) - c.ends.begin());
+        done = true;
+      }
+      if (c.nEvents < GEMGenerator::kChunk) done = true;
+      size_t n = c.size;
+      if (fwrite(&c.buf[0], 1, n, outf) != n) {
+        cout << "write error after " << nBytes << " bytes" << endl;
+        done = true;
+        break;
+      }
+      nBytes  += n;
+      ievent  += c.nEvents;
+      nVFAT   += c.nVFAT;
+      nErrors += c.nErrors;
+    }
+    ichunk += nThreads;
+  }
+  if (outf != stdout) fclose(outf);
+  double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+  cerr << "events " << ievent << " VFATs " << nVFAT << " errors " << nErrors
+       << " bytes " << nBytes << " in " << setprecision(3) << sec << " s, "
+       << nBytes/1e6/(sec > 0 ? sec : 1e-9) << " MB/s" << endl;
+  return 0;
+}
@@ -0,0 +1,314 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TH1.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TClass.h>
+#include <TROOT.h>
+
+#if defined(__CINT__) && !defined(__MAKECINT__)
+#include "libEvent.so"
+#else
+#include "Event.h"
+#endif
+
+/**
+* ... Parallel merger of gem-reading/thldread output ROOT files ...
+*/
+
+/*! \file */
+/*!
+  Merges the ROOT files of runs split across jobs (DQMlight.root of
+  gem-reading.cc, thldread.root, gem-convert.cc outputs) into one file,
+  as hadd does, with the two slow parts of hadd done differently:
+
+  The histograms are summed by worker threads, each one opens its share of
+  the inputs and keeps its own sums, the main thread adds the few partial
+  sums at the end. Every histogram is checked against the booking of the
+  first input (class, bins and axis ranges) while it is read; an input
+  with a histogram missing, extra or booked otherwise fails the merge and
+  no output is left.
+
+  At the same time the main thread appends the trees (GEMtree, Telemetry)
+  input by input. When the compression settings of an input are those of
+  the output, its baskets are copied as they are (TTree::Merge "fast"),
+  without being decompressed and compressed again; otherwise its entries
+  are read and written again. By default the output is compressed
+  like the first input, so the outputs of one campaign are all copied fast.
+
+  Objects which are neither histograms nor trees are taken from the first
+  input, except the "Checkpoint" of gem-reading --checkpoint: it is where
+  the reading of one input got to, the merged file cannot be resumed.
+  Subdirectories are not looked into, the outputs have none.
+
+  scripts/with_root_compile.sh gem-merge.cc <br>
+  ./gem-merge -o DQMlight-all.root job*\/DQMlight.root <br>
+  ./gem-merge -o thldread-all.root -j 8 -compress 101 run1/thldread.root run2/thldread.root
+
+  Options:
+    -o FILE       output file (merged.root)
+    -j N          histogram threads (number of cores)
+    -compress N   compression settings of the output, 100*algorithm+level;
+                  by default those of the first input
+    FILE ...      input files, at least one
+
+  \author Sergey.Baranov@cern.ch
+*/
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+//! What a histogram was booked with.
+struct Booking {
+  string cls;
+  int dim, nx, ny;
+  double xlo, xhi, ylo, yhi;
+
+  explicit Booking(TH1* h) : cls(h->ClassName()), dim(h->GetDimension()), nx(h->GetNbinsX()), ny(0),
+    xlo(h->GetXaxis()->GetXmin()), xhi(h->GetXaxis()->GetXmax()), ylo(0.), yhi(0.) {
+    if (dim < 2) return;
+    ny  = h->GetNbinsY();
+    ylo = h->GetYaxis()->GetXmin();
+    yhi = h->GetYaxis()->GetXmax();
+  }
+
+  bool operator==(const Booking& b) const {
+    return cls == b.cls && dim == b.dim && nx == b.nx && ny == b.ny && xlo == b.xlo && xhi == b.xhi
+        && ylo == b.ylo && yhi == b.yhi;
+  }
+
+  string str() const {
+    char s[128];
+    if (dim < 2) snprintf(s, sizeof(s), "%s(%d, %g, %g)", cls.c_str(), nx, xlo, xhi);
+    else snprintf(s, sizeof(s), "%s(%d, %g, %g, %d, %g, %g)", cls.c_str(), nx, xlo, xhi, ny, ylo, yhi);
+    return s;
+  }
+};
+
+enum Kind { kHisto, kTree, kOther };
+
+//! The objects of a file, each name once (its highest cycle), in the order of the keys.
+static vector<pair<string, Kind> > objects(TFile* f) {
+  vector<pair<string, Kind> > v;
+  set<string> seen;
+  TIter next(f->GetListOfKeys());
+  while (TKey* k = (TKey*)next()) {
+    if (!seen.insert(k->GetName()).second) continue;
+    TClass* c = TClass::GetClass(k->GetClassName());
+    Kind kind = kOther;
+    if (c && c->InheritsFrom(TH1::Class())) kind = kHisto;
+    else if (c && c->InheritsFrom(TTree::Class())) kind = kTree;
+    v.push_back(make_pair(string(k->GetName()), kind));
+  }
+  return v;
+}
+
+//! Histogram sums of a share of the inputs, made by one thread.
+struct Partial {
+  map<string, TH1*> sums;
+  vector<string> errors;
+};
+
+//! Sum the histograms of inputs[first, last) into p, checking them against booked.
+static void sumHistos(const vector<string>& inputs, size_t first, size_t last,
+                      const map<string, Booking>& booked, Partial& p) {
+  for (size_t i = first; i < last; i++) {
+    TFile* f = TFile::Open(inputs[i].c_str(), "READ");
+    if (!f || f->IsZombie()) {
+      p.errors.push_back(inputs[i] + ": cannot be opened");
+      delete f;
+      continue;
+    }
+    set<string> found;
+    vector<pair<string, Kind> > objs = objects(f);
+    for (size_t k = 0; k < objs.size(); k++) {
+      if (objs[k].second != kHisto) continue;
+      const string& name = objs[k].first;
+      map<string, Booking>::const_iterator b = booked.find(name);
+      if (b == booked.end()) {
+        p.errors.push_back(inputs[i] + ": " + name + " is not booked in " + inputs[0]);
+        continue;
+      }
+      TH1* h = 0;
+      f->GetObject(name.c_str(), h);
+      if (!h) continue;
+      h->SetDirectory(0);
+      found.insert(name);
+      Booking bh(h);
+      if (!(bh == b->second)) {
+        p.errors.push_back(inputs[i] + ": " + name + " is " + bh.str() + ", " + b->second.str() + " in " + inputs[0]);
+        delete h;
+        continue;
+      }
+      TH1*& sum = p.sums[name];
+      if (!sum) sum = h;
+      else { sum->Add(h); delete h; }
+    }
+    for (map<string, Booking>::const_iterator b = booked.begin(); b != booked.end(); ++b)
+      if (!found.count(b->first)) p.errors.push_back(inputs[i] + ": " + b->first + " is missing");
+    f->Close();
+    delete f;
+  }
+}
+
+int main(int argc, char** argv)
+{ cerr<<"---> Main()"<<endl;
+
+  string outFile = "merged.root";
+  int nThreads = thread::hardware_concurrency(), compress = -1;
+  vector<string> inputs;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool more = (i+1 < argc);
+    if      (a == "-o"        && more) outFile  = argv[++i];
+    else if (a == "-j"        && more) nThreads = atoi(argv[++i]);
+    else if (a == "-compress" && more) compress = atoi(argv[++i]);
+    else if (!a.empty() && a[0] != '-') inputs.push_back(a);
+    else {
+      cout << "unknown option " << a << endl;
+      return 1;
+    }
+  }
+  if (inputs.empty()) {
+    cout << "\nNo input files.\n" << endl;
+    return 1;
+  }
+  if (nThreads < 1) nThreads = 1;
+  if ((size_t)nThreads > inputs.size()) nThreads = inputs.size();
+
+  ROOT::EnableThreadSafety();
+  TH1::AddDirectory(kFALSE);
+  Clock::time_point t0 = Clock::now();
+
+  // the first input is the reference: its objects, and the booking of its histograms
+  TFile* first = TFile::Open(inputs[0].c_str(), "READ");
+  if (!first || first->IsZombie()) {
+    cout << "\nThe file: " << inputs[0] << " is missing.\n" << endl;
+    return 1;
+  }
+  vector<pair<string, Kind> > objs = objects(first);
+  map<string, Booking> booked;
+  set<string> treeNames;
+  for (size_t k = 0; k < objs.size(); k++) {
+    if (objs[k].second == kTree) treeNames.insert(objs[k].first);
+    if (objs[k].second != kHisto) continue;
+    TH1* h = 0;
+    first->GetObject(objs[k].first.c_str(), h);
+    if (!h) continue;
+    booked.insert(make_pair(objs[k].first, Booking(h)));
+    delete h;
+  }
+  if (compress < 0) compress = first->GetCompressionSettings();
+
+  cerr << "merge " << inputs.size() << " files into " << outFile << ": " << booked.size() << " histograms on "
+       << nThreads << " threads, " << treeNames.size() << " trees" << endl;
+
+  vector<Partial> partials(nThreads);
+  vector<thread> workers;
+  for (int t = 0; t < nThreads; t++) {
+    size_t lo = inputs.size()*t/nThreads, hi = inputs.size()*(t + 1)/nThreads;
+    workers.push_back(thread(sumHistos, cref(inputs), lo, hi, cref(booked), ref(partials[t])));
+  }
+
+  // the trees meanwhile, input by input in the main thread
+  TFile* hfile = new TFile(outFile.c_str(), "RECREATE", "GEM histograms and trees merged by gem-merge", compress);
+  vector<string> errors;
+  map<string, TTree*> trees;
+  int nFast = 0, nSlow = 0;
+  for (size_t i = 0; i < inputs.size() && !treeNames.empty(); i++) {
+    TFile* f = i ? TFile::Open(inputs[i].c_str(), "READ") : first;
+    if (!f || f->IsZombie()) {
+      errors.push_back(inputs[i] + ": cannot be opened");
+      delete f;
+      continue;
+    }
+    bool fast = f->GetCompressionSettings() == hfile->GetCompressionSettings();
+    (fast ? nFast : nSlow)++;
+    for (set<string>::const_iterator n = treeNames.begin(); n != treeNames.end(); ++n) {
+      TTree* in = 0;
+      f->GetObject(n->c_str(), in);
+      if (!in) {
+        errors.push_back(inputs[i] + ": " + *n + " is missing");
+        continue;
+      }
+      hfile->cd();
+      TTree*& out = trees[*n];
+      if (!out) {
+        out = in->CloneTree(0);
+        out->SetDirectory(hfile);
+      }
+      // TTree::Merge sets the branch addresses of in to those of out first
+      TList one;
+      one.Add(in);
+      out->Merge(&one, fast ? "fast" : "");
+      delete in;
+    }
+    if (f != first) { f->Close(); delete f; }
+  }
+
+  for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+  Long64_t nEntries = 0;
+  for (map<string, TTree*>::iterator t = trees.begin(); t != trees.end(); ++t) nEntries += t->second->GetEntries();
+
+  // the partial sums into the first one of every histogram
+  map<string, TH1*> sums;
+  for (size_t t = 0; t < partials.size(); t++) {
+    errors.insert(errors.end(), partials[t].errors.begin(), partials[t].errors.end());
+    for (map<string, TH1*>::iterator s = partials[t].sums.begin(); s != partials[t].sums.end(); ++s) {
+      TH1*& sum = sums[s->first];
+      if (!sum) sum = s->second;
+      else { sum->Add(s->second); delete s->second; }
+    }
+  }
+
+  if (!errors.empty()) {
+    for (size_t e = 0; e < errors.size(); e++) cout << errors[e] << endl;
+    cout << "\nThe inputs do not match, nothing merged.\n" << endl;
+    hfile->Close();
+    delete hfile;
+    remove(outFile.c_str());
+    return 1;
+  }
+
+  // everything in the order of the first input
+  hfile->cd();
+  for (size_t k = 0; k < objs.size(); k++) {
+    const string& name = objs[k].first;
+    if (objs[k].second == kHisto) {
+      if (sums.count(name)) sums[name]->Write(name.c_str(), TObject::kOverwrite);
+    } else if (objs[k].second == kTree) {
+      if (trees.count(name)) trees[name]->Write(name.c_str(), TObject::kOverwrite);
+    } else if (name == "Checkpoint") {
+      continue;
+    } else if (TObject* o = first->Get(name.c_str())) {
+      hfile->cd();
+      o->Write(name.c_str(), TObject::kOverwrite);
+      delete o;
+    }
+  }
+  hfile->Close();
+  delete hfile;
+  first->Close();
+  delete first;
+
+  double sec = chrono::duration<double>(Clock::now() - t0).count();
+  cerr << " " << sums.size() << " histograms, " << nEntries << " tree entries; " << nFast
+       << " inputs with fast tree copy, " << nSlow << " recompressed" << endl;
+  cerr << " " << fixed << setprecision(2) << sec << " s" << endl;
+  return 0;
+}
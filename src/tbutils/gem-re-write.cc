@@ -4,6 +4,7 @@
 #include <fstream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
 #include <sstream>
 #include <vector>
 #include <cstdint>
@@ -25,6 +26,12 @@
 #include <TApplication.h>
 #include <TString.h>
 
+#include "GEMRaw.h"
+#include "GEMWriter.h"
+#include "GEMBlockFile.h"
+#include "GEMRunFile.h"
+#include "GEMDecoder.h"
+
 /**
 * ... Threshold Scan ROOT based application, could be used for analisys of XDAQ GEM data ...
 */
@@ -55,192 +62,25 @@
 
 using namespace std;
 
+int event_ = 0;
+int GEBDataEvent = 0;
+std::string outputType_ = "Hex";
+std::string outFileName_ = "DataParkerThreshold.dat";
+GEMWriter outWriter_;   // opened once in main(), see GEMWriter.h
+GEMBlockWriter* blockWriter_ = 0;   // --compress: a GEMBlockFile instead
+GEMRunWriter* runWriter_ = 0;       // --run: a GEMRunFile instead
+
 //! GEM VFAT2 Data class.
 /*!
   \brief GEMOnline
-  contents VFAT2 GEM data format 
+  ThresholdScan.dat records read from the hex file (GEMDecoder.h), written
+  out as GEB blocks in hex or binary
   \author Sergey.Baranov@cern.ch
 */
 
-int event_ = 0;
-int GEBDataEvent = 0;
-std::string outputType_ = "Hex";
-std::string outFileName_ = "DataParkerThreshold.dat";
-
-class GEMOnline {
+class GEMOnline : public GEMDecoder::Decoder<GEMDecoder::ThresholdScan, GEMDecoder::Hex> {
   public:
 
-      //! VFAT2 Channel data.
-      /*!
-        contents VFAT2 128 channels data in two 64 bits words.
-       */
-    
-      //! GEM Event Data Format (one chip data)
-      /*! 
-        Uncoding of VFAT2 data for one chip, data format.
-        \image html vfat2.data.format.png
-        \author Sergey.Baranov@cern.ch
-       */
-    
-      struct VFATData {
-        uint16_t BC;      /*!<Banch Crossing number "BC" 16 bits, : 1010:4 (control bits), BC:12 */
-        uint16_t EC;      /*!<Event Counter "EC" 16 bits: 1100:4(control bits) , EC:8, Flags:4 */
-        uint32_t bxExp;   
-        uint16_t bxNum;   /*!<Event Number & SBit, 16 bits : bxNum:6, SBit:6 */
-        uint16_t ChipID;  /*!<ChipID 16 bits, 1110:4 (control bits), ChipID:12 */
-        uint64_t lsData;  /*!<lsData value, bits from 1to64. */ 
-        uint64_t msData;  /*!<msData value, bits from 65to128. */
-        double delVT;     /*!<delVT = deviceVT2-deviceVT1, Threshold Scan needs this value. */
-        uint16_t crc;     /*!<Checksum number, CRC:16 */
-      };    
-    
-      //! Application header struct
-      /*!
-        \brief AppHeader contens Threshold scan parameters
-       */
-    
-      struct AppHeader {  
-        int minTh;     /*!<minTh minimal threshold value. */ 
-        int maxTh;     /*!<maxTh maximal threshold value. */ 
-        int stepSize;  /*!<stepSize threshold ste size value. */
-      };
-    
-      struct GEBData {
-        uint64_t header;      // ZSFlag:24 ChamID:12 
-        std::vector<VFATData> vfats;
-        uint64_t trailer;     // OHcrc: 16 OHwCount:16  ChamStatus:16
-      };
-
-      struct GEMData {
-        uint64_t header1;      // AmcNo:4      0000:4     LV1ID:24   BXID:12     DataLgth:20 
-        uint64_t header2;      // User:32      OrN:16     BoardID:16
-        uint64_t header3;      // DAVList:24   BufStat:24 DAVCount:5 FormatVer:3 MP7BordStat:8 
-        std::vector<GEBData> gebs;
-        uint64_t trailer2;     // EventStat:32 GEBerrFlag:24  
-        uint64_t trailer1;     // crc:32       LV1IDT:8   0000:4     DataLgth:20 
-      };
-
-      //! Print Event, "hex" format.
-      /*! 
-        Print VFAT2 event.
-       */
-    
-      //
-      // Useful printouts 
-      //
-      static void show4bits(uint8_t x) {
-        int i;
-        const unsigned long unit = 1;
-        for(i=(sizeof(uint8_t)*4)-1; i>=0; i--)
-          (x & ((unit)<<i))?putchar('1'):putchar('0');
-     	//printf("\n");
-      }
-
-      bool printVFATdata(int event, const VFATData& vfat){
-        if( event<0) return(false);
-          cout << "Received tracking data word:" << endl;
-          cout << "BC      :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.BC     << dec << endl;
-  	  cout << "EC      :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.EC     << dec << endl;
-          cout << "BxExp   :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.bxExp  << dec << endl; // do we need here?
-          cout << "BxNum   :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.bxNum  << dec << endl; // do we need here?
-  	  cout << "ChipID  :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.ChipID << dec << endl;
-          cout << "<127:64>:: 0x" << std::setfill('0') << std::setw(8) << hex << vfat.msData << dec << endl;
-          cout << "<63:0>  :: 0x" << std::setfill('0') << std::setw(8) << hex << vfat.lsData << dec << endl;
-          cout << "crc     :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.crc    << dec <<"\n"<< endl;
-        return(true);
-      };
-
-      static bool printVFATdataBits(int event, const VFATData& vfat){
-        if( event<0) return(false);
-	  cout << "\nReceived VFAT data word: event " << event << endl;
-  
-          uint8_t   b1010 = (0xf000 & vfat.BC) >> 12;
-          show4bits(b1010); cout << " BC     0x" << hex << (0x0fff & vfat.BC) << dec << endl;
-  
-          uint8_t   b1100 = (0xf000 & vfat.EC) >> 12;
-          uint16_t   EC   = (0x0ff0 & vfat.EC) >> 4;
-          uint8_t   Flag  = (0x000f & vfat.EC);
-          show4bits(b1100); cout << " EC     0x" << hex << EC << dec << endl; 
-          show4bits(Flag);  cout << " Flags " << endl;
-  
-          uint8_t   b1110 = (0xf000 & vfat.ChipID) >> 12;
-          uint16_t ChipID = (0x0fff & vfat.ChipID);
-          show4bits(b1110); cout << " ChipID 0x" << hex << ChipID << dec << " " << endl;
-  
-          cout << "     bxExp  0x" << std::setfill('0') << std::setw(4) << hex << vfat.bxExp << dec << " " << endl;
-  	  cout << "     bxNum  0x" << std::setfill('0') << std::setw(2) << hex << ((0xff00 & vfat.bxNum) >> 8) << dec << endl;
-  	  cout << "     SBit   0x" << std::setfill('0') << std::setw(2) << hex <<  (0x00ff & vfat.bxNum)       << dec << endl;
-          cout << " <127:64>:: 0x" << std::setfill('0') << std::setw(8) << hex << vfat.msData << dec << endl;
-          cout << " <63:0>  :: 0x" << std::setfill('0') << std::setw(8) << hex << vfat.lsData << dec << endl;
-          cout << "     crc    0x" << hex << vfat.crc << dec << endl;
-  
-          //cout << " " << endl; show16bits(vfat.EC);
-  
-          return(true);
-      };
-  
-      //! Print ChipID.
-      /*! 
-          Print ChipID "hex" number and control bits "1110"
-       */
-    
-      bool PrintChipID(int event, const VFATData& vfat){
-        if( event<0 ) return(false);
-          cout << "\nevent " << event << endl;
-          uint8_t bitsE = ((vfat.ChipID&0xF000)>>12);
-          showbits(bitsE);
-          cout << hex << "1110 0x0" << ((vfat.ChipID&0xF000)>>12) << " ChipID 0x" << (vfat.ChipID&0x0FFF) << dec << endl;
-      };
-    
-      //! Read 1-128 channels data
-      /*!
-        reading two 64 bits words (lsData & msData) with data from all channels for one VFAT2 chip 
-       */
-    
-      //! Read GEM event data
-      /*!
-        reading GEM VFAT2 data (BC,EC,bxNum,ChipID,(lsData & msData), crc.
-       */
-    
-      bool readEvent(ifstream& inpf, int event, VFATData& vfat){
-        if(event<0) return(false);
-          inpf >> hex >> vfat.BC;
-          inpf >> hex >> vfat.EC;
-          inpf >> hex >> vfat.bxExp;
-          inpf >> hex >> vfat.bxNum;
-          inpf >> hex >> vfat.ChipID;
-          inpf >> hex >> vfat.lsData;
-          inpf >> hex >> vfat.msData;
-          inpf >>        vfat.delVT;
-          inpf >> hex >> vfat.crc;
-        return(true);
-      };	  
-    
-      //! read Threshold scan header.
-      /*!
-        reading of Threshold Scan setup header
-       */
-    
-      bool readHeader(ifstream& inpf, AppHeader& ah){
-        inpf >> ah.minTh;
-        inpf >> ah.maxTh;
-        inpf >> ah.stepSize;
-        return(true);
-      };	  
-    
-
-      //! showbits function.
-      /*!
-       show bits function, needs for debugging
-       */
-    
-      static void showbits(uint8_t x)
-        { int i; 
-          for(i=(sizeof(uint8_t)*8)-1; i>=0; i--)
-            (x&(1<<i))?putchar('1'):putchar('0');
-          printf("\n");
-        };
-
       /*
        *  GEB Data Format
        *    geb.header
@@ -249,103 +89,164 @@ class GEMOnline {
        *
        */
 
-      static bool writeGEBheader(string file, int event, const GEBData& geb){
-        ofstream outf(file.c_str(), ios_base::app );
+      template <class Out> static bool writeGEBheader(Out& outf, int event, const GEBData& geb){
         if( event<0) return(false);
         if(!outf.is_open()) return(false);
-          outf << hex << geb.header << dec << endl;
-          outf.close();
-        return(true);
+          outf.hex(geb.header);
+        return(outf.ok());
       };	  
 
-      static bool writeGEBtrailer(string file, int event, const GEBData& geb){
-        ofstream outf(file.c_str(), ios_base::app );
+      template <class Out> static bool writeGEBtrailer(Out& outf, int event, const GEBData& geb){
         if( event<0) return(false);
         if(!outf.is_open()) return(false);
-          outf << hex << geb.trailer << dec << endl;
-          outf.close();
-        return(true);
+          outf.hex(geb.trailer);
+        return(outf.ok());
       };	  
 
-      static bool writeVFATdata(string file, int event, const VFATData& vfat){
-        ofstream outf(file.c_str(), ios_base::app );
+      template <class Out> static bool writeVFATdata(Out& outf, int event, const VFATData& vfat){
         if( event<0) return(false);
         if(!outf.is_open()) return(false);
-          outf << hex << vfat.BC << dec << endl;
-          outf << hex << vfat.EC << dec << endl;
-          outf << hex << vfat.ChipID << dec << endl;
-          outf << hex << vfat.lsData << dec << endl;
-          outf << hex << vfat.msData << dec << endl;
-          outf << hex << vfat.crc << dec << endl;
-          outf.close();
-        return(true);
+          outf.hex(vfat.BC);
+          outf.hex(vfat.EC);
+          outf.hex(vfat.ChipID);
+          outf.hex(vfat.lsData);
+          outf.hex(vfat.msData);
+          outf.hex(vfat.crc);
+        return(outf.ok());
       };	  
 
-      static bool writeGEBheaderBinary(string file, int event, const GEBData& geb){
-        ofstream outf(file.c_str(), ios_base::app | ios::binary );
+      template <class Out> static bool writeGEBheaderBinary(Out& outf, int event, const GEBData& geb){
         if( event<0) return(false);
         if(!outf.is_open()) return(false);
-  	  outf.write( (char*)&geb.header, sizeof(geb.header));
-          outf.close();
-        return(true);
+  	  outf.binary(geb.header);
+        return(outf.ok());
       };
 	  
-      static bool writeGEBtrailerBinary(string file, int event, const GEBData& geb){
-        ofstream outf(file.c_str(), ios_base::app | ios::binary );
+      template <class Out> static bool writeGEBtrailerBinary(Out& outf, int event, const GEBData& geb){
         if( event<0) return(false);
         if(!outf.is_open()) return(false);
-  	  outf.write( (char*)&geb.trailer, sizeof(geb.trailer));
-          outf.close();
-        return(true);
+  	  outf.binary(geb.trailer);
+        return(outf.ok());
       };
 
-      static bool writeVFATdataBinary(string file, int event, const VFATData& vfat){
-        ofstream outf(file.c_str(), ios_base::app | ios::binary );
+      template <class Out> static bool writeVFATdataBinary(Out& outf, int event, const VFATData& vfat){
         if( event<0) return(false);
         if(!outf.is_open()) return(false);
-  	  outf.write( (char*)&vfat.BC, sizeof(vfat.BC));
-  	  outf.write( (char*)&vfat.EC, sizeof(vfat.EC));
-  	  outf.write( (char*)&vfat.ChipID, sizeof(vfat.ChipID));
-  	  outf.write( (char*)&vfat.lsData, sizeof(vfat.lsData));  
-  	  outf.write( (char*)&vfat.msData, sizeof(vfat.msData));
-  	  outf.write( (char*)&vfat.crc, sizeof(vfat.crc));
-          outf.close();
-        return(true);
+          // one 24 bytes record (GEMRaw layout) instead of six small writes
+          unsigned char rec[GEMRaw::kVFATSize];
+          GEMRaw::store16(rec + GEMRaw::kBCOffset,     vfat.BC);
+          GEMRaw::store16(rec + GEMRaw::kECOffset,     vfat.EC);
+          GEMRaw::store16(rec + GEMRaw::kChipIDOffset, vfat.ChipID);
+          GEMRaw::store64(rec + GEMRaw::kLsDataOffset, vfat.lsData);
+          GEMRaw::store64(rec + GEMRaw::kMsDataOffset, vfat.msData);
+          GEMRaw::store16(rec + GEMRaw::kCrcOffset,    vfat.crc);
+  	  outf.put(rec, sizeof(rec));
+        return(outf.ok());
       };	  
 
-      static void writeGEMevent(GEMData& gem, GEBData& geb, VFATData& vfat)
+      //! Streaming regrouping of VFAT records into GEB blocks.
+      /*!
+        \brief GEBRegroup
+        VFATs are kept in a fixed ring of kRing records; the block being
+        formed is fSize records from fFirst. A closed block is written
+        straight out of the ring and the next one starts behind it, nothing
+        is shifted or reallocated. A block is closed
+          kCount:  after count VFATs,
+          kChipID: before a ChipID which the block already has, or once it
+                   has every ChipID of the set (VFATs of other chips are dropped),
+          kEC:     before a VFAT with another EC,
+        and always at GEMRaw::kMaxVFAT VFATs (one ZSFlag bit per slot).
+       */
+
+      class GEBRegroup {
+        public:
+
+          enum Policy { kCount, kChipID, kEC };
+          enum { kRing = 32, kMask = kRing - 1 };
+
+          GEBRegroup(Policy policy = kCount, int count = GEMRaw::kMaxVFAT)
+            : nBlocks(0), nDropped(0), fPolicy(policy), fFirst(0), fSize(0), fNeed(0) {
+            fCount = (count > 0 && count <= (int)GEMRaw::kMaxVFAT) ? count : GEMRaw::kMaxVFAT;
+          }
+
+          //! kChipID: the chips of one GEB, an empty set means any chips, each once.
+          void AddChipID(uint16_t id) {
+            if (!fSet[id & 0x0fff]) fNeed++;
+            fSet.set(id & 0x0fff);
+          }
+
+          int size() const { return fSize; }
+          const VFATData& operator[](int i) const { return fRing[(fFirst + i) & kMask]; }
+
+          //! Add one VFAT, emit(*this) is called for every block closed by it.
+          template <class F> void add(const VFATData& v, F emit) {
+            uint16_t id = v.ChipID & 0x0fff;
+            if (fPolicy == kChipID) {
+              if (fNeed && !fSet[id]) { nDropped++; return; }
+              if (fHave[id]) close(emit);
+            } else if (fPolicy == kEC) {
+              if (fSize && ((v.EC ^ (*this)[0].EC) & 0x0ff0)) close(emit);
+            }
+            fRing[(fFirst + fSize) & kMask] = v;
+            fSize++;
+            fHave.set(id);
+            if ((fPolicy == kCount && fSize == fCount)
+                || (fPolicy == kChipID && fNeed && (int)fHave.count() == fNeed)
+                || fSize == (int)GEMRaw::kMaxVFAT) close(emit);
+          }
+
+          //! Emit the last, incomplete block.
+          template <class F> void flush(F emit) { close(emit); }
+
+          uint64_t nBlocks;    /*!<GEB blocks emitted */
+          uint64_t nDropped;   /*!<VFATs not in the ChipID set */
+
+        private:
+
+          template <class F> void close(F emit) {
+            if (!fSize) return;
+            emit(*this);
+            nBlocks++;
+            fFirst = (fFirst + fSize) & kMask;
+            fSize = 0;
+            fHave.reset();
+          }
+
+          Policy fPolicy;
+          int fCount;
+          VFATData fRing[kRing];
+          int fFirst, fSize;
+          std::bitset<4096> fSet, fHave;
+          int fNeed;
+      };
+
+      //! Write one GEB block: header, the VFATs of the block, trailer, to a GEMWriter, GEMBlockWriter or GEMRunWriter.
+      template <class Out> static bool writeGEMevent(Out& out, GEBData& geb, const GEBRegroup& block, bool print)
       {
         // GEB data level
         if(outputType_ == "Hex"){
-          writeGEBheader (outFileName_, event_, geb);
+          writeGEBheader (out, event_, geb);
         } else {
-          writeGEBheaderBinary (outFileName_, event_, geb);
+          writeGEBheaderBinary (out, event_, geb);
         } 
           
-        int nChip=0;
-        for (vector<VFATData>::iterator iVFAT=geb.vfats.begin(); iVFAT != geb.vfats.end(); ++iVFAT){
-          nChip++;
-          vfat.BC     = (*iVFAT).BC;
-          vfat.EC     = (*iVFAT).EC;
-          vfat.ChipID = (*iVFAT).ChipID;
-          vfat.lsData = (*iVFAT).lsData;
-          vfat.msData = (*iVFAT).msData;
-          vfat.crc    = (*iVFAT).crc;
-            
+        for (int nChip=1; nChip <= block.size(); nChip++){
+          const VFATData& vfat = block[nChip-1];
           if(outputType_ == "Hex"){
-            writeVFATdata (outFileName_, nChip, vfat); 
+            writeVFATdata (out, nChip, vfat); 
           } else {
-            writeVFATdataBinary (outFileName_, nChip, vfat);
+            writeVFATdataBinary (out, nChip, vfat);
           } 
-          printVFATdataBits(nChip, vfat);
+          if(print) printVFATdataBits(nChip, vfat);
         } //end of VFAT
       
         if(outputType_ == "Hex"){
-          writeGEBtrailer (outFileName_, event_, geb);
+          writeGEBtrailer (out, event_, geb);
         } else {
-          writeGEBtrailerBinary (outFileName_, event_, geb);
+          writeGEBtrailerBinary (out, event_, geb);
         } 
-        /* } // end of GEB */
+        // whole GEB blocks only reach the file
+        return(out.endBlock());
       }
       
 };
@@ -368,10 +269,70 @@ TFile* thldread(Int_t get=0)
 #endif
 { cout<<"---> Main()"<<endl;
 
+  // -o file:        output file (DataParkerThreshold.dat), appended to as before
+  // --binary:       binary GEB/VFAT output (GEMRaw.h) instead of hex
+  // --prealloc MB:  reserve disk space for the output ahead, in steps of MB
+  // --compress C:   write a GEMBlockFile (GEMBlockFile.h) compressed with zlib,
+  //                 lz4 or zstd (if built in), vfat or vfat+zlib (GEMVFATCodec.h,
+  //                 with --binary only), blocks of --block-size MB (1);
+  //                 the file is rewritten, not appended to
+  // --run N:        write run N as a GEMRunFile (GEMRunFile.h): binary GEB blocks
+  //                 in checksummed blocks after a run header with the date,
+  //                 the scan header and the delVT of every VFAT; appended to
+  // --group N:      GEB blocks of N VFATs (24, at most 24)
+  // --group chip[:id,id,...]: one VFAT per chip in a block, with a set of
+  //                 hex ChipIDs a block is complete when it has all of them
+  // --group ec:     a new GEB block on every change of EC
+  double preallocMB = 0., blockMB = 1.;
+  string compress;
+  int runNumber = -1;
+  GEMOnline::GEBRegroup regroup;
+  for(int i=1; i<argc; i++){
+    string a = argv[i];
+    if(a == "--group" && i+1<argc){
+      string g = argv[++i];
+      if(g == "ec") regroup = GEMOnline::GEBRegroup(GEMOnline::GEBRegroup::kEC);
+      else if(g.compare(0, 4, "chip") == 0){
+        regroup = GEMOnline::GEBRegroup(GEMOnline::GEBRegroup::kChipID);
+        stringstream ids(g.size() > 5 ? g.substr(5) : "");
+        string id;
+        while(getline(ids, id, ',')) regroup.AddChipID(strtoul(id.c_str(), 0, 16));
+      }
+      else regroup = GEMOnline::GEBRegroup(GEMOnline::GEBRegroup::kCount, atoi(g.c_str()));
+    }
+    if(a == "-o" && i+1<argc) outFileName_ = argv[++i];
+    if(a == "--binary") outputType_ = "Binary";
+    if(a == "--prealloc" && i+1<argc) preallocMB = atof(argv[++i]);
+    if(a == "--compress" && i+1<argc) compress = argv[++i];
+    if(a == "--block-size" && i+1<argc) blockMB = atof(argv[++i]);
+    if(a == "--run" && i+1<argc) runNumber = atoi(argv[++i]);
+  }
+
 #ifndef __CINT__
   TApplication App("App", &argc, argv);
 #endif
 
+  if(runNumber >= 0){
+    // opened once the scan header is read
+    outputType_ = "Binary";
+    runWriter_ = new GEMRunWriter();
+  } else if(!compress.empty()){
+    int codec = GEMBlockFile::codecByName(compress);
+    if(codec < 0){
+      cout << "\nUnknown or not built in compression " << compress << "\n" << endl;
+      return 0;
+    }
+    blockWriter_ = new GEMBlockWriter();
+    if(!blockWriter_->open(outFileName_, codec, outputType_ == "Hex" ? GEMBlockFile::kHex : GEMBlockFile::kBinary,
+                           (size_t)(blockMB*(1<<20)))){
+      cout << "\nCannot open the output " << blockWriter_->error << "\n" << endl;
+      return 0;
+    }
+  } else if(!outWriter_.open(outFileName_, true, (int64_t)(preallocMB*(1<<20)))){
+    cout << "\nCannot open the output " << outWriter_.error << "\n" << endl;
+    return 0;
+  }
+
   GEMOnline data;
   GEMOnline::AppHeader  ah;
   GEMOnline::VFATData vfat;
@@ -400,6 +361,20 @@ TFile* thldread(Int_t get=0)
 
   cout << " minTh " << ah.minTh << " maxTh " << ah.maxTh << " nBins " << nBins << endl;
 
+  if(runWriter_){
+    GEMRunFile::RunHeader run;
+    run.flags    = GEMRunFile::kDelVT;
+    run.run      = runNumber;
+    run.minTh    = ah.minTh;
+    run.maxTh    = ah.maxTh;
+    run.stepSize = ah.stepSize;
+    run.Now();
+    if(!runWriter_->open(outFileName_, run, true, (size_t)(blockMB*(1<<20)))){
+      cout << "\nCannot open the output " << runWriter_->error << "\n" << endl;
+      return 0;
+    }
+  }
+
   TH1F* histo = new TH1F("allchannels", "Threshold scan for all channels", nBins, (Double_t)ah.minTh-0.5,(Double_t)ah.maxTh+0.5 );
 
   histo->SetFillColor(48);
@@ -430,14 +405,45 @@ TFile* thldread(Int_t get=0)
   }
 
   Int_t ieventMax=90000, LastEvent=0;
-  const Int_t kUPDATE1 = 23, kUPDATE2 = 3000;
+  const Int_t kUPDATE2 = 3000;
+
+  // GEB blocks are formed by GEBRegroup and written as soon as they close
+  auto emit = [&](const GEMOnline::GEBRegroup& block){
+      GEBDataEvent++;
+
+      // Chamber Header, Zero Suppression flags, Chamber ID
+      uint64_t ZSFlag  = 0;                                         // :24
+      for (int IndexVFATChipOnGEB = 0; IndexVFATChipOnGEB < block.size(); IndexVFATChipOnGEB++)
+        ZSFlag |= (1ULL << (23-IndexVFATChipOnGEB));
+      uint64_t ChamID  = 0xdea;                                     // :12
+      uint64_t sumVFAT = block.size();                              // :28
+      geb.header  = (ZSFlag << 40)|(ChamID << 28)|(sumVFAT);
+
+      // Chamber Trailer, OptoHybrid: crc, wordcount, Chamber status
+      uint64_t OHcrc       = BOOST_BINARY( 1 ); // :16
+      uint64_t OHwCount    = BOOST_BINARY( 1 ); // :16
+      uint64_t ChamStatus  = BOOST_BINARY( 1 ); // :16
+      geb.trailer = ((OHcrc << 48)|(OHwCount << 32 )|(ChamStatus << 16));
+
+      bool print = (event_ < ieventPrint);
+      if(print){
+        cout << "event " << event_ << " sumVFAT " << sumVFAT << " GEBDataEvent " << GEBDataEvent << endl;
+      }
+      if(runWriter_){
+        for (int i = 0; i < block.size(); i++) runWriter_->delVT(block[i].delVT);
+        GEMOnline::writeGEMevent(*runWriter_, geb, block, print);
+      }
+      else if(blockWriter_) GEMOnline::writeGEMevent(*blockWriter_, geb, block, print);
+      else GEMOnline::writeGEMevent(outWriter_, geb, block, print);
+  };
 
   for(int ievent=0; ievent<ieventMax; ievent++){
     if(inpf.eof()) break;
     if(!inpf.good()) break;
 
-    LastEvent=ievent;
     data.readEvent(inpf, ievent, vfat);
+    if(inpf.fail()) break;
+    LastEvent=ievent;
 
     if(ievent <= ieventPrint){
       //data.printVFATdataBits(ievent, vfat);
@@ -448,7 +454,7 @@ TFile* thldread(Int_t get=0)
 
     histo->Fill(vfat.delVT, (vfat.lsData||vfat.msData));
 
-    //I think it would be nice to time this...
+    // timed by gem-benchmark.cc (channelBits, histFill)
     for (int chan = 0; chan < 128; ++chan) {
       if (chan < 64)
 	histos[chan]->Fill(vfat.delVT,((vfat.lsData>>chan))&0x1);
@@ -460,50 +466,9 @@ TFile* thldread(Int_t get=0)
     * Keeping GEM events
     */
 
-    geb.vfats.push_back(vfat);
-
-    if (ievent%kUPDATE1 == 0 && ievent != 0) {
-      GEBDataEvent++;
-
-      // Chamber Header, Zero Suppression flags, Chamber ID
-      int IndexVFATChipOnGEB = 0; 
-      uint64_t ZSFlag  = (ZSFlag | (1 << (23-IndexVFATChipOnGEB))); // :24
-      uint64_t ChamID  = 0xdea;                                     // :12
-      uint64_t sumVFAT = int(geb.vfats.size());                     // :28, geb.vfats.size was placed a very temporary here !!!
-    
-      geb.header  = (ZSFlag << 40)|(ChamID << 28)|(sumVFAT);
-        if(outputType_ == "Hex"){
-        GEMOnline::writeGEBheader (outFileName_, event_, geb);
-      } else {
-        GEMOnline::writeGEBheaderBinary (outFileName_, event_, geb);
-      } 
-
-      if(ievent < ieventPrint){
-        cout << "event " << ievent << " ievent%kUPDATE1 " << ievent%kUPDATE1 << " sumVFAT " << sumVFAT+1 << " GEBDataEvent " << GEBDataEvent << endl;
-      }
-      event_=ievent;
-
-      // GEB data level
-      GEMOnline::writeGEMevent(gem, geb, vfat);
-      geb.vfats.erase (geb.vfats.begin(),geb.vfats.begin()+kUPDATE1);
-      //cout << " geb.vfats.erase " << geb.vfats.size() << endl;
-
-      // Chamber Trailer, OptoHybrid: crc, wordcount, Chamber status
-      uint64_t OHcrc       = BOOST_BINARY( 1 ); // :16
-      uint64_t OHwCount    = BOOST_BINARY( 1 ); // :16
-      uint64_t ChamStatus  = BOOST_BINARY( 1 ); // :16
-      geb.trailer = ((OHcrc << 48)|(OHwCount << 32 )|(ChamStatus << 16));
-    
-      OHcrc      = (0xffff000000000000 & geb.trailer) >> 48; 
-      OHwCount   = (0x0000ffff00000000 & geb.trailer) >> 32; 
-      ChamStatus = (0x00000000ffff0000 & geb.trailer) >> 16;
-    
-      if(outputType_ == "Hex"){
-        GEMOnline::writeGEBtrailer (outFileName_, event_, geb);
-      } else {
-        GEMOnline::writeGEBtrailerBinary (outFileName_, event_, geb);
-      } 
-    }
+    event_=ievent;
+    regroup.add(vfat, emit);
+    if(!(runWriter_ ? runWriter_->ok() : blockWriter_ ? blockWriter_->ok() : outWriter_.ok())) break;
 
     if (ievent%kUPDATE2 == 0 && ievent != 0) {
       c1->cd(1);
@@ -511,9 +476,28 @@ TFile* thldread(Int_t get=0)
       c1->Update();
     }
   }//end loop for events
+  regroup.flush(emit);
   cout << "\n The Last Event is  " << LastEvent+1 << endl;
+  cout << " " << regroup.nBlocks << " GEB blocks";
+  if(regroup.nDropped) cout << ", " << regroup.nDropped << " VFATs of other chips dropped";
+  cout << endl;
   inpf.close();
 
+  if(runWriter_){
+    if(!runWriter_->close()) cout << "\n Output " << outFileName_ << ": " << runWriter_->error << endl;
+    cout << " run " << runNumber << ": " << runWriter_->nEvents << " GEB blocks in " << runWriter_->nBlocks << " blocks, "
+         << runWriter_->bytes() << " bytes written to " << outFileName_ << endl;
+    delete runWriter_;
+  } else if(blockWriter_){
+    if(!blockWriter_->close()) cout << "\n Output " << outFileName_ << ": " << blockWriter_->error << endl;
+    cout << " " << blockWriter_->nRaw << " bytes in " << blockWriter_->nBlocks << " " << compress << " blocks, "
+         << blockWriter_->bytes() << " bytes written to " << outFileName_ << endl;
+    delete blockWriter_;
+  } else {
+    if(!outWriter_.close()) cout << "\n Output " << outFileName_ << ": " << outWriter_.error << endl;
+    cout << " " << outWriter_.nBytes << " bytes written to " << outFileName_ << " in " << outWriter_.nWrites << " writes" << endl;
+  }
+
   // Save all objects in this file
   hfile->Write();
   cout<<"=== hfile->Write()"<<endl;
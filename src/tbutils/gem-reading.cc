@@ -4,11 +4,13 @@
 #include <fstream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
 #include <sstream>
 #include <vector>
 #include <cstdint>
 
 #include <TFile.h>
+#include <TKey.h>
 #include <TNtuple.h>
 #include <TH2.h>
 #include <TProfile.h>
@@ -21,11 +23,33 @@
 #include <TInterpreter.h>
 #include <TApplication.h>
 #include <TString.h>
+#include <TVirtualPad.h>
+#include <THttpServer.h>
+#include <RVersion.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
 #if defined(__CINT__) && !defined(__MAKECINT__)
 #include "libEvent.so"
 #else
 #include "Event.h"
 #endif
+#include "GEMRaw.h"
+#include "GEMResync.h"
+#include "GEMCrc.h"
+#include "GEMTelemetry.h"
+#include "GEMDisplay.h"
+#include "GEMFollow.h"
+#include "GEMSocket.h"
+#include "GEMShmRing.h"
+#include "GEMBlockFile.h"
+#include "GEMView.h"
+#include "GEMCatalog.h"
+#include "GEMSampler.h"
+#include "GEMTrace.h"
+#include "GEMDecoder.h"
 /**
 * ... Threshold Scan ROOT based application, could be used for analisys of XDAQ GEM data ...
 */
@@ -59,231 +83,84 @@ using namespace std;
 //! GEM VFAT2 Data class.
 /*!
   \brief GEMOnline
-  contents VFAT2 GEM data format 
+  GEB blocks of DataParker.dat read from the hex file, or decoded in place
+  from binary memory, see GEMDecoder.h
   \author Sergey.Baranov@cern.ch
 */
 
-class GEMOnline {
+class GEMOnline : public GEMDecoder::Decoder<GEMDecoder::GEBFramed, GEMDecoder::Hex> {
   public:
 
-      //! VFAT2 Channel data.
-      /*!
-        contents VFAT2 128 channels data in two 64 bits words.
-       */
-    
-      //! GEM Event Data Format (one chip data)
-      /*! 
-        Uncoding of VFAT2 data for one chip, data format.
-        \image html vfat2.data.format.png
-        \author Sergey.Baranov@cern.ch
-       */
-    
-      struct VFATData {
-        uint16_t BC;      /*!<Banch Crossing number "BC" 16 bits, : 1010:4 (control bits), BC:12 */
-        uint16_t EC;      /*!<Event Counter "EC" 16 bits: 1100:4(control bits) , EC:8, Flag:4 */
-        uint32_t bxExp;   
-        uint16_t bxNum;   /*!<Event Number & SBit, 16 bits : bxNum:6, SBit:6 */
-        uint16_t ChipID;  /*!<ChipID 16 bits, 1110:4 (control bits), ChipID:12 */
-        uint64_t lsData;  /*!<lsData value, bits from 1to64. */ 
-        uint64_t msData;  /*!<msData value, bits from 65to128. */
-        uint16_t crc;     /*!<Checksum number, CRC:16 */
-      };    
-    
-      struct GEBData {
-        uint64_t header;      // ZSFlag:24 ChamID:12 
-        std::vector<VFATData> vfats;
-        uint64_t trailer;     // OHcrc: 16 OHwCount:16  ChamStatus:16
-      };
+      typedef GEMDecoder::Decoder<GEMDecoder::GEBFramed, GEMDecoder::Binary> BinaryDecoder;
 
-      struct GEMData {
-        uint64_t header1;      // AmcNo:4      0000:4     LV1ID:24   BXID:12     DataLgth:20 
-        uint64_t header2;      // User:32      OrN:16     BoardID:16
-        uint64_t header3;      // DAVList:24   BufStat:24 DAVCount:5 FormatVer:3 MP7BordStat:8 
-        std::vector<GEBData> gebs;
-        uint64_t trailer2;     // EventStat:32 GEBerrFlag:24  
-        uint64_t trailer1;     // crc:32       LV1IDT:8   0000:4     DataLgth:20 
-      };
+      //! The whole binary GEB block at the reader position, 0 if its header is wrong or the data ends.
+      const unsigned char* peekGEBbinary(GEMSocketReader& in){ return(BinaryDecoder::peekGEB(in)); };
 
-      //! Print Event, "hex" format.
-      /*! 
-        Print VFAT2 event.
-       */
-    
-      //
-      // Useful printouts 
-      //
-      void show4bits(uint8_t x) {
-        int i;
-        const unsigned long unit = 1;
-        for(i=(sizeof(uint8_t)*4)-1; i>=0; i--)
-          (x & ((unit)<<i))?putchar('1'):putchar('0');
-     	//printf("\n");
-      }
+      //! Decode the binary GEB block at p, its header is already checked.
+      void decodeGEB(const unsigned char* p, GEBData& geb){ BinaryDecoder::decodeGEB(p, geb); };
 
-      bool printVFATdata(int event, const VFATData& vfat){
-        if( event<0) return(false);
-          cout << "Received tracking data word:" << endl;
-          cout << "BC      :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.BC     << dec << endl;
-  	  cout << "EC      :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.EC     << dec << endl;
-	  /*
-          cout << "BxExp   :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.bxExp  << dec << endl; // do we need here?
-          cout << "BxNum   :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.bxNum  << dec << endl; // do we need here?
-          */
-  	  cout << "ChipID  :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.ChipID << dec << endl;
-          cout << "<127:64>:: 0x" << std::setfill('0') << std::setw(8) << hex << vfat.msData << dec << endl;
-          cout << "<63:0>  :: 0x" << std::setfill('0') << std::setw(8) << hex << vfat.lsData << dec << endl;
-          cout << "crc     :: 0x" << std::setfill('0') << std::setw(4) << hex << vfat.crc    << dec <<"\n"<< endl;
-        return(true);
-      };
-
-      bool printVFATdataBits(int event, int ivfat, const VFATData& vfat){
-          if( event<0) return(false);
-	  cout << "\nReceived VFAT data word: event " << event << " ivfat  " << ivfat << endl;
-  
-          uint8_t   b1010 = (0xf000 & vfat.BC) >> 12;
-          show4bits(b1010); cout << " BC     0x" << hex << (0x0fff & vfat.BC) << dec << endl;
-  
-          uint8_t   b1100 = (0xf000 & vfat.EC) >> 12;
-          uint16_t   EC   = (0x0ff0 & vfat.EC) >> 4;
-          uint8_t   Flag  = (0x000f & vfat.EC);
-          show4bits(b1100); cout << " EC     0x" << hex << EC << dec << endl; 
-          show4bits(Flag);  cout << " Flag  " << endl;
-  
-          uint8_t   b1110 = (0xf000 & vfat.ChipID) >> 12;
-          uint16_t ChipID = (0x0fff & vfat.ChipID);
-          show4bits(b1110); cout << " ChipID 0x" << hex << ChipID << dec << " " << endl;
-	  /*
-          cout << "     bxExp  0x" << std::setfill('0') << std::setw(4) << hex << vfat.bxExp << dec << " " << endl;
-  	  cout << "     bxNum  0x" << std::setfill('0') << std::setw(2) << hex << ((0xff00 & vfat.bxNum) >> 8) << dec << endl;
-  	  cout << "     SBit   0x" << std::setfill('0') << std::setw(2) << hex <<  (0x00ff & vfat.bxNum)       << dec << endl;
-	  */
-          cout << " <127:64>:: 0x" << std::setfill('0') << std::setw(8) << hex << vfat.msData << dec << endl;
-          cout << " <63:0>  :: 0x" << std::setfill('0') << std::setw(8) << hex << vfat.lsData << dec << endl;
-          cout << "     crc    0x" << hex << vfat.crc << dec << endl;
-  
-          //cout << " " << endl; show16bits(vfat.EC);
-  
-          return(true);
-      };
-  
-      //! Print ChipID.
-      /*! 
-          Print ChipID "hex" number and control bits "1110"
-       */
-    
-      bool PrintChipID(int event, const VFATData& vfat){
-        if( event<0 ) return(false);
-          cout << "\nevent " << event << endl;
-          uint8_t bitsE = ((vfat.ChipID&0xF000)>>12);
-          showbits(bitsE);
-          cout << hex << "1110 0x0" << ((vfat.ChipID&0xF000)>>12) << " ChipID 0x" << (vfat.ChipID&0x0FFF) << dec << endl;
-      };
-    
-      //! showbits function.
-      /*!
-       show bits function, needs for debugging
-       */
-    
-      void showbits(uint8_t x)
-        { int i; 
-          for(i=(sizeof(uint8_t)*8)-1; i>=0; i--)
-            (x&(1<<i))?putchar('1'):putchar('0');
-          printf("\n");
-        };
-
-      bool readGEBheader(ifstream& inpf, GEBData& geb){
-	inpf >> hex >> geb.header;
-        return(true);
-      };	  
-
-      bool printGEBheader(const GEBData& geb){
-	cout << hex << geb.header << " ChamID " << ((0x000000fff0000000 & geb.header) >> 28) 
-             << dec << " sumVFAT " << (0x000000000fffffff & geb.header) << endl;
-        return(true);
-      };	  
-
-      bool readGEBtrailer(ifstream& inpf, GEBData& geb){
- 	inpf >> hex >> geb.trailer;
-        return(true);
-      };	  
-
-      bool printGEBtrailer(const GEBData& geb){
-        uint64_t OHcrc      = (0xffff000000000000 & geb.trailer) >> 48; 
-        uint64_t OHwCount   = (0x0000ffff00000000 & geb.trailer) >> 32; 
-        uint64_t ChamStatus = (0x00000000ffff0000 & geb.trailer) >> 16;
-        cout << "GEM Camber Treiler: OHcrc " << hex << OHcrc << " OHwCount " << OHwCount << " ChamStatus " << ChamStatus << dec 
-             << endl;
-        return(true);
-      };	  
-
-      //! Read 1-128 channels data
-      /*!
-        reading two 64 bits words (lsData & msData) with data from all channels for one VFAT2 chip 
-       */
-    
-      //! Read GEM event data
-      /*!
-        reading GEM VFAT2 data (BC,EC,bxNum,ChipID,(lsData & msData), crc.
-       */
-    
-      bool readEvent(ifstream& inpf, int event, VFATData& vfat){
-        if(event<0) return(false);
-          inpf >> hex >> vfat.BC;
-          inpf >> hex >> vfat.EC;
-          /* inpf >> hex >> vfat.bxExp;
-          inpf >> hex >> vfat.bxNum;
-          */
-	  inpf >> hex >> vfat.ChipID;
-          inpf >> hex >> vfat.lsData;
-          inpf >> hex >> vfat.msData;
-          inpf >> hex >> vfat.crc;
-        return(true);
-      };	  
-
-};// end of GEMOnline
-
-/*
- *  CRC ******************************************************************
- */
-      uint16_t dataVFAT[11];
-      uint16_t crc_calc(uint16_t crc_in, uint16_t dato){
-      uint16_t v = 0x0001;
-      uint16_t mask = 0x0001;    
-      bool d=0;
-      uint16_t crc_temp = crc_in;
-      unsigned char datalen = 16;
-       
-      for (int i=0; i<datalen; i++){
-        if (dato & v) d = 1;
-        else d = 0;
-        if ((crc_temp & mask)^d) crc_temp = crc_temp>>1 ^ 0x8408;
-        else crc_temp = crc_temp>>1;
-        v<<=1;
-      }
-      return(crc_temp);
-    }
-
-    // unsigned short int 
-    uint16_t checkCRC(bool OKprint){
-      uint16_t crc_fin = 0xffff;
-      for (int i = 11; i >= 1; i--){
-        crc_fin = crc_calc(crc_fin, dataVFAT[i]);
-	if(OKprint){
+      //! Print the bit serial CRC of a VFAT2 word after each of its eleven 16 bits words, returns the CRC.
+      static uint16_t printCRC(const VFATData& vfat){
+        uint16_t dataVFAT[12] = { 0,
+          (uint16_t)(vfat.lsData),       (uint16_t)(vfat.lsData >> 16), (uint16_t)(vfat.lsData >> 32), (uint16_t)(vfat.lsData >> 48),
+          (uint16_t)(vfat.msData),       (uint16_t)(vfat.msData >> 16), (uint16_t)(vfat.msData >> 32), (uint16_t)(vfat.msData >> 48),
+          vfat.ChipID, vfat.EC, vfat.BC };
+        uint16_t crc_fin = 0xffff;
+        for (int i = 11; i >= 1; i--){
+          crc_fin = GEMCrc::crc_calc(crc_fin, dataVFAT[i]);
           cout << " dataVFAT[" << std::setfill('0') << std::setw(2) << i << "] " << hex << std::setfill('0') << std::setw(4) << dataVFAT[i]
                << " crc_temp " << std::setfill('0') << std::setw(4) << crc_fin << dec << endl;
         }
-      }
-      return(crc_fin);
-    }
+        return(crc_fin);
+      };
+
+};// end of GEMOnline
 
     // Ok printing
     bool OKprint(int ievent, int iMaxPrint ){
-      if( ievent <= iMaxPrint ){
+      if( ievent < iMaxPrint ){
         return (true);
       } else { 
         return (false);
       }
     }
+
+//! Where the reading of an input got to, the title of the "Checkpoint" object of DQMlight.root.
+/*!
+  Written with the histograms and trees, so the file holds them as they
+  were at that point of the input; --resume continues from there.
+*/
+struct Checkpoint {
+  int64_t  offset;      /*!<byte of the next GEB block in the file, next GEB block of --blocks, -1 for a socket or shm */
+  int      event;       /*!<ievent to continue with */
+  uint64_t deselected;  /*!<GEB blocks skipped by --chip */
+  int64_t  skipped;     /*!<bytes skipped by resync */
+  string   catalog;     /*!<GEMCatalogBuilder::state() with --catalog, empty otherwise */
+  string   input;       /*!<file, block file, socket or shm name */
+  Checkpoint() : offset(-1), event(0), deselected(0), skipped(0) {}
+
+  string str() const {
+    stringstream s;
+    s << "offset " << offset << " event " << event << " deselected " << deselected << " skipped " << skipped;
+    if(!catalog.empty()) s << " catalog " << catalog;
+    s << " input " << input;
+    return s.str();
+  }
+
+  bool parse(const string& title) {
+    stringstream s(title);
+    string key;
+    while(s >> key){
+      if(key == "offset") s >> offset;
+      else if(key == "event") s >> event;
+      else if(key == "deselected") s >> deselected;
+      else if(key == "skipped") s >> skipped;
+      else if(key == "catalog") s >> catalog;
+      else if(key == "input") { s >> ws; getline(s, input); }
+    }
+    return !input.empty();
+  }
+};
     
 
 //! root function.
@@ -304,8 +181,86 @@ TFile* thldread(Int_t get=0)
 #endif
 { cout<<"---> Main()"<<endl;
 
+  // -b or --batch: headless, no TCanvas and no TApplication::Run
+  // --no-resync:   stop at the first corrupted GEB block instead of skipping it
+  // --http port:   serve the histogram snapshots on http://localhost:port
+  // -f or --follow: keep reading DataParker.dat while the DAQ writes it,
+  //                 stop after --idle seconds (300) without new data,
+  //                 DQMlight.root is rewritten every --flush seconds (30)
+  // --socket addr:  binary GEB blocks from unix:/path, tcp:[host:]port,
+  //                 unixgram:/path or udp:[host:]port instead of the file
+  // --shm name:     binary GEB blocks from a shared memory ring (GEMShmRing)
+  //                 of --shm-size MB (64), filled by a DAQ or gem-replay
+  // --blocks file:  a compressed GEMBlockFile (gem-re-write --compress, gem-convert
+  //                 -compress), from GEB block --first (0) on
+  // --chip id,...:  only the VFATs with these ChipIDs (hex), GEB blocks without
+  //                 any are skipped; binary blocks are selected on their raw
+  //                 ChipID words (GEMView) before they are decoded
+  // --catalog file: append the summary of this run to a run catalog (GEMCatalog,
+  //                 gem-catalog queries it) as run --run N
+  // --checkpoint s: write DQMlight.root every s seconds with the position of the
+  //                 input in it (a "Checkpoint" object), not only at the end
+  // --resume:       continue from the checkpoint of DQMlight.root: its histograms
+  //                 and trees are filled on, the file or --blocks input is read
+  //                 from where the checkpoint was written; with --catalog the
+  //                 catalog counters of the checkpoint are continued as well
+  // --prescale n:   load shedding, the histograms and GEMtree get 1 of every n GEB
+  //                 blocks, filled with weight n; the error counters get all of them
+  // --sample k:     the same with k GEB blocks per --sample-window seconds (1), chosen
+  //                 at random, weighted by blocks seen/kept: never behind real time
+  // --print n:      print the first n events in full (28)
+  // --trace n:      keep the last n decoded words per thread in memory (4096, 0 none),
+  //                 appended to --trace-file (DQMtrace.txt) around CRC, control bits
+  //                 and resync errors, at most once a second, and on kill -USR1
+  bool OKbatch  = false;
+  bool OKresync = true;
+  bool OKfollow = false;
+  bool OKresume = false;
+  int  httpPort = 0;
+  string socketAddress, shmName, blockFile, catalogFile;
+  int runNumber = -1;
+  uint32_t prescale = 1, sampleSize = 0;
+  int printEvents = 28, traceRecords = 4096;
+  string traceFile = "DQMtrace.txt";
+  double sampleWindow = 1.;
+  uint64_t firstEvent = 0;
+  GEMView::ChipSet chips;
+  double shmMB = 64.;
+  double idleSec = 300., flushSec = 30., checkpointSec = 0.;
+  for(int i=1; i<argc; i++){
+    string a = argv[i];
+    if(a == "-b" || a == "--batch") OKbatch = true;
+    if(a == "--no-resync") OKresync = false;
+    if(a == "--http" && i+1<argc) httpPort = atoi(argv[++i]);
+    if(a == "-f" || a == "--follow") OKfollow = true;
+    if(a == "--socket" && i+1<argc) socketAddress = argv[++i];
+    if(a == "--shm" && i+1<argc) shmName = argv[++i];
+    if(a == "--shm-size" && i+1<argc) shmMB = atof(argv[++i]);
+    if(a == "--blocks" && i+1<argc) blockFile = argv[++i];
+    if(a == "--first"  && i+1<argc) firstEvent = strtoull(argv[++i], 0, 0);
+    if(a == "--chip" && i+1<argc){
+      stringstream ids(argv[++i]);
+      string id;
+      while(getline(ids, id, ',')) chips.set(strtoul(id.c_str(), 0, 16) & 0x0fff);
+    }
+    if(a == "--idle"  && i+1<argc) idleSec  = atof(argv[++i]);
+    if(a == "--catalog" && i+1<argc) catalogFile = argv[++i];
+    if(a == "--run"     && i+1<argc) runNumber   = atoi(argv[++i]);
+    if(a == "--flush" && i+1<argc) flushSec = atof(argv[++i]);
+    if(a == "--checkpoint" && i+1<argc) checkpointSec = atof(argv[++i]);
+    if(a == "--resume") OKresume = true;
+    if(a == "--prescale" && i+1<argc) prescale = strtoul(argv[++i], 0, 0);
+    if(a == "--sample" && i+1<argc) sampleSize = strtoul(argv[++i], 0, 0);
+    if(a == "--sample-window" && i+1<argc) sampleWindow = atof(argv[++i]);
+    if(a == "--print" && i+1<argc) printEvents = atoi(argv[++i]);
+    if(a == "--trace" && i+1<argc) traceRecords = atoi(argv[++i]);
+    if(a == "--trace-file" && i+1<argc) traceFile = argv[++i];
+  }
+
 #ifndef __CINT__
-  TApplication App("App", &argc, argv);
+  TApplication* App = 0;
+  if(OKbatch) gROOT->SetBatch(kTRUE);
+  else App = new TApplication("App", &argc, argv);
 #endif
  
   GEMOnline         Online;   
@@ -314,27 +269,96 @@ TFile* thldread(Int_t get=0)
 
   string file="DataParker.dat";
 
-  ifstream inpf(file.c_str());
-  if(!inpf.is_open()) {
-    cout << "\nThe file: " << file.c_str() << " is missing.\n" << endl;
-    return 0;
-  };
+  ifstream inpf;
+  GEMSocketReader* source = 0;
+  GEMShmRing* ring = 0;
+  GEMBlockReader* blocks = 0;
+  if(!blockFile.empty()){
+    blocks = new GEMBlockReader(blockFile);
+    if(!blocks->good()) {
+      cout << "\nThe block file: " << blocks->error << "\n" << endl;
+      return 0;
+    }
+    cout << blockFile << ": " << blocks->nEvents() << " GEB blocks in " << blocks->nBlocks() << " compressed blocks" << endl;
+    if(firstEvent) blocks->seek(firstEvent);
+    OKfollow = false;
+  } else if(!socketAddress.empty()){
+    GEMSocket sock(socketAddress);
+    cout << "waiting for data on " << socketAddress << endl;
+    int fd = sock.Listen();
+    if(fd < 0) {
+      cout << "\nThe socket: " << socketAddress << " " << sock.error << "\n" << endl;
+      return 0;
+    }
+    source = new GEMSocketReader(fd, sock.stream());
+    OKfollow = false;
+  } else if(!shmName.empty()){
+    string error;
+    ring = GEMShmRing::Create(shmName, (uint64_t)(shmMB*1024*1024), error);
+    if(!ring) {
+      cout << "\nThe shared memory ring: " << shmName << " " << error << "\n" << endl;
+      return 0;
+    }
+    cout << "waiting for data in " << shmName << ", " << ring->capacity() << " bytes" << endl;
+    OKfollow = false;
+  } else {
+    inpf.open(file.c_str());
+    if(!inpf.is_open()) {
+      cout << "\nThe file: " << file.c_str() << " is missing.\n" << endl;
+      return 0;
+    };
+  }
+  GEMFollow* follower = OKfollow ? new GEMFollow(file) : 0;
+  const string input = !blockFile.empty() ? blockFile : !socketAddress.empty() ? socketAddress : !shmName.empty() ? shmName : file;
+  GEMCatalogBuilder* catalog = 0;
+  if(!catalogFile.empty()){
+    catalog = new GEMCatalogBuilder();
+    catalog->run(runNumber);
+    catalog->source(input);
+  }
+  if(follower) cout << "following " << file << (follower->inotify() ? " (inotify)" : " (polling)") << endl;
 
   /* Threshould Analysis Histograms */
   const TString filename = "DQMlight.root";
 
-  // Create a new canvas.
-  TCanvas *c1 = new TCanvas("c1","Dynamic Filling Example",0,0,600,600);
-  c1->SetFillColor(42);
-  c1->GetFrame()->SetFillColor(21);
-  c1->GetFrame()->SetBorderSize(6);
-  c1->GetFrame()->SetBorderMode(-1);
-  c1->Divide(3,3);
-
   TFile* hfile = NULL;
-  hfile = new TFile(filename,"RECREATE","Threshold Scan ROOT file with histograms");
+  Checkpoint resumed;
+  bool OKresumed = false;
+  if(OKresume){
+    hfile = new TFile(filename,"UPDATE","Threshold Scan ROOT file with histograms");
+    TNamed* saved = 0;
+    hfile->GetObject("Checkpoint", saved);
+    OKresumed = saved && resumed.parse(saved->GetTitle());
+    delete saved;
+    if(OKresumed && resumed.input != input) {
+      cout << "\nThe checkpoint of " << filename << " is for " << resumed.input << ", not " << input << ".\n" << endl;
+      return 0;
+    }
+    // the catalog gets one summary of the whole run, the counters before the checkpoint included
+    if(OKresumed && catalog && !catalog->restore(resumed.catalog)) {
+      cout << "\nThe checkpoint of " << filename << " has no catalog counters, --catalog cannot resume it.\n" << endl;
+      return 0;
+    }
+    if(!OKresumed){
+      cout << "no checkpoint in " << filename << ", starting from the beginning" << endl;
+      hfile->Close();
+      delete hfile;
+      hfile = NULL;
+    }
+  }
+  if(!hfile) hfile = new TFile(filename,"RECREATE","Threshold Scan ROOT file with histograms");
+  if(OKresumed){
+    if(blocks && resumed.offset >= 0) blocks->seek(resumed.offset);
+    if(inpf.is_open() && resumed.offset >= 0) inpf.seekg(resumed.offset);
+    cout << "resume " << input << " at event " << resumed.event;
+    if(resumed.offset >= 0) cout << (blocks ? ", GEB block " : ", byte ") << resumed.offset;
+    cout << endl;
+  }
 
-  TTree GEMtree("GEMtree","A Tree with GEM Events");
+  // --resume: the trees of the checkpoint are filled on
+  TTree* GEMtree = 0;
+  if(OKresumed) hfile->GetObject("GEMtree", GEMtree);
+  if(!GEMtree) GEMtree = new TTree("GEMtree","A Tree with GEM Events");
 
   TH1F* hiVFAT = new TH1F("VFAT", "Number VFAT per event", 100, -0.5, 100. );
 
@@ -376,177 +400,540 @@ TFile* thldread(Int_t get=0)
     histos[hi] = new TH1F(histName.str().c_str(), histTitle.str().c_str(), 100, 0., 0xf );
   }
 
-  const Int_t ieventPrint = 27;
-  const Int_t ieventMax   = 90000;
+  // --resume: the booked histograms take over the contents of the checkpoint
+  if(OKresumed){
+    vector<TH1*> booked = { hiVFAT, hi1010, hi1100, hi1110, hiChip, hiFlag, hiCRC, hiDiffCRC, hiCh128 };
+    booked.insert(booked.end(), histos, histos + 128);
+    for(size_t i = 0; i < booked.size(); i++){
+      TKey* key = hfile->GetKey(booked[i]->GetName());
+      TH1* saved = key ? (TH1*)key->ReadObj() : 0;
+      if(!saved) continue;
+      saved->SetDirectory(0);
+      saved->Copy(*booked[i]);
+      booked[i]->SetDirectory(hfile);
+      delete saved;
+    }
+  }
+
+  const Int_t ieventPrint = printEvents;
+  const Int_t ieventMax   = (OKfollow || source || ring || blocks) ? 2147483647 : 90000;
   const Int_t kUPDATE     = 50;
   bool OKpri = false;
 
+  // Recovery mode: on a bad GEB header or VFAT control bits skip to the next valid GEB block
+  GEMResync resync;
+  resync.growing = OKfollow;
+  if(OKresumed) resync.nSkipped = resumed.skipped;
+
   Event *ev = new Event(); 
-  GEMtree.Branch("GEMEvents", &ev);
+  if(GEMtree->GetBranch("GEMEvents")) GEMtree->SetBranchAddress("GEMEvents", &ev);
+  else GEMtree->Branch("GEMEvents", &ev);
+
+  // Throughput telemetry: DQMmetrics.txt and the Telemetry tree, every 5 seconds
+  GEMTelemetry telemetry("DQMmetrics.txt", 5.);
+  TTree* Telemetry = 0;
+  if(OKresumed) hfile->GetObject("Telemetry", Telemetry);
+  if(!Telemetry) Telemetry = new TTree("Telemetry","GEM reader throughput telemetry");
+  telemetry.BookTree(Telemetry);
+
+  // Create a new canvas, refreshed once per second from histogram snapshots.
+  // With --http the snapshots, channel histograms included, are also served on the web.
+  GEMDisplay* display = 0;
+  if(!OKbatch || httpPort){
+    TCanvas *c1 = 0;
+    if(!OKbatch){
+      c1 = new TCanvas("c1","Dynamic Filling Example",0,0,600,600);
+      c1->SetFillColor(42);
+      c1->GetFrame()->SetFillColor(21);
+      c1->GetFrame()->SetBorderSize(6);
+      c1->GetFrame()->SetBorderMode(-1);
+      c1->Divide(3,3);
+    }
 
-  for(int ievent=0; ievent<ieventMax; ievent++){
-    OKpri = OKprint(ievent,ieventPrint);
-    if(inpf.eof()) break;
-    if(!inpf.good()) break;
+    display = new GEMDisplay(c1, 1000, &telemetry);
+    display->Add(hiVFAT,    1, true);
+    display->Add(hi1010,    2);
+    display->Add(hi1100,    3);
+    display->Add(hiFlag,    4, true);
+    display->Add(hi1110,    5, true);
+    display->Add(hiChip,    6, true);
+    display->Add(hiCRC,     7, true);
+    display->Add(hiCh128,   8, true);
+    display->Add(hiDiffCRC, 9, true);
+  }
+  THttpServer* server = 0;
+  if(httpPort){
+    for(int hi = 0; hi < 128; ++hi) display->Add(histos[hi]);
+    server = new THttpServer(TString::Format("http:%d", httpPort));
+    server->SetReadOnly(kTRUE);
+    display->Publish(server, "/GEM");
+    cout << "DQM histograms on http://localhost:" << httpPort << "/" << endl;
+  }
+  std::mutex noDisplay;
+  std::mutex& histLock = display ? display->Mutex() : noDisplay;
+  std::atomic<bool> stop(false);
+
+  // debug trace of the decoded words, dumped around errors and on kill -USR1
+  GEMTrace::Tracer& tracer = GEMTrace::tracer();
+  tracer.configure(traceRecords, traceFile);
+  signal(SIGUSR1, GEMTrace::onSignal);
+
+  // binary GEB blocks are checked and selected on their raw words, a block is decoded once it passes
+  const bool OKselect = chips.any();
+  uint64_t nDeselected = OKresumed ? resumed.deselected : 0;
+  auto selectGEB = [&](const GEMView::GEB& view, int ievent, bool* selected) {
+    if(OKresync && !view.controlBitsOK()) {
+      telemetry.count(GEMTelemetry::kControlErrors);
+      if(catalog) catalog->controlError();
+      tracer.record(GEMTrace::kGEBHeader, ievent, view.header(), GEMTrace::kControlError);
+      for(size_t i = 0; i < view.sumVFAT(); i++){
+        GEMView::VFAT v = view.vfat(i);
+        tracer.vfat(ievent, i, v.BCword(), v.ECword(), v.ChipIDword(), v.lsData(), v.msData(), v.crc(), 0,
+                    v.controlBitsOK() ? 0 : GEMTrace::kControlError);
+      }
+      tracer.trigger("control bits");
+      return false;
+    }
+    if(OKselect && !view.hasChip(chips)) {
+      nDeselected++;
+      if(selected) *selected = false;
+      return false;
+    }
+    return true;
+  };
 
-    if(OKpri) cout << "\nievent " << ievent << endl;
+  // load shedding: the events analysed in full, the others are only counted
+  struct SampledGEB {
+    GEMOnline::GEBData geb;
+    std::vector<uint16_t> checked;   /*!<CRC computed for every VFAT */
+    int ievent;
+  };
+  GEMSampler<SampledGEB> sampler;
+  if(sampleSize) sampler.reservoir(sampleSize, sampleWindow);
+  else sampler.prescale(prescale);
+
+  // The event loop, run in a worker thread when there is a display
+  auto process = [&]() {
+    uint64_t tick = 0, tEvent = 0;
+
+    uint64_t nextBlock = OKresumed ? resumed.offset : firstEvent;
+
+    // The expensive part of an event, for the events of the sampler: histograms, weighted, and the tree
+    std::vector<uint16_t> checked;
+    auto analyse = [&](const GEMOnline::GEBData& g, const std::vector<uint16_t>& checkedCRCs, double w, int ievent) {
+      bool OKpri = OKprint(ievent,ieventPrint);
+      uint64_t ZSFlag  = (0xffffff0000000000 & g.header) >> 40; 
+      uint64_t ChamID  = (0x000000fff0000000 & g.header) >> 28; 
+
+      GEBdata *GEBdata_ = new GEBdata(ZSFlag, ChamID);
+
+      // histograms are only touched with histLock held, the display copies them under it
+      std::unique_lock<std::mutex> lock(histLock);
+      for(int ivfat=0; ivfat<(int)g.vfats.size(); ivfat++){
+        const GEMOnline::VFATData& vfat = g.vfats[ivfat];
+        if(OKselect && !chips.test(vfat.ChipID & 0x0fff)) continue;
+        uint64_t tick = GEMTelemetry::now();
+  
+        uint8_t   b1010  = (0xf000 & vfat.BC) >> 12;
+        uint8_t   b1100  = (0xf000 & vfat.EC) >> 12;
+        uint8_t   Flag   = (0x000f & vfat.EC);
+        uint8_t   b1110  = (0xf000 & vfat.ChipID) >> 12;
+        uint16_t  ChipID = (0x0fff & vfat.ChipID);
+        uint16_t  CRC    = vfat.crc;
+  
+        // the control bits errors are counted for every event, such VFATs are not analysed
+        if ( (b1010 == 0xa) && (b1100==0xc) && (b1110==0xe) /* && (ChipID==0x68) */ ){
+
+          VFATdata *VFATdata_ = new VFATdata(b1010, b1100, ChipID, Flag, b1110, CRC);
+          GEBdata_->addVFATData(*VFATdata_);
+          delete VFATdata_;
+          // building the tree's Event, the words were decoded when the block was read
+          uint64_t tock = GEMTelemetry::now();
+          telemetry.stage(GEMTelemetry::kTree, tock - tick);
+          tick = tock;
+
+          uint16_t checkedCRC = checkedCRCs[ivfat];
+  
+         /*
+          * GEM Event Analyse
+          */
 
-    // read Event Chamber Header 
-    Online.readGEBheader(inpf, geb);
-    if(OKpri) Online.printGEBheader(geb);
+          hiVFAT->Fill(ivfat, w);
+          hi1010->Fill(b1010, w);
+          hi1100->Fill(b1100, w);
+          hiFlag->Fill(Flag, w);
+          hi1110->Fill(b1110, w);
+          hiChip->Fill(ChipID, w);
+          hiCRC->Fill(CRC, w);
+          hiDiffCRC->Fill(CRC-checkedCRC, w);
+    
+          // timed by gem-benchmark.cc (channelBits, histFill)
+          uint8_t chan0xf = 0;
+          for (int chan = 0; chan < 128; ++chan) {
+            if (chan < 64){
+              chan0xf = ((vfat.lsData >> chan) & 0x1);
+              histos[chan]->Fill(chan0xf, w);
+            if(!chan0xf) hiCh128->Fill(chan, w);
+      	  } else {
+              chan0xf = ((vfat.msData >> (chan-64)) & 0x1);
+        	    histos[chan]->Fill(chan0xf, w);
+      	  if(!chan0xf) hiCh128->Fill(chan, w);
+            }
+          }
+          telemetry.stage(GEMTelemetry::kFill, GEMTelemetry::now() - tick);
+    
+          if(OKpri){
+            Online.printVFATdataBits(ievent, ivfat, vfat);
+            //Online.printVFATdata(ievent, vfat);
+            //Online.PrintChipID(ievent,vfat);
+          }
+        }// if 1010,1100,1110, ChipID
+      }//end ivfat
+      lock.unlock();
 
-    uint64_t ZSFlag  = (0xffffff0000000000 & geb.header) >> 40; 
-    uint64_t ChamID  = (0x000000fff0000000 & geb.header) >> 28; 
-    uint64_t sumVFAT = (0x000000000fffffff & geb.header);
+      if(OKpri) Online.printGEBtrailer(g);
 
-    GEBdata *GEBdata_ = new GEBdata(ZSFlag, ChamID);
+      uint64_t OHcrc      = (0xffff000000000000 & g.trailer) >> 48; 
+      uint64_t OHwCount   = (0x0000ffff00000000 & g.trailer) >> 32; 
+      uint64_t ChamStatus = (0x00000000ffff0000 & g.trailer) >> 16;
 
-    for(int ivfat=0; ivfat<sumVFAT; ivfat++){
+      GEBdata_->setTrailer(OHcrc, OHwCount, ChamStatus);
 
-     /*
-      *  GEM Event Reading
-      */
-      Online.readEvent(inpf, ievent, vfat);
-  
-      uint8_t   b1010  = (0xf000 & vfat.BC) >> 12;
-      uint8_t   b1100  = (0xf000 & vfat.EC) >> 12;
-      uint8_t   Flag   = (0x000f & vfat.EC);
-      uint8_t   b1110  = (0xf000 & vfat.ChipID) >> 12;
-      uint16_t  ChipID = (0x0fff & vfat.ChipID);
-      uint16_t  CRC    = vfat.crc;
-  
-      if ( (b1010 == 0xa) && (b1100==0xc) && (b1110==0xe) /* && (ChipID==0x68) */ ){
-
-      VFATdata *VFATdata_ = new VFATdata(b1010, b1100, Flag, b1110, ChipID, CRC);
-      GEBdata_->addVFATData(*VFATdata_);
-      delete VFATdata_;
-
-     /*
-      * GEM Event Analyse
-      */
-
-      hiVFAT->Fill(ivfat);
-      hi1010->Fill(b1010);
-      hi1100->Fill(b1100);
-      hiFlag->Fill(Flag);
-      hi1110->Fill(b1110);
-      if (ChipID != 0xdead) hiChip->Fill(ChipID);
-      hiCRC->Fill(CRC);
-
-      //I think it would be nice to time this...
-      uint8_t chan0xf = 0;
-      for (int chan = 0; chan < 128; ++chan) {
-        if (chan < 64){
-          chan0xf = ((vfat.lsData >> chan) & 0x1);
-  	  histos[chan]->Fill(chan0xf);
-	  if(!chan0xf) hiCh128->Fill(chan);
-	} else {
-          chan0xf = ((vfat.lsData >> (chan-64)) & 0x1);
-  	  histos[chan]->Fill(chan0xf);
-	  if(!chan0xf) hiCh128->Fill(chan);
+      uint64_t tick = GEMTelemetry::now();
+      ev->Build(0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0);
+      ev->addGEBdata(*GEBdata_);
+      GEMtree->Fill();
+      ev->Clear();
+      delete GEBdata_;
+      telemetry.stage(GEMTelemetry::kTree, GEMTelemetry::now() - tick);
+
+      if(OKpri){
+        cout << "GEM Camber Treiler: OHcrc " << hex << OHcrc << " OHwCount " << OHwCount << " ChamStatus " << ChamStatus << dec 
+             << " ievent " << ievent << endl;
+      }
+    };
+    auto drainSampled = [&](bool force) {
+      sampler.drain([&](const SampledGEB& s, double w) { analyse(s.geb, s.checked, w, s.ievent); }, force);
+    };
+
+    // write the output file with the checkpoint to resume from at event next,
+    // byte "at" of the file input (its position now if -1)
+    auto checkpoint = [&](int next, int64_t at) {
+      Checkpoint ck;
+      ck.offset = blocks ? (int64_t)nextBlock : (source || ring) ? -1 : at >= 0 ? at : (int64_t)inpf.tellg();
+      ck.event = next;
+      ck.deselected = nDeselected;
+      ck.skipped = resync.nSkipped;
+      if(catalog) ck.catalog = catalog->state();
+      ck.input = input;
+      drainSampled(true);
+      TNamed named("Checkpoint", ck.str().c_str());
+      hfile->Write(0, TObject::kOverwrite);
+      hfile->WriteTObject(&named, "Checkpoint", "Overwrite");
+      hfile->Flush();
+    };
+
+    // follow mode and --checkpoint: rewrite the output file, at most every flushSec (checkpointSec) seconds
+    const double flushPeriod = checkpointSec > 0. ? checkpointSec : flushSec;
+    std::chrono::steady_clock::time_point lastFlush = std::chrono::steady_clock::now();
+    int nFlushed = 0, nEvents = 0;
+    auto flush = [&](bool force, int next, int64_t at) {
+      if(nEvents == nFlushed) return;
+      if(!force && std::chrono::steady_clock::now() - lastFlush < std::chrono::duration<double>(flushPeriod)) return;
+      checkpoint(next, at);
+      lastFlush = std::chrono::steady_clock::now();
+      nFlushed = nEvents;
+    };
+
+    // follow mode: the data ends at "seen", wait for more and go back to "back", event next
+    auto waitMore = [&](int64_t seen, int64_t back, int next) {
+      flush(true, next, back);
+      if(!follower->wait(seen, idleSec, &stop)) return false;
+      inpf.clear();
+      inpf.seekg(back);
+      return true;
+    };
+
+    int ievent = OKresumed ? resumed.event : 0;
+    for(; ievent<ieventMax && !stop; ievent++){
+      OKpri = OKprint(ievent,ieventPrint);
+      bool OKblock = true;
+      int64_t gebStart = 0, gebBytes = 0;
+
+      if(blocks){
+       /*
+        *  Binary GEB blocks from the block file, decompressed ahead by other threads
+        */
+        tEvent = tick = GEMTelemetry::now();
+        size_t n = 0;
+        uint64_t blockEvent = 0;
+        const unsigned char* p = blocks->nextGEB(n, &blockEvent);
+        if(!p) break;
+        nextBlock = blockEvent + 1;
+        if(OKpri) cout << "\nievent " << ievent << endl;
+        OKblock = selectGEB(GEMView::GEB(p), ievent, 0);
+        uint64_t tock = GEMTelemetry::now();
+        telemetry.stage(GEMTelemetry::kRead, tock - tick);
+        if(OKblock) Online.decodeGEB(p, geb);
+        telemetry.stage(GEMTelemetry::kDecode, GEMTelemetry::now() - tock);
+        // the blocks were framed when the file was written
+        if(!OKblock) continue;
+        if(OKpri) Online.printGEBheader(geb);
+        gebBytes = n;
+      } else if(ring){
+       /*
+        *  Binary GEB blocks decoded in the shared memory ring, then handed back to the producer
+        */
+        tEvent = tick = GEMTelemetry::now();
+        uint64_t n = 0;
+        const unsigned char* p = ring->next(n, &stop);
+        if(!p) break;
+        if(OKpri) cout << "\nievent " << ievent << endl;
+        OKblock = selectGEB(GEMView::GEB(p), ievent, 0);
+        uint64_t tock = GEMTelemetry::now();
+        if(OKblock) Online.decodeGEB(p, geb);
+        tick = GEMTelemetry::now();
+        telemetry.stage(GEMTelemetry::kDecode, tick - tock);
+        ring->release();
+        telemetry.queueDepth(ring->used());
+        telemetry.stage(GEMTelemetry::kRead, GEMTelemetry::now() - tick + tock - tEvent);
+        // every block in the ring is framed by its producer, a bad one is just dropped
+        if(!OKblock) continue;
+        if(OKpri) Online.printGEBheader(geb);
+        gebBytes = n;
+      } else if(source){
+       /*
+        *  Binary GEB blocks from a socket, decoded in place
+        */
+        tEvent = tick = GEMTelemetry::now();
+        if(OKpri) cout << "\nievent " << ievent << endl;
+        const unsigned char* p = Online.peekGEBbinary(*source);
+        if(!p && source->eof()) break;
+        bool selected = true;
+        OKblock = p && selectGEB(GEMView::GEB(p), ievent, &selected);
+        uint64_t tock = GEMTelemetry::now();
+        telemetry.stage(GEMTelemetry::kRead, tock - tick);
+        if(OKblock) Online.decodeGEB(p, geb);
+        telemetry.stage(GEMTelemetry::kDecode, GEMTelemetry::now() - tock);
+        if(!selected){
+          source->consume(GEMView::GEB(p).size());
+          continue;
         }
-  
-        // CRC check
-        dataVFAT[11] = vfat.BC;
-        dataVFAT[10] = vfat.EC;
-        dataVFAT[9]  = vfat.ChipID;
-        dataVFAT[8]  = (0xffff000000000000 & vfat.msData) >> 48;
-        dataVFAT[7]  = (0x0000ffff00000000 & vfat.msData) >> 32;
-        dataVFAT[6]  = (0x00000000ffff0000 & vfat.msData) >> 16;
-        dataVFAT[5]  = (0x000000000000ffff & vfat.msData);
-        dataVFAT[4]  = (0xffff000000000000 & vfat.lsData) >> 48;
-        dataVFAT[3]  = (0x0000ffff00000000 & vfat.lsData) >> 32;
-        dataVFAT[2]  = (0x00000000ffff0000 & vfat.lsData) >> 16;
-        dataVFAT[1]  = (0x000000000000ffff & vfat.lsData);
-
-        uint16_t checkedCRC = checkCRC(OKpri);
-        if(OKpri){
-           cout << " vfat.crc " << std::setfill('0') << std::setw(4) << hex << CRC 
-                << "     crc " << std::setfill('0') << std::setw(4) << checkedCRC << dec << "\n" << endl;
+        if(!OKblock){
+          if(!OKresync) break;
+          telemetry.count(GEMTelemetry::kResyncs);
+          tracer.record(GEMTrace::kResync, ievent, source->nBytes);
+          tracer.trigger("resync");
+          if(!source->resync()) break;
+          continue;
         }
-  
+        if(OKpri) Online.printGEBheader(geb);
+        gebBytes = GEMRaw::gebSize(geb.header);
+        source->consume(gebBytes);
+      } else {
+        tick = GEMTelemetry::now();
+        inpf >> ws;
+        if(inpf.eof() && follower){
+          inpf.clear();
+          int64_t seen = inpf.tellg();
+          if(!waitMore(seen, seen, ievent)) break;
+          ievent--;
+          continue;
+        }
+        if(inpf.eof()) break;
+        if(!inpf.good()) break;
+
+        if(OKpri) cout << "\nievent " << ievent << endl;
+
+        // read Event Chamber Header, the hex tokens are parsed straight from the stream buffer
+        tEvent = GEMTelemetry::now();
+        telemetry.stage(GEMTelemetry::kRead, tEvent - tick);
+        tick = tEvent;
+        gebStart = inpf.tellg();
+        OKblock = Online.readGEBheader(inpf, geb);
+        if(OKpri) Online.printGEBheader(geb);
+
+        uint64_t sumVFAT = GEMRaw::sumVFAT(geb.header);
+
+        if(OKresync && !GEMRaw::headerOK(geb.header)) OKblock = false;
+
        /*
-        * GEM Event Analyse
+        *  GEM Event Reading, the whole GEB block is read before it is analysed
         */
-
-        hiVFAT->Fill(ivfat);
-        hi1010->Fill(b1010);
-        hi1100->Fill(b1100);
-        hiFlag->Fill(Flag);
-        hi1110->Fill(b1110);
-        hiChip->Fill(ChipID);
-        hiCRC->Fill(CRC);
-        hiDiffCRC->Fill(CRC-checkedCRC);
-    
-        //I think it would be nice to time this...
-        uint8_t chan0xf = 0;
-        for (int chan = 0; chan < 128; ++chan) {
-          if (chan < 64){
-            chan0xf = ((vfat.lsData >> chan) & 0x1);
-            histos[chan]->Fill(chan0xf);
-          if(!chan0xf) hiCh128->Fill(chan);
-    	  } else {
-            chan0xf = ((vfat.msData >> (chan-64)) & 0x1);
-      	    histos[chan]->Fill(chan0xf);
-    	  if(!chan0xf) hiCh128->Fill(chan);
+        geb.vfats.clear();
+        for(uint64_t ivfat=0; OKblock && ivfat<sumVFAT; ivfat++){
+          if(!Online.readEvent(inpf, ievent, vfat)) { OKblock = false; break; }
+          if(OKresync && !GEMRaw::controlBitsOK(vfat.BC, vfat.EC, vfat.ChipID)) {
+            telemetry.count(GEMTelemetry::kControlErrors);
+            if(catalog) catalog->controlError();
+            tracer.record(GEMTrace::kGEBHeader, ievent, geb.header);
+            tracer.vfat(ievent, ivfat, vfat.BC, vfat.EC, vfat.ChipID, vfat.lsData, vfat.msData, vfat.crc, 0,
+                        GEMTrace::kControlError);
+            tracer.trigger("control bits");
+            OKblock = false;
+            break;
           }
+          geb.vfats.push_back(vfat);
         }
-    
-        if(OKpri){
-          Online.printVFATdataBits(ievent, ivfat, vfat);
-          //Online.printVFATdata(ievent, vfat);
-          //Online.PrintChipID(ievent,vfat);
+
+        // read Event Chamber Trailer
+        if(OKblock) OKblock = Online.readGEBtrailer(inpf, geb);
+
+        telemetry.stage(GEMTelemetry::kDecode, GEMTelemetry::now() - tick);
+
+        // follow mode: the block runs into the end of the data, it is still being written
+        if(follower && inpf.eof()){
+          inpf.clear();
+          int64_t seen = inpf.tellg();
+          if(!waitMore(seen, gebStart, ievent)) break;
+          ievent--;
+          continue;
         }
-    
-      }// if 1010,1100,1110, ChipID
-    }//end ivfat
 
-    // read Event Chamber Header 
-    Online.readGEBtrailer(inpf, geb);
-    if(OKpri) Online.printGEBtrailer(geb);
+        if(!OKblock){
+          if(!OKresync) break;
+          telemetry.count(GEMTelemetry::kResyncs);
+          if(OKpri) cout << "ievent " << ievent << " corrupted GEB block at byte " << gebStart << endl;
+          tracer.record(GEMTrace::kResync, ievent, gebStart);
+          tracer.trigger("resync");
+          bool found = resync.resync(inpf, gebStart+1, false);
+          while(!found && follower && waitMore(resync.scanned, gebStart+1, ievent)) found = resync.resync(inpf, gebStart+1, false);
+          if(!found) break;
+          continue;
+        }
+        gebBytes = (int64_t)inpf.tellg() - gebStart;
+
+        bool selected = !OKselect;
+        for(size_t ivfat=0; !selected && ivfat<geb.vfats.size(); ivfat++) selected = chips.test(geb.vfats[ivfat].ChipID & 0x0fff);
+        if(!selected){
+          nDeselected++;
+          continue;
+        }
+      }
 
-    uint64_t OHcrc      = (0xffff000000000000 & geb.trailer) >> 48; 
-    uint64_t OHwCount   = (0x0000ffff00000000 & geb.trailer) >> 32; 
-    uint64_t ChamStatus = (0x00000000ffff0000 & geb.trailer) >> 16;
+      telemetry.count(GEMTelemetry::kEvents);
+      if(catalog) catalog->event();
+      telemetry.count(GEMTelemetry::kBytes, gebBytes);
+      telemetry.count(GEMTelemetry::kVFATs, geb.vfats.size());
+
+      // every event: control bits and CRC of the VFATs, with their counters
+      tracer.record(GEMTrace::kGEBHeader, ievent, geb.header);
+      checked.resize(geb.vfats.size());
+      for(int ivfat=0; ivfat<(int)geb.vfats.size(); ivfat++){
+        vfat = geb.vfats[ivfat];
+        if(OKselect && !chips.test(vfat.ChipID & 0x0fff)) continue;
+        if(!GEMRaw::controlBitsOK(vfat.BC, vfat.EC, vfat.ChipID)){
+          telemetry.count(GEMTelemetry::kControlErrors);
+          if(catalog) catalog->vfat(vfat.BC, vfat.EC, vfat.ChipID, true);
+          tracer.vfat(ievent, ivfat, vfat.BC, vfat.EC, vfat.ChipID, vfat.lsData, vfat.msData, vfat.crc, 0,
+                      GEMTrace::kControlError);
+          tracer.trigger("control bits");
+          continue;
+        }
+        tick = GEMTelemetry::now();
 
-    GEBdata_->setTrailer(OHcrc, OHwCount, ChamStatus);
+        // CRC check, word by word printed for the first --print events
+        uint16_t checkedCRC = GEMCrc::vfatCRC(vfat.BC, vfat.EC, vfat.ChipID, vfat.lsData, vfat.msData);
+        if(OKpri){
+           Online.printCRC(vfat);
+           cout << " vfat.crc " << std::setfill('0') << std::setw(4) << hex << vfat.crc 
+                << "     crc " << std::setfill('0') << std::setw(4) << checkedCRC << dec << "\n" << endl;
+        }
+        checked[ivfat] = checkedCRC;
+        tracer.vfat(ievent, ivfat, vfat.BC, vfat.EC, vfat.ChipID, vfat.lsData, vfat.msData, vfat.crc, checkedCRC,
+                    vfat.crc != checkedCRC ? GEMTrace::kCRCError : 0);
+        if(vfat.crc != checkedCRC){
+          telemetry.count(GEMTelemetry::kCRCErrors);
+          tracer.trigger("CRC error");
+        }
+        if(catalog) catalog->vfat(vfat.BC, vfat.EC, vfat.ChipID, vfat.crc == checkedCRC);
+        telemetry.stage(GEMTelemetry::kCRC, GEMTelemetry::now() - tick);
+      }
+      tracer.record(GEMTrace::kGEBTrailer, ievent, geb.trailer);
+
+      // the sampled events: histograms and tree
+      if(sampler.mode() == GEMSampler<SampledGEB>::kReservoir){
+        SampledGEB s = { geb, checked, ievent };
+        sampler.offer(s);
+        drainSampled(false);
+      } else if(sampler.take()){
+        analyse(geb, checked, sampler.weight(), ievent);
+      }
+      telemetry.latency(GEMTelemetry::now() - tEvent);
 
-    ev->Build(0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0);
-    ev->addGEBdata(*GEBdata_);
-    GEMtree.Fill();
-    ev->Clear();
+      if (ievent%kUPDATE == 0 && ievent != 0) {
+        cout << "event " << ievent << " ievent%kUPDATE " << ievent%kUPDATE << endl;
+      }
 
-    if(OKpri){
-      cout << "GEM Camber Treiler: OHcrc " << hex << OHcrc << " OHwCount " << OHwCount << " ChamStatus " << ChamStatus << dec 
-           << " ievent " << ievent << endl;
+      if(OKpri) cout<<"ievent "<< ievent <<endl;
+      telemetry.Report();
+      tracer.poll();
+      nEvents++;
+      if(follower || checkpointSec > 0.) flush(false, ievent+1, -1);
     }
-
-    if (ievent%kUPDATE == 0 && ievent != 0) {
-      c1->cd(1)->SetLogy(); hiVFAT->Draw();
-      c1->cd(2); hi1010->Draw();
-      c1->cd(3); hi1100->Draw();
-      c1->cd(4)->SetLogy(); hiFlag->Draw();
-      c1->cd(5)->SetLogy(); hi1110->Draw();
-      c1->cd(6)->SetLogy(); hiChip->Draw();
-      c1->cd(7)->SetLogy(); hiCRC->Draw();
-      c1->cd(8)->SetLogy(); hiCh128->Draw();
-      c1->cd(9)->SetLogy(); hiDiffCRC->Draw();
-      c1->Update();
-
-      cout << "event " << ievent << " ievent%kUPDATE " << ievent%kUPDATE << endl;
+    inpf.clear();
+    int64_t end = inpf.is_open() ? (int64_t)inpf.tellg() : -1;
+    inpf.close();
+    if(OKresync) resync.Print();
+    if(sampler.mode() != GEMSampler<SampledGEB>::kAll){
+      drainSampled(true);
+      cout << "sampling: " << sampler.nAnalysed << " of " << sampler.nSeen << " GEB blocks analysed" << endl;
+    }
+    tracer.Done();
+    if(tracer.nDumps || tracer.nSuppressed){
+      cout << "trace: " << tracer.nDumps << " dumps to " << traceFile << ", " << tracer.nSuppressed << " rate limited" << endl;
+    }
+    if(OKselect) cout << "--chip: " << nDeselected << " GEB blocks without the selected chips skipped" << endl;
+    if(source){
+      cout << "socket: " << source->nBytes << " bytes in " << source->nReads << " reads";
+      if(source->nDatagrams) cout << ", " << source->nDatagrams << " datagrams, " << source->nTruncated << " truncated";
+      cout << ", " << source->nSkipped << " bytes skipped" << endl;
+    }
+    if(ring){
+      cout << "shm: " << ring->blocks() << " blocks written, " << ring->overruns() << " overruns";
+      if(ring->nCorrupt) cout << ", " << ring->nCorrupt << " corrupted";
+      cout << endl;
+      delete ring;
+    }
+    if(blocks){
+      cout << "blocks: " << blocks->nBlocks() << " compressed blocks, " << blocks->nCorrupt << " corrupted, "
+           << blocks->nSkipped << " bytes skipped" << endl;
+      delete blocks;
+    }
+    telemetry.Report(true);
+    telemetry.LatencyHistogram("EventLatency", hfile);
+    if(catalog){
+      catalog->skipped(resync.nSkipped);
+      if(!catalog->append(catalogFile)) cout << "catalog: " << catalog->error << endl;
+      else cout << "catalog: run " << catalog->summary().run << " added to " << catalogFile << endl;
     }
 
-    if(OKpri) cout<<"ievent "<< ievent <<endl;
-  }
-  inpf.close();
-
-  // Save all objects in this file
-  hfile->Write();
-  cout<<"=== hfile->Write()"<<endl;
+    // Save all objects in this file, with the checkpoint to continue from if the input grows
+    checkpoint(ievent, end);
+    cout<<"=== hfile->Write()"<<endl;
+    if(display) display->Done();
+  };
 
+  if(!display){
+    process();
+  } else {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+    ROOT::EnableThreadSafety();
+#endif
+    std::thread worker(process);
+    display->TurnOn();
 #ifndef __CINT__
-     App.Run();
+    if(App) App->Run(kTRUE);
 #endif
+    // batch mode with --http: the timer and the web requests run here
+    while(!App && !display->IsDone()){
+      gSystem->ProcessEvents();
+      gSystem->Sleep(10);
+    }
+    stop = true;
+    worker.join();
+    display->Snapshot(true);
+  }
 
 #ifdef __CINT__
    return hfile;
@@ -0,0 +1,480 @@
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <climits>
+#include <vector>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "GEMRaw.h"
+#include "GEMConvert.h"
+#include "GEMResync.h"
+#include "GEMSocket.h"
+#include "GEMShmRing.h"
+#include "GEMByteOrder.h"
+
+/**
+* ... Replays a GEB/VFAT file at a controlled rate, a stand-in for the DAQ and a DQM stress test ...
+*/
+
+/*! \file */
+/*!
+  Re-emits the GEB blocks of a hex (gem-reading.cc input) or binary
+  (writeVFATdataBinary) file into a socket, a shared memory ring, a pipe or
+  a growing file, at a given event rate, with beam-like bursts, and can
+  ramp the rate up to find where the reader stops keeping up.
+
+  g++ -O2 -std=c++11 gem-replay.cc -o gem-replay -lrt <br>
+  ./gem-reading -b --shm /gem & <br>
+  ./gem-replay -i DataParker.bin -o shm:/gem -rate 5000 <br>
+  ./gem-replay -i DataParker.dat -o file:DataParker.live -rate 1000 -burst 4800:7200 <br>
+  ./gem-replay -i DataParker.bin -o unix:/tmp/gem.sock -ramp 1000:1.5:5 -loop 0
+
+  Options:
+    -i FILE         input file, hex or binary (DataParker.bin), the format is detected,
+                    and so is a binary file written with the other byte order
+    -o ADDRESS      unix:/path, tcp:[host:]port, unixgram:/path, udp:[host:]port,
+                    shm:name (gem-reading --shm), pipe:/path (a FIFO, made if missing),
+                    file:/path (a growing file, for gem-reading --follow) or - (stdout)
+    -hex, -binary   format written to pipes and files (same as the input),
+                    sockets and shm always get binary
+    -rate R         GEB blocks (events) per second, 0 is as fast as possible (0)
+    -speed X        X times the recorded rate given by -recorded
+    -recorded R     rate at which the input was taken, events per second
+    -burst ON:OFF   milliseconds with beam, then without: the rate applies
+                    during ON, nothing is sent during OFF
+    -loop N         send the file N times, 0 is forever (1)
+    -ramp R0:F:S    start at R0 events/s, multiply by F every S seconds until the
+                    reader falls behind, then report the highest sustained rate
+    -max R          stop the ramp at this rate
+    -batch N        at most N blocks per system call (64)
+    -drop           shm: drop blocks when the ring is full, as the DAQ does,
+                    instead of waiting for the reader
+    -report S       progress line every S seconds (1)
+
+  The reader falls behind when the blocks due at the requested rate can no
+  longer be sent (a socket, pipe or full ring pushing back) or, on shm,
+  when the ring is more than half full or overruns appear. A growing file
+  never pushes back, watch the reader's DQMmetrics.txt instead.
+  On datagram sockets every GEB block is one datagram, an empty datagram
+  ends the run.
+
+  \author Sergey.Baranov@cern.ch
+*/
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+//! One GEB block ready to be sent.
+struct Block {
+  const unsigned char* p;
+  size_t n;
+};
+
+//! GEB blocks of a hex or binary file, chunk by chunk, in the output format.
+class Input {
+  public:
+
+      Input(const string& file, int loops) : nSkipped(0), nLoops(0), fLoops(loops), fHave(0), fHex(false), fSwap(false), fDone(0) {
+        fInpf.open(file.c_str(), ios::binary);
+        vector<char> c(1 << 16);
+        fInpf.read(&c[0], c.size());
+        // hex files are whitespace and hex digits only
+        fHex = fInpf.gcount() > 0;
+        for (int i = 0; i < fInpf.gcount() && i < 64; i++) fHex &= (GEMResync::isSpace(c[i]) || GEMResync::hexDigit(c[i]) >= 0);
+        if (!fHex) fSwap = GEMByteOrder::detect((const unsigned char*)&c[0], fInpf.gcount()) == GEMByteOrder::kSwapped;
+        rewind();
+      }
+
+      bool good() const { return fInpf.is_open(); }
+      bool hex() const { return fHex; }
+      bool swapped() const { return fSwap; }
+
+      //! Blocks of the next chunk, written in hex or binary; false at the end.
+      bool next(vector<Block>& blocks, bool outHex) {
+        fOut.clear();
+        vector<size_t> offsets;
+        while (offsets.empty()) {
+          fInpf.read((char*)&fBuf[fHave], kChunk);
+          size_t n = fHave + fInpf.gcount();
+          bool last = (fInpf.gcount() == 0);
+          if (last && fHex && fHave) fBuf[n++] = '\n';   // the last token may lack its new line
+          if (!n || (last && !fHave)) {
+            if (fLoops && ++nLoops >= fLoops) return false;
+            rewind();
+            continue;
+          }
+
+          // a foreign binary file is framed only where it is in host order already
+          size_t m = n;
+          if (fSwap) {
+            fDone += GEMByteOrder::swapBlocks(&fBuf[fDone], n - fDone);
+            if (!last) m = fDone;
+          }
+
+          size_t pos;
+          if (fHex) {
+            pos = GEMConvert::frameHex((const char*)&fBuf[0], n, nSkipped,
+              [&](const char* text, size_t len, const uint64_t* words) {
+                if (outHex) {
+                  add((const unsigned char*)text, len, offsets);
+                } else {
+                  unsigned char bin[GEMRaw::kMaxGEBSize];
+                  add(bin, GEMConvert::wordsToBinary(words, bin), offsets);
+                }
+              });
+          } else {
+            pos = GEMConvert::frameBinary(&fBuf[0], m, nSkipped,
+              [&](const unsigned char* p, size_t size) {
+                if (outHex) {
+                  char text[GEMConvert::kMaxHexGEB];
+                  add((const unsigned char*)text, GEMConvert::binaryToHex(p, text), offsets);
+                } else {
+                  add(p, size, offsets);
+                }
+              });
+          }
+          if (last) {
+            nSkipped += n - pos;
+            pos = n;
+          }
+          fHave = n - pos;
+          memmove(&fBuf[0], &fBuf[pos], fHave);
+          fDone = fSwap && !last ? fDone - pos : 0;
+        }
+        // fOut is complete, its blocks can be pointed to
+        blocks.resize(offsets.size()/2);
+        for (size_t j = 0; j < blocks.size(); j++) {
+          blocks[j].p = &fOut[offsets[2*j]];
+          blocks[j].n = offsets[2*j+1];
+        }
+        return true;
+      }
+
+      uint64_t nSkipped;   /*!<bytes which are not part of a valid GEB block */
+      int nLoops;
+
+  private:
+
+      static const size_t kChunk = 4 << 20;
+
+      void rewind() {
+        fInpf.clear();
+        fInpf.seekg(0);
+        fHave = 0;
+        fDone = 0;
+        fBuf.resize(kChunk + 2*GEMConvert::kMaxHexGEB + 1);
+      }
+
+      void add(const unsigned char* p, size_t n, vector<size_t>& offsets) {
+        offsets.push_back(fOut.size());
+        offsets.push_back(n);
+        fOut.insert(fOut.end(), p, p + n);
+      }
+
+      ifstream fInpf;
+      int fLoops;
+      vector<unsigned char> fBuf, fOut;
+      size_t fHave;
+      bool fHex;
+      bool fSwap;      /*!<binary input in the other byte order */
+      size_t fDone;    /*!<bytes at the start of fBuf in host order */
+};
+
+//! Where the blocks go.
+class Sink {
+  public:
+
+      enum Kind { kStream, kDatagram, kShm };
+
+      Sink() : kind(kStream), fd(-1), ring(0), drop(false), nDropped(0) {}
+
+      bool open(const string& address, string& error) {
+        if (address == "-") { fd = 1; return true; }
+        if (address.compare(0, 4, "shm:") == 0) {
+          kind = kShm;
+          ring = GEMShmRing::Attach(address.substr(4), error);
+          return ring != 0;
+        }
+        if (address.compare(0, 5, "pipe:") == 0) {
+          string path = address.substr(5);
+          struct stat st;
+          if (stat(path.c_str(), &st) != 0 && mkfifo(path.c_str(), 0660) != 0) {
+            error = string("mkfifo: ") + strerror(errno);
+            return false;
+          }
+          fd = ::open(path.c_str(), O_WRONLY);   // waits for the reader
+          if (fd < 0) error = string("open: ") + strerror(errno);
+          return fd >= 0;
+        }
+        if (address.compare(0, 5, "file:") == 0) {
+          fd = ::open(address.substr(5).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+          if (fd < 0) error = string("open: ") + strerror(errno);
+          return fd >= 0;
+        }
+        GEMSocket sock(address);
+        fd = sock.Connect();
+        error = sock.error;
+        kind = sock.stream() ? kStream : kDatagram;
+        return fd >= 0;
+      }
+
+      //! Pipes and files take either format, sockets and shm binary GEB blocks.
+      static bool anyFormat(const string& address) {
+        return address == "-" || address.compare(0, 5, "pipe:") == 0 || address.compare(0, 5, "file:") == 0;
+      }
+
+      //! Send blocks [first, first+m), false on an error.
+      bool send(const vector<Block>& b, size_t first, size_t m) {
+        if (kind == kShm) {
+          for (size_t j = first; j < first + m; j++)
+            if (!ring->write(b[j].p, b[j].n, !drop)) nDropped++;
+          return true;
+        }
+        if (kind == kDatagram) {
+          vector<struct iovec> iov(m);
+          vector<struct mmsghdr> msgs(m);
+          memset(&msgs[0], 0, m*sizeof(struct mmsghdr));
+          for (size_t j = 0; j < m; j++) {
+            iov[j].iov_base = (void*)b[first + j].p;
+            iov[j].iov_len  = b[first + j].n;
+            msgs[j].msg_hdr.msg_iov = &iov[j];
+            msgs[j].msg_hdr.msg_iovlen = 1;
+          }
+          for (size_t sent = 0; sent < m; ) {
+            int k = sendmmsg(fd, &msgs[sent], m - sent, 0);
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) return false;
+            sent += k;
+          }
+          return true;
+        }
+        // byte streams: adjacent blocks go out as one iovec
+        vector<struct iovec> iov;
+        for (size_t j = first; j < first + m; j++) {
+          if (!iov.empty() && (const unsigned char*)iov.back().iov_base + iov.back().iov_len == b[j].p) {
+            iov.back().iov_len += b[j].n;
+          } else {
+            struct iovec v = { (void*)b[j].p, b[j].n };
+            iov.push_back(v);
+          }
+        }
+        return writeAll(iov);
+      }
+
+      void finish() {
+        if (ring) { ring->finish(); delete ring; ring = 0; return; }
+        if (kind == kDatagram) ::send(fd, "", 0, 0);
+        if (fd > 2) close(fd);
+      }
+
+      double fill() const { return ring ? (double)ring->used()/ring->capacity() : 0.; }
+      uint64_t overruns() const { return ring ? ring->overruns() : 0; }
+
+      Kind kind;
+      int fd;
+      GEMShmRing* ring;
+      bool drop;
+      uint64_t nDropped;
+
+  private:
+
+      bool writeAll(vector<struct iovec>& iov) {
+        size_t i = 0;
+        while (i < iov.size()) {
+          ssize_t w = writev(fd, &iov[i], min(iov.size() - i, (size_t)IOV_MAX));
+          if (w < 0 && errno == EINTR) continue;
+          if (w <= 0) return false;
+          while (i < iov.size() && (size_t)w >= iov[i].iov_len) { w -= iov[i].iov_len; i++; }
+          if (i < iov.size()) {
+            iov[i].iov_base = (char*)iov[i].iov_base + w;
+            iov[i].iov_len -= w;
+          }
+        }
+        return true;
+      }
+};
+
+//! main function.
+/*!
+C++ any documents
+*/
+
+int main(int argc, char** argv)
+{ cerr<<"---> Main()"<<endl;
+
+  string file = "DataParker.bin";
+  string address;
+  int batch = 64, loops = 1, format = 0;   // format: 0 as the input, 1 hex, 2 binary
+  double rate = 0., speed = 0., recorded = 0., onMs = 0., offMs = 0., reportSec = 1.;
+  double ramp0 = 0., rampFactor = 2., rampSec = 5., rampMax = 0.;
+  bool drop = false;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool more = (i+1 < argc);
+    if      (a == "-i"        && more) file      = argv[++i];
+    else if (a == "-o"        && more) address   = argv[++i];
+    else if (a == "-hex")              format    = 1;
+    else if (a == "-binary")           format    = 2;
+    else if (a == "-rate"     && more) rate      = atof(argv[++i]);
+    else if (a == "-speed"    && more) speed     = atof(argv[++i]);
+    else if (a == "-recorded" && more) recorded  = atof(argv[++i]);
+    else if (a == "-burst"    && more) sscanf(argv[++i], "%lf:%lf", &onMs, &offMs);
+    else if (a == "-loop"     && more) loops     = atoi(argv[++i]);
+    else if (a == "-ramp"     && more) sscanf(argv[++i], "%lf:%lf:%lf", &ramp0, &rampFactor, &rampSec);
+    else if (a == "-max"      && more) rampMax   = atof(argv[++i]);
+    else if (a == "-batch"    && more) batch     = atoi(argv[++i]);
+    else if (a == "-drop")             drop      = true;
+    else if (a == "-report"   && more) reportSec = atof(argv[++i]);
+    else {
+      cout << "unknown option " << a << endl;
+      return 1;
+    }
+  }
+  if (address.empty()) {
+    cout << "no output, use -o ADDRESS" << endl;
+    return 1;
+  }
+  if (speed > 0.) {
+    if (recorded <= 0.) {
+      cout << "-speed needs -recorded R, the raw data carry no time stamps" << endl;
+      return 1;
+    }
+    rate = speed*recorded;
+  }
+  if (ramp0 > 0.) rate = ramp0;
+  if (batch < 1) batch = 1;
+
+  Input in(file, loops);
+  if (!in.good()) {
+    cout << "\nThe file: " << file << " is missing.\n" << endl;
+    return 1;
+  }
+
+  Sink out;
+  out.drop = drop;
+  string error;
+  if (!out.open(address, error)) {
+    cout << "\nThe output: " << address << " " << error << "\n" << endl;
+    return 1;
+  }
+  bool outHex = Sink::anyFormat(address) ? (format ? format == 1 : in.hex()) : false;
+  cerr << "replay " << file << (in.hex() ? " (hex)" : in.swapped() ? " (binary, other byte order)" : " (binary)") << " to " << address
+       << (outHex ? " as hex" : " as binary");
+  if (rate > 0.) cerr << " at " << rate << " events/s";
+  if (onMs > 0.) cerr << ", bursts of " << onMs << " ms every " << onMs + offMs << " ms";
+  cerr << endl;
+
+  // pacing: "due" is the number of blocks the schedule allows so far, it
+  // grows only while the beam is on; due - sent is the lag
+  vector<Block> blocks;
+  size_t next = 0;
+  uint64_t sent = 0, nBytes = 0;
+  double due = 0.;
+  bool ok = true, saturated = false;
+  double sustained = 0.;
+
+  Clock::time_point t0 = Clock::now(), tLast = t0, tReport = t0, tStep = t0;
+  uint64_t sentReport = 0, sentStep = 0, overrunsStep = 0;
+  double dueStep = 0., maxFillStep = 0.;
+
+  while (ok) {
+    if (next == blocks.size()) {
+      if (!in.next(blocks, outHex)) break;
+      next = 0;
+      continue;
+    }
+
+    Clock::time_point now = Clock::now();
+    double t = chrono::duration<double>(now - t0).count();
+    double dt = chrono::duration<double>(now - tLast).count();
+    tLast = now;
+    double phase = onMs > 0. ? fmod(t*1000., onMs + offMs) : 0.;
+    bool beam = onMs <= 0. || phase < onMs;
+
+    if (!beam) {
+      // nothing is sent between bursts, whatever the rate
+      this_thread::sleep_for(chrono::duration<double>(min((onMs + offMs - phase)/1000., 0.01)));
+      continue;
+    }
+
+    size_t m = blocks.size() - next;
+    if (rate > 0.) {
+      due += rate*dt;
+      double allowed = due - sent;
+      if (allowed < 1.) {
+        this_thread::sleep_for(chrono::duration<double>(min((1. - allowed)/rate, 0.01)));
+        continue;
+      }
+      m = min(m, (size_t)allowed);
+    }
+    m = min(m, (size_t)batch);
+
+    ok = out.send(blocks, next, m);
+    for (size_t j = next; j < next + m; j++) nBytes += blocks[j].n;
+    next += m;
+    sent += m;
+    if (out.ring) maxFillStep = max(maxFillStep, out.fill());
+
+    if (reportSec > 0. && chrono::duration<double>(now - tReport).count() >= reportSec) {
+      double sec = chrono::duration<double>(now - tReport).count();
+      cerr << fixed << setprecision(1) << "t=" << t << " target=" << rate << " sent/s=" << (sent - sentReport)/sec
+           << " lag=" << (rate > 0. ? due - sent : 0.);
+      if (out.ring) cerr << " ring=" << setprecision(0) << 100.*out.fill() << "% overruns=" << out.overruns();
+      cerr << endl;
+      cerr.unsetf(ios::fixed);
+      tReport = now;
+      sentReport = sent;
+    }
+
+    // ramp: a step is sustained if nearly everything due was sent and the ring did not fill up
+    if (ramp0 > 0. && chrono::duration<double>(now - tStep).count() >= rampSec) {
+      double wanted = due - dueStep, done = sent - sentStep;
+      bool kept = done >= 0.98*wanted && maxFillStep < 0.5 && out.overruns() == overrunsStep;
+      cerr << "ramp: " << rate << " events/s " << (kept ? "sustained" : "NOT sustained")
+           << ", sent " << done/rampSec << " events/s";
+      if (out.ring) cerr << ", ring up to " << (int)(100.*maxFillStep) << "%, overruns " << out.overruns() - overrunsStep;
+      cerr << endl;
+      if (!kept) {
+        saturated = true;
+        break;
+      }
+      sustained = rate;
+      rate *= rampFactor;
+      if (rampMax > 0. && rate > rampMax) break;
+      due = sent;
+      tStep = now;
+      dueStep = due;
+      sentStep = sent;
+      overrunsStep = out.overruns();
+      maxFillStep = 0.;
+    }
+  }
+  out.finish();
+  double sec = chrono::duration<double>(Clock::now() - t0).count();
+
+  if (!ok) cout << "send error: " << strerror(errno) << endl;
+  cerr << "blocks " << sent << " bytes " << nBytes << " skipped bytes " << in.nSkipped;
+  if (out.kind == Sink::kShm) cerr << " dropped " << out.nDropped;
+  cerr << " in " << setprecision(3) << sec << " s, " << sent/(sec > 0 ? sec : 1e-9) << " events/s, "
+       << nBytes/1e6/(sec > 0 ? sec : 1e-9) << " MB/s" << endl;
+  if (ramp0 > 0.) {
+    cerr << "highest sustained rate " << sustained << " events/s";
+    if (!saturated) cerr << " (the reader never fell behind)";
+    cerr << endl;
+  }
+  return ok ? 0 : 1;
+}
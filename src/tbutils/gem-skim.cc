@@ -0,0 +1,250 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+#include <cstdint>
+#include <chrono>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GEMRaw.h"
+#include "GEMConvert.h"
+#include "GEMResync.h"
+#include "GEMView.h"
+#include "GEMWriter.h"
+#include "GEMBlockFile.h"
+#include "GEMRunFile.h"
+
+/**
+* ... Raw level skimmer: GEB blocks matching cheap predicates into a new file ...
+*/
+
+/*! \file */
+/*!
+  Copies the GEB blocks of a hex or binary file which match a selection
+  into a new file, unchanged and in the input format, without Event
+  objects or histograms. The input is mapped into memory and framed in one
+  pass (GEMConvert), every block is looked at through a GEMView: a ChipID
+  or control bits test reads 6 bytes per VFAT, the hits the data words,
+  only the CRC test reads the whole record.
+
+  g++ -O2 -std=c++11 gem-skim.cc -o gem-skim -lz <br>
+  ./gem-skim -i DataParker.bin -o bad.bin -control -any -crc <br>
+  ./gem-skim -i DataParker.dat -o chip68.dat -chip 68 -hits 10 <br>
+  ./gem-skim -i DataParker.bin -ec 10:20 -count
+
+  Options:
+    -i FILE       input file, hex or binary, the format is detected (DataParker.dat);
+                  a GEMBlockFile or GEMRunFile is read too, its blocks are written binary
+    -o FILE       output file (DataParker.skim)
+    -chip ID,...  some VFAT has one of these ChipIDs (hex)
+    -control      some VFAT has wrong control bits 1010/1100/1110
+    -crc          some VFAT has a CRC which is not the one of its data
+    -flag MASK    some VFAT has one of the Flag bits of MASK (hex) set
+    -ec LO:HI     EC of the first VFAT in [LO, HI]
+    -hits N       at least N hits in the GEB block
+    -any          keep a block passing any of the tests, by default all of them
+    -not          keep the blocks which are not selected
+    -count        only count, write nothing
+
+  Without -control the input is framed as gem-convert.cc does: a block
+  with wrong control bits is garbage and skipped. With it, such a block is
+  taken when the next block follows right after it, so it can be selected.
+  A block or run file holds only blocks which were framed when written.
+
+  \author Sergey.Baranov@cern.ch
+*/
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+//! What a GEB block is tested for.
+struct Selection {
+  GEMView::ChipSet chips;
+  bool byChip, control, crc, byEC, any, invert;
+  uint16_t flags;
+  int ecLo, ecHi, minHits;
+  Selection() : byChip(false), control(false), crc(false), byEC(false), any(false), invert(false),
+                flags(0), ecLo(0), ecHi(0), minHits(-1) {}
+
+  int nTests() const { return byChip + control + crc + byEC + (flags != 0) + (minHits >= 0); }
+
+  //! The cheap tests first, the CRC last; stops as soon as the answer is known.
+  bool pass(const GEMView::GEB& g) const {
+    bool sel = nTests() == 0 || !any;
+    if (nTests()) {
+      for (int t = 0; t < 6; t++) {
+        bool r;
+        switch (t) {
+          case 0: if (!byChip) continue;    r = g.hasChip(chips); break;
+          case 1: if (!control) continue;   r = !g.controlBitsOK(); break;
+          case 2: if (!flags) continue;     r = hasFlag(g); break;
+          case 3: if (!byEC) continue;      r = g.vfat(0).EC() >= ecLo && g.vfat(0).EC() <= ecHi; break;
+          case 4: if (minHits < 0) continue; r = g.nHits() >= minHits; break;
+          default: if (!crc) continue;      r = hasBadCRC(g); break;
+        }
+        if (r == any) { sel = any; break; }
+      }
+    }
+    return sel != invert;
+  }
+
+  bool hasFlag(const GEMView::GEB& g) const {
+    for (size_t i = 0; i < g.sumVFAT(); i++) if (g.vfat(i).Flag() & flags) return true;
+    return false;
+  }
+
+  static bool hasBadCRC(const GEMView::GEB& g) {
+    for (size_t i = 0; i < g.sumVFAT(); i++) if (!g.vfat(i).crcOK()) return true;
+    return false;
+  }
+};
+
+//! Counters of a skim.
+struct Stats {
+  uint64_t blocks, kept, skipped, bytes;
+  Stats() : blocks(0), kept(0), skipped(0), bytes(0) {}
+};
+
+//! The blocks of a mapped hex or binary file.
+static void skimRaw(const char* b, size_t n, bool hex, const Selection& sel, bool keepBad, GEMWriter* out, Stats& st) {
+  if (hex) {
+    auto block = [&](const char* text, size_t len, const uint64_t* words) {
+      unsigned char bin[GEMRaw::kMaxGEBSize];
+      GEMConvert::wordsToBinary(words, bin);
+      st.blocks++;
+      if (!sel.pass(GEMView::GEB(bin))) return;
+      st.kept++;
+      if (out) { out->put(text, len); out->endBlock(); }
+    };
+    size_t pos = GEMConvert::frameHex(b, n, st.skipped, block, ~(size_t)0, keepBad);
+    if (pos < n) {
+      // the last token may lack its new line
+      vector<char> tail(b + pos, b + n);
+      tail.push_back('\n');
+      size_t end = GEMConvert::frameHex(&tail[0], tail.size(), st.skipped, block, ~(size_t)0, keepBad);
+      st.skipped += tail.size() - end;
+    }
+  } else {
+    size_t pos = GEMConvert::frameBinary((const unsigned char*)b, n, st.skipped,
+      [&](const unsigned char* p, size_t size) {
+        st.blocks++;
+        if (!sel.pass(GEMView::GEB(p))) return;
+        st.kept++;
+        if (out) { out->put(p, size); out->endBlock(); }
+      }, ~(size_t)0, keepBad);
+    st.skipped += n - pos;
+  }
+  st.bytes = n;
+}
+
+//! The GEB blocks of a block or run file.
+template <class Reader> void skimBlocks(Reader& r, const Selection& sel, GEMWriter* out, Stats& st) {
+  size_t n = 0;
+  while (const unsigned char* p = r.nextGEB(n)) {
+    st.blocks++;
+    st.bytes += n;
+    if (!sel.pass(GEMView::GEB(p))) continue;
+    st.kept++;
+    if (out) { out->put(p, n); out->endBlock(); }
+  }
+  st.skipped = r.nSkipped;
+}
+
+int main(int argc, char** argv)
+{ cerr<<"---> Main()"<<endl;
+
+  string inFile = "DataParker.dat", outFile = "DataParker.skim";
+  Selection sel;
+  bool count = false;
+
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool more = (i+1 < argc);
+    if      (a == "-i"       && more) inFile  = argv[++i];
+    else if (a == "-o"       && more) outFile = argv[++i];
+    else if (a == "-chip"    && more) {
+      stringstream ids(argv[++i]);
+      string id;
+      while (getline(ids, id, ',')) sel.chips.set(strtoul(id.c_str(), 0, 16) & 0x0fff);
+      sel.byChip = true;
+    }
+    else if (a == "-control")         sel.control = true;
+    else if (a == "-crc")             sel.crc     = true;
+    else if (a == "-flag"    && more) sel.flags   = strtoul(argv[++i], 0, 16) & 0xf;
+    else if (a == "-ec"      && more) sel.byEC    = sscanf(argv[++i], "%d:%d", &sel.ecLo, &sel.ecHi) == 2;
+    else if (a == "-hits"    && more) sel.minHits = atoi(argv[++i]);
+    else if (a == "-any")             sel.any     = true;
+    else if (a == "-not")             sel.invert  = true;
+    else if (a == "-count")           count       = true;
+    else {
+      cout << "unknown option " << a << endl;
+      return 1;
+    }
+  }
+
+  GEMWriter writer;
+  GEMWriter* out = 0;
+  if (!count) {
+    if (!writer.open(outFile, false)) {
+      cout << "\nThe output: " << writer.error << "\n" << endl;
+      return 1;
+    }
+    out = &writer;
+  }
+
+  Stats st;
+  Clock::time_point t0 = Clock::now();
+  if (GEMBlockReader::IsBlockFile(inFile)) {
+    GEMBlockReader r(inFile);
+    if (!r.good()) { cout << "\n" << r.error << "\n" << endl; return 1; }
+    cerr << "skim " << inFile << " (blocks) to " << (out ? outFile : string("nothing")) << endl;
+    skimBlocks(r, sel, out, st);
+  } else if (GEMRunReader::IsRunFile(inFile)) {
+    GEMRunReader r(inFile);
+    if (!r.good()) { cout << "\n" << r.error << "\n" << endl; return 1; }
+    cerr << "skim " << inFile << " (run " << r.run().run << ") to " << (out ? outFile : string("nothing")) << endl;
+    skimBlocks(r, sel, out, st);
+  } else {
+    int fd = ::open(inFile.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+      cout << "\nThe file: " << inFile << " is missing.\n" << endl;
+      return 1;
+    }
+    size_t n = sb.st_size;
+    const char* b = 0;
+    if (n) {
+      void* m = mmap(0, n, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m == MAP_FAILED) {
+        cout << "\nmmap: " << strerror(errno) << "\n" << endl;
+        return 1;
+      }
+      madvise(m, n, MADV_SEQUENTIAL);
+      b = (const char*)m;
+    }
+    // hex files are whitespace and hex digits only
+    bool hex = n > 0;
+    for (size_t i = 0; i < n && i < 64; i++) hex &= (GEMResync::isSpace(b[i]) || GEMResync::hexDigit(b[i]) >= 0);
+    cerr << "skim " << inFile << (hex ? " (hex)" : " (binary)") << " to " << (out ? outFile : string("nothing")) << endl;
+    skimRaw(b, n, hex, sel, sel.control, out, st);
+    if (n) munmap((void*)b, n);
+    ::close(fd);
+  }
+  if (out && !writer.close()) {
+    cout << "\nThe output: " << writer.error << "\n" << endl;
+    return 1;
+  }
+
+  double sec = chrono::duration<double>(Clock::now() - t0).count();
+  cerr << " " << st.kept << " of " << st.blocks << " GEB blocks kept, " << st.skipped << " bytes skipped" << endl;
+  cerr << " " << fixed << setprecision(2) << sec << " s, " << (sec > 0. ? st.bytes/sec/1e6 : 0.) << " MB/s" << endl;
+  return 0;
+}